@@ -0,0 +1,455 @@
+/*
+	This file implements micro benchmarks of the ray tracing kernels.
+
+	Usage: benchmark model [results.json] [repeats] [rays]
+
+	The rays are generated from a fixed seed, so every run (and every version
+	of the ray tracer) measures the same ray set. Each kernel is run once to
+	warm up and then the given number of times; the mean and the variance of
+	ns/op over the repeats are reported. On Linux the retired instructions per
+	operation are counted as well (if the kernel allows the performance
+	counters, otherwise -1 is reported). The results are printed as a table
+	and saved as JSON, so they can be compared between versions.
+*/
+
+// C++ headers
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <chrono>
+#ifdef __linux__
+#include <cstring>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+// Project headers
+#include "Vector3d.h"
+#include "Camera.h"
+#include "Shape.h"
+#include "Ray.h"
+#include "Chess.h"
+#include "RayTracer.h"
+#include "Primitives.h"
+
+using namespace std;
+
+//! Pseudo random sequence (xorshift), the same on every platform
+class RandomSequence
+{
+public:
+	RandomSequence(unsigned long long seed) : state_(seed) { }
+
+	//! Returns a number from <0.0, 1.0)
+	double next() {
+		state_ ^= state_ << 13;
+		state_ ^= state_ >> 7;
+		state_ ^= state_ << 17;
+		return (state_ >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	//! Returns an integer from <0, n)
+	int nextInt(int n) { return min((int)(next() * n), n - 1); }
+
+private:
+	unsigned long long state_;
+};
+
+//! Counter of the instructions retired by the process (user space only)
+class InstructionCounter
+{
+public:
+	InstructionCounter() : fd_(-1) {
+#ifdef __linux__
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		fd_ = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+	}
+
+	~InstructionCounter() {
+#ifdef __linux__
+		if(fd_ >= 0) close(fd_);
+#endif
+	}
+
+	bool available() const { return fd_ >= 0; }
+
+	void start() {
+#ifdef __linux__
+		if(fd_ < 0) return;
+		ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+	}
+
+	//! Returns the instructions since start(), -1 if not available
+	long long stop() {
+#ifdef __linux__
+		long long count = 0;
+		if(fd_ < 0) return -1;
+		ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+		if(read(fd_, &count, sizeof(count)) != sizeof(count)) return -1;
+		return count;
+#else
+		return -1;
+#endif
+	}
+
+private:
+	int fd_;
+};
+
+//! Rays aimed at random triangles of the chess pieces
+struct RaySet
+{
+	vector<Ray> rays;			// primary-like rays from around the board
+	vector<Ray> shadowRays;		// rays from the targeted points towards the light
+	vector<Triangle *> tris;	// triangle targeted by the ray
+	vector<int> objects;		// object of the targeted triangle
+};
+
+//! Measurements of one kernel
+struct Result
+{
+	string name;
+	long long ops;				// operations per repeat
+	vector<double> nsPerOp;		// one value per repeat
+	double instructionsPerOp;	// measured on the warm up run, -1 if not available
+	double checksum;			// result of the kernel (hits), equal between versions
+
+	double mean() const {
+		double sum = 0.0;
+		for(int i = 0; i < (int)nsPerOp.size(); i++) sum += nsPerOp[i];
+		return sum / nsPerOp.size();
+	}
+
+	double variance() const {
+		double m = mean(), sum = 0.0;
+		for(int i = 0; i < (int)nsPerOp.size(); i++) sum += (nsPerOp[i] - m) * (nsPerOp[i] - m);
+		return (nsPerOp.size() > 1) ? sum / (nsPerOp.size() - 1) : 0.0;
+	}
+};
+
+class Benchmark
+{
+public:
+	Benchmark(unsigned repeats) : repeats_(repeats) { }
+	~Benchmark() { }
+
+	//! Measures the kernel, which performs ops operations and returns a checksum of its results
+	template<typename Kernel>
+	void run(string name, long long ops, Kernel kernel);
+
+	void print(ostream& os);
+	void writeJson(ostream& os, string& modelFile, int rays);
+
+private:
+	unsigned repeats_;
+	vector<Result> results_;
+	InstructionCounter instructions_;
+};
+
+template<typename Kernel>
+inline void Benchmark::run(string name, long long ops, Kernel kernel)
+{
+	Result result;
+	result.name = name;
+	result.ops = ops;
+	instructions_.start();
+	result.checksum = kernel();		// warm up
+	long long instructions = instructions_.stop();
+	result.instructionsPerOp = (instructions >= 0) ? (double)instructions / ops : -1.0;
+
+	for(unsigned i = 0; i < repeats_; i++) {
+		chrono::high_resolution_clock::time_point tStart = chrono::high_resolution_clock::now();
+		double checksum = kernel();
+		chrono::high_resolution_clock::time_point tEnd = chrono::high_resolution_clock::now();
+
+		result.nsPerOp.push_back(chrono::duration<double, nano>(tEnd - tStart).count() / ops);
+		if(checksum != result.checksum)
+			cerr << "WARNING: " << name << " is not deterministic" << endl;
+	}
+
+	results_.push_back(result);
+	cout << setw(32) << left << name << setw(12) << right << fixed << setprecision(1) << result.mean() << " ns/op" << endl;
+}
+
+inline void Benchmark::print(ostream& os)
+{
+	os << endl << setw(32) << left << "kernel" << setw(12) << right << "ns/op" << setw(12) << "stddev" << setw(16) << "rays/s" << setw(12) << "instr/op" << endl;
+	for(int i = 0; i < (int)results_.size(); i++) {
+		Result& r = results_.at(i);
+		os << setw(32) << left << r.name << setw(12) << right << fixed << setprecision(1) << r.mean()
+		   << setw(12) << sqrt(r.variance()) << setw(16) << setprecision(0) << 1e9 / r.mean();
+		if(r.instructionsPerOp >= 0.0)	os << setw(12) << setprecision(1) << r.instructionsPerOp << endl;
+		else							os << setw(12) << "n/a" << endl;
+	}
+}
+
+inline void Benchmark::writeJson(ostream& os, string& modelFile, int rays)
+{
+	os << "{\n"
+	   << "  \"model\": \"" << modelFile << "\",\n"
+	   << "  \"rays\": " << rays << ",\n"
+	   << "  \"repeats\": " << repeats_ << ",\n"
+	   << "  \"benchmarks\": [\n";
+
+	for(int i = 0; i < (int)results_.size(); i++) {
+		Result& r = results_.at(i);
+		os << "    { \"name\": \"" << r.name << "\", \"ops\": " << r.ops
+		   << setprecision(6) << resetiosflags(ios::floatfield)
+		   << ", \"nsPerOp\": " << r.mean() << ", \"nsPerOpVariance\": " << r.variance()
+		   << ", \"nsPerOpStddev\": " << sqrt(r.variance()) << ", \"raysPerSecond\": " << 1e9 / r.mean()
+		   << ", \"instructionsPerOp\": " << r.instructionsPerOp
+		   << ", \"checksum\": " << setprecision(17) << r.checksum << " }"
+		   << ((i + 1 < (int)results_.size()) ? ",\n" : "\n");
+	}
+
+	os << "  ]\n}\n";
+}
+
+//! Generates the rays aimed at uniformly chosen triangles of the pieces
+void generateRays(ModelChess& model, int count, Point& light, RaySet& set)
+{
+	RandomSequence random(0x5eed1234abcdULL);
+
+	// center and size of the board
+	Vector3d cmin(INFINITY, INFINITY, INFINITY), cmax(-INFINITY, -INFINITY, -INFINITY);
+	for(int i = 0; i < (int)model.objects_.size(); i++) {
+		for(int j = 0; j < (int)model.objects_.at(i).shapes.size(); j++) {
+			Vector3d mn = model.objects_.at(i).shapes.at(j)->minCoords();
+			Vector3d mx = model.objects_.at(i).shapes.at(j)->maxCoords();
+			cmin = Vector3d(min(cmin.x_, mn.x_), min(cmin.y_, mn.y_), min(cmin.z_, mn.z_));
+			cmax = Vector3d(max(cmax.x_, mx.x_), max(cmax.y_, mx.y_), max(cmax.z_, mx.z_));
+		}
+	}
+	Vector3d center = (cmin + cmax) * 0.5;
+	double radius = (cmax - cmin).length();
+
+	for(int i = 0; i < count; i++) {
+		int obj = random.nextInt(ModelChess::CHESS_PIECES_COUNT);
+		Object& object = model.objects_.at(obj);
+		Triangle* tri = (Triangle *)object.shapes.at(random.nextInt((int)object.shapes.size()));
+
+		// random point of the triangle
+		double u = random.next(), v = random.next();
+		if(u + v > 1.0) { u = 1.0 - u; v = 1.0 - v; }
+		Vector3d e1 = tri->v1 - tri->v0;
+		Vector3d e2 = tri->v2 - tri->v0;
+		Point target = tri->v0 + e1 * u + e2 * v;
+
+		// origin on the upper hemisphere around the board
+		double phi = 2.0 * 3.14159265358979323846 * random.next();
+		double cosTheta = random.next();
+		double sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+		Point origin = center + Vector3d(cos(phi) * sinTheta, sin(phi) * sinTheta, cosTheta) * radius;
+
+		Vector3d n = e1.cross(e2).normalize();
+		if(n.dot(origin - target) < 0.0) n = -n;
+		Point shadowOrigin = target + n * 0.00001;
+
+		set.rays.push_back(Ray(origin, (target - origin).normalize(), true));
+		set.shadowRays.push_back(Ray(shadowOrigin, (light - shadowOrigin).normalize(), true));
+		set.tris.push_back(tri);
+		set.objects.push_back(obj);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if(argc < 2) {
+		cerr << "Usage: benchmark model [results.json] [repeats] [rays]" << endl;
+		exit(1);
+	}
+
+	string modelFile(argv[1]);
+	string outputFile = (argc > 2) ? argv[2] : "benchmark.json";
+	unsigned repeats = (argc > 3) ? atoi(argv[3]) : 10;
+	int count = (argc > 4) ? atoi(argv[4]) : 20000;
+
+	ModelChess model(modelFile);
+	Point light(0.5, 1.2, 2.7);
+	RaySet set;
+	generateRays(model, count, light, set);
+
+	// bounding spheres of the pieces
+	vector<Sphere> spheres;
+	for(int i = 0; i < (int)ModelChess::CHESS_PIECES_COUNT; i++) {
+		Object& object = model.objects_.at(i);
+		Vector3d cmin(INFINITY, INFINITY, INFINITY), cmax(-INFINITY, -INFINITY, -INFINITY);
+		for(int j = 0; j < (int)object.shapes.size(); j++) {
+			Vector3d mn = object.shapes.at(j)->minCoords();
+			Vector3d mx = object.shapes.at(j)->maxCoords();
+			cmin = Vector3d(min(cmin.x_, mn.x_), min(cmin.y_, mn.y_), min(cmin.z_, mn.z_));
+			cmax = Vector3d(max(cmax.x_, mx.x_), max(cmax.y_, mx.y_), max(cmax.z_, mx.z_));
+		}
+		Point c = (cmin + cmax) * 0.5;
+		spheres.push_back(Sphere(c, (cmax - cmin).length() * 0.5, NULL));
+	}
+
+	Material lightMaterial(Vector3d(1.0, 1.0, 1.0), 0.0, 0.0, 0.0, 0.0);
+	Light lightSphere(light, 0.0, &lightMaterial);
+	Camera camera(Vector3d(-6.0, -3.0, 6.0), Vector3d(0.5, 0.7, -0.3), 640, 480, 45);
+	RayTracer rayTracer(camera, lightSphere, &model);
+	RayTracer::Context ctx;
+	ctx.camera = &camera;
+
+	Benchmark benchmark(repeats);
+	cout << "Running " << count << " rays, " << repeats << " repeats..." << endl;
+
+	benchmark.run("Triangle::intersects", count, [&]() {
+		Shape::Intersection is;
+		double hits = 0;
+		for(int i = 0; i < count; i++)
+			if(set.tris[i]->intersects(set.rays[i], is)) hits++;
+		return hits;
+	});
+
+	benchmark.run("Sphere::intersects", count, [&]() {
+		Shape::Intersection is;
+		double hits = 0;
+		for(int i = 0; i < count; i++)
+			if(spheres[set.objects[i]].intersects(set.rays[i], is)) hits++;
+		return hits;
+	});
+
+	benchmark.run("Object::intersectsBoundingBox", count, [&]() {
+		double hits = 0;
+		for(int i = 0; i < count; i++)
+			if(model.objects_.at(set.objects[i]).intersectsBoundingBox(set.rays[i])) hits++;
+		return hits;
+	});
+
+	benchmark.run("RayTracer::closestHit", count, [&]() {
+		Shape::Intersection is;
+		double hits = 0;
+		for(int i = 0; i < count; i++)
+			if(rayTracer.closestHit(ctx, set.rays[i], is)) hits++;
+		return hits;
+	});
+
+	benchmark.run("RayTracer::occluded", count, [&]() {
+		double hits = 0;
+		for(int i = 0; i < count; i++)
+			if(rayTracer.occluded(ctx, set.shadowRays[i])) hits++;
+		return hits;
+	});
+
+	// closest hit of all the shapes of the targeted object - virtual call vs. type-sorted arrays
+	vector<PrimitiveSet> sorted(ModelChess::CHESS_PIECES_COUNT);
+	long long tests = 0;
+	for(int i = 0; i < (int)sorted.size(); i++)
+		sorted.at(i).build(model.objects_.at(i).shapes);
+	for(int i = 0; i < count; i++)
+		tests += model.objects_.at(set.objects[i]).shapes.size();
+
+	benchmark.run("Shape::intersects(virtual)", tests, [&]() {
+		double sum = 0.0;
+		for(int i = 0; i < count; i++) {
+			vector<Shape *>& shapes = model.objects_.at(set.objects[i]).shapes;
+			Shape::Intersection is, isC;
+			isC.t = INFINITY;
+			for(int j = 0; j < (int)shapes.size(); j++)
+				if(shapes[j]->intersects(set.rays[i], is) && is.t < isC.t) isC = is;
+			if(isC.t < INFINITY) sum += isC.t;
+		}
+		return sum;
+	});
+
+	benchmark.run("PrimitiveSet::closest", tests, [&]() {
+		double sum = 0.0;
+		for(int i = 0; i < count; i++) {
+			Shape::Intersection isC;
+			isC.t = INFINITY;
+			if(sorted.at(set.objects[i]).closest(set.rays[i], isC)) sum += isC.t;
+		}
+		return sum;
+	});
+
+	// vector math of the shading of the targeted points (Phong terms, reflected and refracted directions)
+	Vector3d view(-6.0, -3.0, 6.0);
+	vector<Vector3d> normals;
+	for(int i = 0; i < count; i++) {
+		Triangle* tri = set.tris[i];
+		Vector3d n = (tri->v1 - tri->v0).cross(tri->v2 - tri->v0).normalize();
+		normals.push_back(n.dot(set.rays[i].getDir()) > 0.0 ? -n : n);
+	}
+
+	benchmark.run("shading", count, [&]() {
+		double sum = 0.0;
+		for(int i = 0; i < count; i++) {
+			const Vector3d& n = normals[i];
+			const Vector3d& dir = set.rays[i].getDir();
+			Point isect = set.shadowRays[i].getStart();
+			Vector3d lv = (light - isect).normalize();
+			Vector3d V = (view - isect).normalize();
+			double Id = lv.dot(n) * 3.5;
+			Vector3d R = (-lv).reflect(n);
+			double Is = R.dot(V) * 5.0;
+			Vector3d reflected = dir.reflect(n);
+			Vector3d refracted(0.0);
+			dir.refract(n, 1.0 / 1.5, refracted);
+			Vector3d color = Vector3d(0.8, 0.7, 0.6) * (Id + Is) + reflected * 0.2 + refracted * 0.1;
+			sum += color.x_ + color.y_ + color.z_;
+		}
+		return sum;
+	});
+
+	benchmark.run("Vector3d::reflect", count, [&]() {
+		double sum = 0.0;
+		for(int i = 0; i < count; i++)
+			sum += set.rays[i].getDir().reflect(normals[i]).z_;
+		return sum;
+	});
+
+	benchmark.run("Vector3d::refract", count, [&]() {
+		double sum = 0.0;
+		Vector3d refracted;
+		for(int i = 0; i < count; i++)
+			if(set.rays[i].getDir().refract(normals[i], 1.0 / 1.5, refracted)) sum += refracted.z_;
+		return sum;
+	});
+
+	// primary rays of the whole screen, tile by tile
+	long long pixels = camera.getScreenWidth() * camera.getScreenHeight();
+	auto generatePrimary = [&]() {
+		RayBatch batch;
+		double sum = 0.0;
+		for(int y = 0; y < (int)camera.getScreenHeight(); y += TileScheduler::TILE_SIZE) {
+			for(int x = 0; x < (int)camera.getScreenWidth(); x += TileScheduler::TILE_SIZE) {
+				Tile tile(x, y, min(TileScheduler::TILE_SIZE, (int)camera.getScreenWidth() - x),
+							 min(TileScheduler::TILE_SIZE, (int)camera.getScreenHeight() - y));
+				camera.generateRays(tile, batch);
+				sum += batch.x[0];
+			}
+		}
+		return sum;
+	};
+	benchmark.run("Camera::generateRays", pixels, generatePrimary);
+	camera.prepareRays();
+	benchmark.run("Camera::generateRays(cached)", pixels, generatePrimary);
+
+	benchmark.print(cout);
+
+	ofstream ofs(outputFile);
+	if(ofs.fail()) {
+		cerr << "ERROR: The file " << outputFile << " cannot be opened." << endl;
+		exit(1);
+	}
+	benchmark.writeJson(ofs, modelFile, count);
+	cout << "Results saved to " << outputFile << endl;
+
+	return 0;
+}
@@ -10,6 +10,18 @@
 #include "Camera.h"
 #include "Shape.h"
 #include "Ray.h"
+#include "Model.h"
+#include "Rasterizer.h"
+#include "Scheduler.h"
+#include "RayTracer.h"
+#include "Decimator.h"
+#include "Arena.h"
+#include "Primitives.h"
+#include "BoardGrid.h"
+#include "Bvh.h"
+#include "SceneDescription.h"
+#include "RenderServer.h"
+#include "TileFarm.h"
 
 using namespace std;
 
@@ -113,6 +125,28 @@ void testVector()
 
 	Test::assertTrue(v6 == v4 + v5, 
 		string("Wrong implementation of operator+="));
+
+	// -- test 9 -- reflect
+	Vector3d d = Vector3d(1.0, 0.0, -1.0).normalize();
+	Vector3d up(0.0, 0.0, 1.0);
+	Test::assertTrue(d.reflect(up) == Vector3d(d.x_, 0.0, -d.z_), 
+		string("Wrong implementation of reflect()"));
+
+	// -- test 10 -- refract (Snell's law), total internal reflection
+	Vector3d t;
+	Test::assertTrue(d.refract(up, 1.0, t) && t == d, 
+		string("Wrong refraction with the same indices"));
+	Test::assertTrue(d.refract(up, 1.0 / 1.5, t) && eq(t.length(), 1.0) && eq(t.x_ * 1.5, d.x_), 
+		string("Wrong implementation of refract()"));
+	Test::assertTrue(!d.refract(up, 1.5, t), 
+		string("Total internal reflection not detected"));
+
+	// -- test 11 -- fresnel (4 % of glass at normal incidence from both sides, everything on total internal reflection)
+	Vector3d down(0.0, 0.0, -1.0);
+	Test::assertTrue(eq(down.fresnel(up, 1.0 / 1.5), 0.04) && eq(down.fresnel(up, 1.5), 0.04) && eq(d.fresnel(up, 1.0), 0.0),
+		string("Wrong implementation of fresnel()"));
+	Test::assertTrue(d.fresnel(up, 1.0 / 1.5) > 0.04 && d.fresnel(up, 1.0 / 1.5) < 0.1 && d.fresnel(up, 1.5) == 1.0,
+		string("Wrong reflectance at 45 degrees"));
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -124,6 +158,120 @@ void testCamera()
 	double pxStep = c.getPxStep();	
 
 	Test::assertTrue(eq(pxStep, 0.01), string("eq(pxStep, 0.01)"));
+
+	// -- test 2 -- projection of the pixel centers
+	Camera c2(Vector3d(-6.0, -3.0, 6.0), Vector3d(4.0, 3.0, -2.0), 160, 120, 45);
+	double x, y, depth;
+	Point px = c2.getTopLeftPX() + 7.0 * c2.getWidthStep() + 3.0 * c2.getHeightStep();
+
+	Test::assertTrue(c2.project(px, x, y, depth) && eq(x, 7.0) && eq(y, 3.0), string("wrong projection of pixel center"));
+	Point behind = c2.position() - c2.direction();
+	Test::assertTrue(!c2.project(behind, x, y, depth), string("point behind camera projected"));
+
+	// -- test 3 -- primary rays generator
+	Tile tile(5, 2, 4, 3);
+	RayBatch computed, cached;
+	c2.generateRays(tile, computed);
+	Vector3d expected = px - c2.position();
+	Test::assertTrue(computed.size() == 12 && computed.direction(1 * 4 + 2) == expected.normalize(), 
+		string("wrong primary ray direction"));
+
+	c2.prepareRays();
+	c2.generateRays(tile, cached);
+	Test::assertTrue(cached.x == computed.x && cached.y == computed.y && cached.z == computed.z, 
+		string("cached rays differ from computed"));
+
+	// -- test 4 -- jittered samples stay within the pixel
+	c2.setJitter(Camera::JITTER_STRATIFIED, 4);
+	bool inPixel = true;
+	for(unsigned s = 0; s < c2.getSamplesPerPixel(); s++) {
+		Tile one(7, 3, 1, 1);
+		c2.generateRays(one, computed, s);
+		Point p = c2.position() + computed.direction(0);
+		c2.project(p, x, y, depth);
+		if(fabs(x - 7.0) > 0.5 || fabs(y - 3.0) > 0.5) inPixel = false;
+	}
+	Test::assertTrue(c2.getSamplesPerPixel() == 4 && inPixel, string("jittered sample outside of pixel"));
+
+	// -- test 5 -- crop window clipped by the screen, its cached rays are the rays of the screen
+	c2.setJitter(Camera::JITTER_NONE, 1);
+	c2.setCrop(Tile(150, 100, 40, 40));
+	Tile crop = c2.getCrop();
+	Test::assertTrue(crop.x == 150 && crop.y == 100 && c2.getImageWidth() == 10 && c2.getImageHeight() == 20, string("wrong crop window"));
+	Tile inCrop(152, 105, 4, 3);
+	c2.generateRays(inCrop, computed);
+	c2.prepareRays();
+	c2.generateRays(inCrop, cached);
+	Test::assertTrue(cached.x == computed.x && cached.y == computed.y && cached.z == computed.z, string("cached rays of crop window differ"));
+	c2.clearCrop();
+	Test::assertTrue(c2.getImageWidth() == 160 && c2.getImageHeight() == 120, string("crop window not cleared"));
+}
+
+///////////////////////////////////////////////////////////////////////////
+////	RASTERIZER.H
+class TestModel: public Model
+{
+public:
+	virtual void load(string fileName) { }
+};
+
+class TestGridModel: public TestModel
+{
+public:
+	virtual BoardGrid* getGrid() { return &grid; }
+	BoardGrid grid;
+};
+
+void testRasterizer()
+{
+	Material mat(Vector3d(0.5, 0.5, 0.5), 0.0, 0.0, 0.0, 4.0);
+	Vector3d n(0.0, -1.0, 0.0);
+	TestModel model;
+	model.objects_.push_back(Object());
+	model.objects_.at(0).shapes.push_back(new Triangle(Point(-1.0, 5.0, -1.0), Point(1.0, 5.0, -1.0), Point(0.0, 5.0, 1.0), n, n, n, &mat));
+	model.objects_.at(0).shapes.push_back(new Triangle(Point(-1.0, 3.0, -1.0), Point(1.0, 3.0, -1.0), Point(0.0, 3.0, 1.0), n, n, n, &mat));
+
+	Camera c(Vector3d(0.0, 0.0, 0.0), Vector3d(0.0, 1.0, 0.0), 100, 100, 90);
+	Rasterizer r(c, &model);
+
+	// -- test 1 -- closer triangle wins
+	Test::assertTrue(r.rasterize(), string("triangle model should be rasterized"));
+	Test::assertTrue(r.at(50, 50) == model.objects_.at(0).shapes.at(1), string("wrong closest triangle"));
+	Test::assertTrue(r.at(0, 0) == NULL && r.at(99, 99) == NULL, string("empty pixel covered"));
+
+	// -- test 2 -- outline pixels are ray traced
+	Test::assertTrue(!r.needsTrace(50, 50) && !r.needsTrace(0, 0), string("inner pixel marked as outline"));
+
+	// -- test 3 -- visibility buffer agrees with ray casting
+	bool agrees = true;
+	for(int i = 0; i < 100; i++) {
+		for(int j = 0; j < 100; j++) {
+			Point px = c.getTopLeftPX() + j * c.getWidthStep() + i * c.getHeightStep();
+			Ray ray(c.position(), px - c.position());
+			Shape::Intersection is, isC;
+			isC.t = INFINITY;
+			for(int k = 0; k < 2; k++)
+				if(model.objects_.at(0).shapes.at(k)->intersects(ray, is) && is.t < isC.t) isC = is;
+			Shape* expected = (isC.t < INFINITY) ? isC.obj : NULL;
+			if(!r.needsTrace(j, i) && r.at(j, i) != expected) agrees = false;
+		}
+	}
+	Test::assertTrue(agrees, string("visibility buffer differs from ray casting"));
+
+	// -- test 4 -- crop window equals the same region of the full image (the outlines at its border as well)
+	Light light(Vector3d(0.0, -1.0, 0.0), 0.0, &mat);
+	RayTracer rt(c, light, &model);
+	rt.setRasterizePrimary(true);
+	rt.setThreads(1);
+	vector<Vector3d> full(100 * 100), cropped(23 * 41);
+	rt.render(&full[0]);
+	rt.camera_->setCrop(Tile(45, 30, 23, 41));
+	rt.render(&cropped[0]);
+	bool same = true;
+	for(int i = 0; i < 41; i++)
+		for(int j = 0; j < 23; j++)
+			same = same && cropped.at(i * 23 + j) == full.at((30 + i) * 100 + 45 + j);
+	Test::assertTrue(same && rt.getStats().primaryRays == 23 * 41, string("crop window differs from full image"));
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -150,6 +298,911 @@ void testSphere()
 	Test::assertTrue(isectInfo.normal == Vector3d(1.0, 1.0, 1.0).normalize(), string("wrong normal vector"));	
 }	
 
+///////////////////////////////////////////////////////////////////////////
+////	SCHEDULER.H
+void testScheduler()
+{
+	TileScheduler scheduler;
+	scheduler.addView(0, 70, 40, 32);
+	scheduler.addView(1, 10, 10, 32);
+
+	// -- test 1 -- tiles cover the screens
+	Test::assertTrue(scheduler.size() == 7, string("wrong number of tiles"));
+
+	// -- test 2 -- each tile is rendered exactly once
+	vector<int> covered(70 * 40 + 10 * 10, 0);
+	scheduler.run(3, [&](unsigned /*threadIdx*/) {
+		TileScheduler::Task task;
+		while(scheduler.next(task))
+			for(int i = task.tile.y; i < task.tile.y + task.tile.height; i++)
+				for(int j = task.tile.x; j < task.tile.x + task.tile.width; j++)
+					covered[task.view * 70 * 40 + i * (task.view ? 10 : 70) + j]++;
+	});
+
+	bool once = true;
+	for(int i = 0; i < (int)covered.size(); i++)
+		if(covered[i] != 1) once = false;
+	Test::assertTrue(once, string("pixel not rendered exactly once"));
+}
+
+///////////////////////////////////////////////////////////////////////////
+////	IMAGEWRITER.H
+class MemoryWriter: public ImageWriter
+{
+public:
+	MemoryWriter() : ImageWriter(OutputFormat()) { }
+	virtual bool open(string& fileName, int width, int height) { width_ = width; height_ = height; return true; }
+	virtual void writeRows(Vector3d* rows, int count) { 
+		rows_.insert(rows_.end(), rows, rows + count * width_);
+		rowsWritten_ += count;
+	}
+	virtual void close() { }
+	vector<Vector3d> rows_;
+};
+
+void testImageWriter()
+{
+	// -- test 1 -- CRC of the PNG chunks
+	const unsigned char iend[] = { 'I', 'E', 'N', 'D' };
+	Test::assertTrue(PngWriter::crc32(0, iend, 4) == 0xae426082u, string("wrong CRC-32"));
+
+	// -- test 2 -- bands are written in order of rows
+	MemoryWriter writer;
+	string name("memory");
+	writer.open(name, 40, 70);
+	BandWindow window(&writer, 40, 70, 2);
+	
+	int bands[] = { 1, 0, 0, 2, 1, 2 };	// two tiles per band, finished out of order
+	for(int k = 0; k < 6; k++) {
+		int band = bands[k];
+		Vector3d* rows = window.acquire(band);
+		for(int i = 0; i < window.getBandHeight(); i++)
+			for(int j = 0; j < 40; j++)
+				rows[i * 40 + j] = Vector3d(band * window.getBandHeight() + i);
+		window.finishTile(band);
+	}
+
+	bool ordered = writer.getRowsWritten() == 70;
+	for(int i = 0; i < (int)writer.rows_.size(); i++)
+		if(writer.rows_.at(i).x_ != i / 40) ordered = false;
+	Test::assertTrue(ordered, string("rows not written in order"));
+
+	// -- test 3 -- quantization rounds and clamps
+	Vector3d px[2] = { Vector3d(0.5, -1.0, 2.0), Vector3d(0.0, 1.0, 0.2) };
+	unsigned char out8[6];
+	Quantizer q8;
+	q8.quantize(px, 2, out8);
+	Test::assertTrue(out8[0] == 128 && out8[1] == 0 && out8[2] == 255 && 
+					 out8[3] == 0 && out8[4] == 255 && out8[5] == 51, string("wrong 8-bit quantization"));
+
+	unsigned char out16[12];
+	Quantizer q16(16);
+	q16.quantize(px, 2, out16);
+	Test::assertTrue(out16[0] == 0x80 && out16[1] == 0x00 && out16[4] == 0xff && out16[5] == 0xff, 
+					 string("wrong 16-bit quantization"));
+
+	// -- test 4 -- gamma correction
+	Vector3d grey(0.5);
+	Quantizer qGamma(8, 2.2);
+	qGamma.quantize(&grey, 1, out8);
+	Test::assertTrue(out8[0] == 186, string("wrong gamma correction"));
+
+	// -- test 5 -- gamma keeps the dark tones (no rounding to the linear 16-bit value first)
+	Vector3d dark[2] = { Vector3d(1e-6, 0.5, 0.0), Vector3d(5e-6) };
+	Quantizer qGamma16(16, 2.2);
+	qGamma16.quantize(dark, 1, out16);
+	qGamma.quantize(dark + 1, 1, out8);
+	Test::assertTrue(out16[0] == 0 && out16[1] == 123 && (out16[2] << 8 | out16[3]) == 47824 && out16[4] == 0 && out16[5] == 0 && out8[0] == 1,
+					 string("dark tones lost by gamma correction"));
+}
+
+///////////////////////////////////////////////////////////////////////////
+////	STATS.H
+void testStats()
+{
+	// -- test 1 -- merging of the thread counters
+	RenderStats a, b;
+	a.primaryRays = 10; a.shadowRays = 4; a.tracingTime = 1.0;
+	b.primaryRays = 5; b.reflectionRays = 2; b.tracingTime = 0.5;
+	a.merge(b);
+	Test::assertTrue(a.primaryRays == 15 && a.rays() == 21 && a.tracingTime == 1.5, string("wrong merge"));
+
+	// -- test 2 -- counters of the rendering
+	Material mat(Vector3d(0.5, 0.5, 0.5), 0.0, 0.0, 0.0, 4.0);
+	Material lightMat(Vector3d(1.0, 1.0, 1.0), 0.0, 0.0, 0.0, 0.0);
+	Vector3d n(0.0, -1.0, 0.0);
+	TestModel model;
+	model.objects_.push_back(Object());
+	model.objects_.at(0).shapes.push_back(new Triangle(Point(-10.0, 3.0, -10.0), Point(10.0, 3.0, -10.0), Point(0.0, 3.0, 10.0), n, n, n, &mat));
+
+	Camera c(Vector3d(0.0, 0.0, 0.0), Vector3d(0.0, 1.0, 0.0), 10, 10, 90);
+	Light light(Vector3d(0.0, -1.0, 0.0), 0.0, &lightMat);
+	RayTracer rt(c, light, &model);
+	rt.setThreads(2);
+	vector<Vector3d> image(100);
+	rt.render(&image[0]);
+
+	RenderStats& stats = rt.getStats();
+	Test::assertTrue(stats.primaryRays == 100 && stats.hits == 100, string("wrong primary ray counts"));
+	Test::assertTrue(stats.shadowRays == 100 && stats.rays() == 200, string("wrong shadow ray counts"));
+	// the shadow rays leave the plane of the triangle away from its box, the hierarchy culls them
+	Test::assertTrue(stats.triangleTests == 100 && stats.traversalSteps == 100 && stats.boundingBoxTests == 200, string("wrong test counts"));
+}
+
+///////////////////////////////////////////////////////////////////////////
+////	HEATMAP.H
+void testHeatmap()
+{
+	// -- test 1 -- color ramp
+	Test::assertTrue(Heatmap::ramp(0.0) == Vector3d(0.0) && Heatmap::ramp(1.0) == Vector3d(1.0) && 
+					 Heatmap::ramp(2.0) == Vector3d(1.0) && Heatmap::ramp(0.5) == Vector3d(1.0, 0.0, 0.0), string("wrong color ramp"));
+
+	// -- test 2 -- tiles get the average cost
+	float cost[16] = { 0, 4, 0, 0,  0, 0, 0, 0,  8, 8, 8, 8,  8, 8, 8, 8 };
+	vector<Vector3d> colors;
+	double scale = Heatmap::toColors(cost, 4, 4, 2, colors);
+	Test::assertTrue(scale == 8.0 && colors.at(0) == colors.at(5) && colors.at(0) == Heatmap::ramp(1.0 / 8.0) && 
+					 colors.at(15) == Vector3d(1.0), string("wrong tile average"));
+
+	// -- test 3 -- cost of the pixels sums to the counted tests
+	Material mat(Vector3d(0.5, 0.5, 0.5), 0.0, 0.0, 0.0, 4.0);
+	Material lightMat(Vector3d(1.0, 1.0, 1.0), 0.0, 0.0, 0.0, 0.0);
+	Vector3d n(0.0, -1.0, 0.0);
+	TestModel model;
+	model.objects_.push_back(Object());
+	model.objects_.at(0).shapes.push_back(new Triangle(Point(-1.0, 3.0, -1.0), Point(1.0, 3.0, -1.0), Point(0.0, 3.0, 1.0), n, n, n, &mat));
+
+	Camera c(Vector3d(0.0, 0.0, 0.0), Vector3d(0.0, 1.0, 0.0), 40, 40, 90);
+	Light light(Vector3d(0.0, -1.0, 0.0), 0.0, &lightMat);
+	RayTracer rt(c, light, &model);
+	rt.setHeatmap(Heatmap::METRIC_TESTS);
+	vector<Vector3d> image(1600);
+	rt.render(&image[0]);
+
+	double sum = 0.0;
+	for(int i = 0; i < 1600; i++)
+		sum += rt.getCost(0)[i];
+	Test::assertTrue(sum == rt.getStats().triangleTests + rt.getStats().boundingBoxTests, string("wrong pixel cost"));
+	Test::assertTrue(rt.getCost(0)[0] < rt.getCost(0)[20 * 40 + 20], string("hit pixel should cost more"));
+}
+
+///////////////////////////////////////////////////////////////////////////
+////	LIGHT.H
+void testSoftShadows()
+{
+	Material lightMat(Vector3d(1.0, 1.0, 1.0), 0.0, 0.0, 0.0, 0.0);
+	Light light(Vector3d(0.0, 0.0, 10.0), 1.0, &lightMat);
+	Point origin(0.0, 0.0, 0.0);
+
+	// -- test 1 -- samples lie on the disk facing the point
+	bool onDisk = true;
+	for(int i = 0; i < 10; i++) {
+		Point p = light.sample(origin, i / 10.0, (i * 7 % 10) / 10.0);
+		if(!eq(p.z_, 10.0) || sqrt(p.x_ * p.x_ + p.y_ * p.y_) > 1.0 + 1e-9) onDisk = false;
+	}
+	Test::assertTrue(onDisk, string("light sample off the disk"));
+
+	// -- test 2 -- visibility of the light partially hidden by an occluder
+	Material mat(Vector3d(0.5, 0.5, 0.5), 0.0, 0.0, 0.0, 4.0);
+	Vector3d n(0.0, 0.0, -1.0);
+	TestModel model;
+	model.objects_.push_back(Object());
+	model.objects_.at(0).shapes.push_back(new Triangle(Point(0.0, -10.0, 5.0), Point(10.0, -10.0, 5.0), Point(0.0, 10.0, 5.0), n, n, n, &mat));
+	model.objects_.at(0).shapes.push_back(new Triangle(Point(10.0, -10.0, 5.0), Point(10.0, 10.0, 5.0), Point(0.0, 10.0, 5.0), n, n, n, &mat));
+
+	Camera c;
+	RayTracer rt(c, light, &model);
+	RayTracer::Context ctx;
+	rt.setShadowSampling(64, 4);
+
+	// half plane x > 0 at z = 5 hides half of the light seen from x = 0
+	Point penumbra(0.0, 0.0, 0.0);
+	Point umbra(5.0, 0.0, 0.0);
+	Point lit(-5.0, 0.0, 0.0);
+	double v = rt.lightVisibility(ctx, rt.light_, penumbra);
+	Test::assertTrue(v > 0.35 && v < 0.65, string("wrong penumbra visibility"));
+	Test::assertTrue(rt.lightVisibility(ctx, rt.light_, umbra) == 0.0 && rt.lightVisibility(ctx, rt.light_, lit) == 1.0, string("wrong umbra or lit visibility"));
+
+	// -- test 3 -- only the probes are cast outside the penumbra
+	long long before = ctx.stats.shadowRays;
+	rt.lightVisibility(ctx, rt.light_, lit);
+	Test::assertTrue(ctx.stats.shadowRays - before == 4, string("probes not used"));
+}
+
+void testMultipleLights()
+{
+	// -- test 1 -- distance falloff
+	Material lightMat(Vector3d(1.0, 1.0, 1.0), 0.0, 0.0, 0.0, 0.0);
+	Light key(Vector3d(0.0, 0.0, 10.0), 0.0, &lightMat);
+	Light fill(Vector3d(3.0, 0.0, 3.0), 0.0, &lightMat, 0.5, 2.0);
+	Light rim(Vector3d(100.0, 0.0, 1.0), 0.0, &lightMat, 0.01, 1.0);
+	Test::assertTrue(key.attenuation(100.0) == 1.0 && fill.attenuation(2.0) == 0.5, string("wrong attenuation"));
+
+	// -- test 2 -- lights add up, the negligible one casts no shadow rays
+	Material mat(Vector3d(0.5, 0.5, 0.5), 0.0, 0.0, 0.0, 4.0);
+	Vector3d n(0.0, 0.0, 1.0);
+	TestModel model;
+	model.objects_.push_back(Object());
+	model.objects_.at(0).shapes.push_back(new Triangle(Point(-10.0, -10.0, 0.0), Point(10.0, -10.0, 0.0), Point(-10.0, 10.0, 0.0), n, n, n, &mat));
+	model.objects_.at(0).shapes.push_back(new Triangle(Point(10.0, -10.0, 0.0), Point(10.0, 10.0, 0.0), Point(-10.0, 10.0, 0.0), n, n, n, &mat));
+
+	Camera c(Point(0.0, 0.0, 5.0), Vector3d(0.0, 0.001, -1.0), 1, 1, 45.0);
+	RayTracer rt(c, key, &model);
+	Vector3d single, all, culled;
+	rt.render(&single);
+	long long singleRays = rt.getStats().shadowRays;
+
+	rt.addLight(fill);
+	rt.addLight(rim);
+	rt.render(&all);
+	Test::assertTrue(all.x_ > single.x_ && rt.getStats().shadowRays == 3 * singleRays, string("lights not summed"));
+
+	rt.setLightThreshold(0.001);
+	rt.render(&culled);
+	Test::assertTrue(rt.getStats().shadowRays == 2 * singleRays && rt.getStats().culledLights > 0, string("light not culled"));
+	Test::assertTrue(fabs(culled.x_ - all.x_) < 0.001, string("culled light changed the color"));
+}
+
+///////////////////////////////////////////////////////////////////////////
+////	DECIMATOR.H
+void testDecimator()
+{
+	Material mat(Vector3d(0.5, 0.5, 0.5), 0.0, 0.0, 0.0, 4.0);
+	Vector3d up(0.0, 0.0, 1.0);
+	Arena arena;
+
+	// -- test 1 -- flat grid collapses to the outline (2 triangles) without leaving the plane
+	vector<Shape *> grid;
+	for(int i = 0; i < 4; i++)
+		for(int j = 0; j < 4; j++) {
+			grid.push_back(new Triangle(Point(j, i, 0.0), Point(j + 1, i, 0.0), Point(j + 1, i + 1, 0.0), up, up, up, &mat));
+			grid.push_back(new Triangle(Point(j, i, 0.0), Point(j + 1, i + 1, 0.0), Point(j, i + 1, 0.0), up, up, up, &mat));
+		}
+	Decimator flat(grid);
+	Test::assertTrue(flat.decimate(2) == 2, string("grid not decimated to 2 triangles"));
+	vector<Shape *> outline;
+	flat.getTriangles(&mat, outline, arena);
+	double area = 0.0;
+	for(int i = 0; i < (int)outline.size(); i++) {
+		Triangle* t = static_cast<Triangle *>(outline.at(i));
+		area += (t->v1 - t->v0).cross(t->v2 - t->v0).length() * 0.5;
+		Test::assertTrue(t->minCoords().z_ == 0.0 && t->maxCoords().z_ == 0.0 && t->n0.z_ > 0.99, string("grid left the plane"));
+	}
+	Test::assertTrue(fabs(area - 16.0) < 1e-9, string("outline of the grid not preserved"));
+
+	// -- test 2 -- closed sphere stays inside its bounding box, proxy of the object follows its moves
+	Object sphere;
+	const int R = 8, S = 16;
+	for(int i = 0; i < R; i++) {
+		for(int j = 0; j < S; j++) {
+			Point p[4];
+			for(int k = 0; k < 4; k++) {
+				double theta = 3.14159265358979 * (i + k / 2) / R;
+				double phi = 2.0 * 3.14159265358979 * (j + (k == 1 || k == 2)) / S;
+				p[k] = Point(sin(theta) * cos(phi), sin(theta) * sin(phi), cos(theta));
+			}
+			if(i > 0)		sphere.shapes.push_back(new Triangle(p[0], p[2], p[1], p[0], p[2], p[1], &mat));
+			if(i < R - 1)	sphere.shapes.push_back(new Triangle(p[0], p[3], p[2], p[0], p[3], p[2], &mat));
+		}
+	}
+	sphere.createProxy(40, arena);
+	Test::assertTrue(!sphere.proxy.empty() && sphere.proxy.size() <= 40, string("wrong proxy size"));
+	bool inside = true;
+	for(int i = 0; i < (int)sphere.proxy.size(); i++)
+		inside = inside && sphere.proxy.at(i)->minCoords().min() >= -1.0 && sphere.proxy.at(i)->maxCoords().max() <= 1.0;
+	Test::assertTrue(inside, string("proxy left the bounding box"));
+
+	Vector3d t(5.0, 0.0, 0.0);
+	sphere.translate(t);
+	Test::assertTrue(sphere.proxy.at(0)->minCoords().x_ >= 4.0, string("proxy not moved with the object"));
+	sphere.createProxy(1000, arena);
+	Test::assertTrue(sphere.proxy.empty(), string("small object got a proxy"));
+}
+
+void testLod()
+{
+	Material mat(Vector3d(0.5, 0.5, 0.5), 0.0, 0.0, 0.0, 4.0);
+	Vector3d up(0.0, 0.0, 1.0);
+
+	// two copies of a grid, the second one moved
+	TestModel model;
+	model.objects_.assign(2, Object());
+	for(int k = 0; k < 2; k++)
+		for(int i = 0; i < 8; i++)
+			for(int j = 0; j < 8; j++) {
+				model.objects_.at(k).shapes.push_back(new Triangle(Point(j + 10 * k, i, 0.0), Point(j + 1 + 10 * k, i, 0.0), Point(j + 1 + 10 * k, i + 1, 0.0), up, up, up, &mat));
+				model.objects_.at(k).shapes.push_back(new Triangle(Point(j + 10 * k, i, 0.0), Point(j + 1 + 10 * k, i + 1, 0.0), Point(j + 10 * k, i + 1, 0.0), up, up, up, &mat));
+			}
+
+	// -- test 1 -- chain of halved levels, the copy shares the decimation
+	model.createLods(3);
+	Object& first = model.objects_.at(0);
+	Object& copy = model.objects_.at(1);
+	Test::assertTrue(first.lods.size() == 3 && first.lods.at(0).size() <= 64 && first.lods.at(2).size() <= 16, string("wrong levels of detail"));
+	Test::assertTrue(copy.lods.size() == 3 && copy.lods.at(1).size() == first.lods.at(1).size() &&
+		static_cast<Triangle *>(copy.lods.at(1).at(0))->v0.x_ == static_cast<Triangle *>(first.lods.at(1).at(0))->v0.x_ + 10.0, string("levels of the copy not shared"));
+	Test::assertTrue(&first.getShapes(0) == &first.shapes && &first.getShapes(9) == &first.lods.at(2), string("wrong level picked"));
+
+	// -- test 2 -- projected size of the box
+	Camera c(Vector3d(0.0, 0.0, 0.0), Vector3d(0.0, 1.0, 0.0), 100, 100, 90);
+	Point cmin(-1.0, 9.0, -1.0), cmax(1.0, 11.0, 1.0);
+	double size = c.projectedSize(cmin, cmax);
+	Point behind(-1.0, -1.0, -1.0);
+	Test::assertTrue(size > 10.0 && size < 12.0 && c.projectedSize(behind, cmax) == INFINITY, string("wrong projected size"));
+}
+
+///////////////////////////////////////////////////////////////////////////
+////	ARENA.H
+void testArena()
+{
+	Material mat(Vector3d(0.5, 0.5, 0.5), 0.0, 0.0, 0.0, 4.0);
+	Vector3d n(0.0, 0.0, 1.0);
+	Arena arena(1024);
+
+	// -- test 1 -- aligned allocations, big ones get a block of their own
+	bool aligned = true;
+	for(int i = 0; i < 100; i++)
+		aligned = aligned && ((size_t)arena.allocate(1 + i % 7) % Arena::ALIGNMENT) == 0;
+	Test::assertTrue(aligned, string("unaligned allocation"));
+	char* big = static_cast<char *>(arena.allocate(4096));
+	big[4095] = 1;
+	Test::assertTrue(arena.bytesReserved() >= 4096 + 1024, string("big allocation not in its own block"));
+
+	// -- test 2 -- reset reuses the blocks, memory stays flat over rebuilds
+	size_t reserved = 0;
+	for(int k = 0; k < 10; k++) {
+		arena.reset();
+		for(int i = 0; i < 50; i++)
+			new (arena) Triangle(Point(i, 0.0, 0.0), Point(i + 1, 0.0, 0.0), Point(i, 1.0, 0.0), n, n, n, &mat);
+		if(k == 0)
+			reserved = arena.bytesReserved();
+	}
+	Test::assertTrue(arena.bytesReserved() == reserved && arena.bytesUsed() >= 50 * sizeof(Triangle), string("reset blocks not reused"));
+	arena.release();
+	Test::assertTrue(arena.bytesReserved() == 0 && arena.bytesUsed() == 0, string("blocks not released"));
+
+	// -- test 3 -- bounding box is moved with the object
+	Object object;
+	object.shapes.push_back(new (arena) Triangle(Point(0.0, 0.0, 0.0), Point(1.0, 0.0, 0.0), Point(0.0, 1.0, 1.0), n, n, n, &mat));
+	object.createBoundingBox(arena);
+	Vector3d t(2.0, 0.0, 0.0);
+	object.translate(t);
+	Vector3d cmin, cmax;
+	object.getBounds(cmin, cmax);
+	Test::assertTrue(object.boundingBox.size() == 12 && cmin.x_ == 2.0 && cmax.x_ == 3.0 && cmax.z_ == 1.0, string("bounding box not moved"));
+}
+
+///////////////////////////////////////////////////////////////////////////
+////	PRIMITIVES.H
+void testPrimitives()
+{
+	Material mat(Vector3d(0.5, 0.5, 0.5), 0.0, 0.0, 0.0, 4.0);
+	Vector3d n(0.0, -1.0, 0.0);
+	Triangle far(Point(-1.0, 9.0, -1.0), Point(1.0, 9.0, -1.0), Point(0.0, 9.0, 1.0), n, n, n, &mat);
+	Triangle near(Point(-1.0, 7.0, -1.0), Point(1.0, 7.0, -1.0), Point(0.0, 7.0, 1.0), n, n, n, &mat);
+	Sphere sphere(Point(0.0, 8.0, 0.0), 0.5, &mat);
+	Light light(Point(0.0, 5.0, 0.0), 0.5, &mat);
+
+	vector<Shape *> shapes;
+	shapes.push_back(&far);
+	shapes.push_back(&sphere);
+	shapes.push_back(&light);
+	shapes.push_back(&near);
+	PrimitiveSet set;
+	set.build(shapes);
+
+	// -- test 1 -- sorted by the exact type, the order kept
+	Test::assertTrue(set.triangles.size() == 2 && set.triangles.at(0) == &far && set.spheres.size() == 1 &&
+		set.others.size() == 1 && set.others.at(0) == &light && set.size() == 4, string("shapes not sorted by type"));
+
+	// -- test 2 -- the same closest hit as the virtual calls
+	Ray ray(Point(0.0, 0.0, 0.0), Vector3d(0.0, 1.0, 0.0));
+	Shape::Intersection isC;
+	isC.t = INFINITY;
+	Test::assertTrue(set.closest(ray, isC) && isC.obj == &light && fabs(isC.t - 4.5) < 1e-9, string("wrong closest shape"));
+	isC.t = 4.0;
+	Test::assertTrue(!set.closest(ray, isC), string("farther shape reported"));
+
+	// -- test 3 -- any hit within the distance, the tests counted
+	long long tests = 0;
+	Test::assertTrue(set.any(ray, 7.5, tests) && tests == 2, string("near triangle not found first"));
+	Ray up(Point(5.0, 0.0, 0.0), Vector3d(0.0, 1.0, 0.0));
+	tests = 0;
+	Test::assertTrue(!set.any(up, INFINITY, tests) && tests == 4, string("missing ray hit"));
+}
+
+///////////////////////////////////////////////////////////////////////////
+////	BOARDGRID.H
+void testBoardGrid()
+{
+	Material mat(Vector3d(0.5, 0.5, 0.5), 0.0, 0.0, 0.0, 4.0);
+	Vector3d n(-1.0, 0.0, 0.0);
+	Point corner(0.0, 0.0, 0.0);
+
+	// wall in the middle of each of the fields (0..3, 1) facing -x
+	TestGridModel model;
+	model.grid.init(corner, 1.0);
+	for(int k = 0; k < 4; k++) {
+		model.objects_.push_back(Object());
+		double x = k + 0.5;
+		model.objects_.at(k).shapes.push_back(new Triangle(Point(x, 1.2, 0.0), Point(x, 1.8, 0.0), Point(x, 1.8, 1.0), n, n, n, &mat));
+		model.objects_.at(k).shapes.push_back(new Triangle(Point(x, 1.2, 0.0), Point(x, 1.8, 1.0), Point(x, 1.2, 1.0), n, n, n, &mat));
+		Vector3d cmin, cmax;
+		model.objects_.at(k).getBounds(cmin, cmax);
+		model.grid.insert(k, cmin, cmax);
+	}
+
+	// -- test 1 -- walk through the cells in the order of the ray
+	BoardGrid::Walk walk;
+	Ray diagonal(Point(-1.0, -0.5, 0.5), Vector3d(1.0, 1.0, 0.0));
+	Test::assertTrue(model.grid.begin(diagonal, INFINITY, walk) && walk.x == 0 && walk.y == 0 && model.grid.next(walk) &&
+		walk.x == 0 && walk.y == 1 && model.grid.cell(walk).at(0) == 0 && model.grid.next(walk) && walk.x == 1 && walk.y == 1 && model.grid.cell(walk).at(0) == 1, string("wrong cells walked"));
+	Ray above(Point(-1.0, 1.5, 5.0), Vector3d(1.0, 0.0, 0.0));
+	Test::assertTrue(!model.grid.begin(above, INFINITY, walk), string("ray above the objects walked"));
+
+	// -- test 2 -- the same hits as without the grid, the walk ends at the first hit
+	Camera c;
+	Light light(Point(0.0, 0.0, 10.0), 0.0, &mat);
+	RayTracer rt(c, light, &model);
+	RayTracer::Context ctx;
+	Ray ray(Point(-1.0, 1.5, 0.5), Vector3d(1.0, 0.0, 0.0));
+	Shape::Intersection isGrid, isAll;
+	rt.closestHit(ctx, ray, isGrid);
+	long long gridTests = ctx.stats.triangleTests;
+	rt.setBoardGrid(false);
+	rt.closestHit(ctx, ray, isAll);
+	Test::assertTrue(isGrid.obj == isAll.obj && isGrid.object == 0 && eq(isGrid.t, 1.5), string("wrong closest hit in the grid"));
+	Test::assertTrue(gridTests == 2 && ctx.stats.triangleTests == 2 + 2, string("cells (or hierarchy nodes) behind the hit tested"));
+
+	// -- test 3 -- moved object found in its new cell
+	rt.setBoardGrid(true);
+	Vector3d t(0.0, 4.0, 0.0);
+	model.objects_.at(2).translate(t);
+	Vector3d cmin, cmax;
+	model.objects_.at(2).getBounds(cmin, cmax);
+	model.grid.insert(2, cmin, cmax);
+	Ray moved(Point(-1.0, 5.5, 0.5), Vector3d(1.0, 0.0, 0.0));
+	Ray vacated(Point(1.6, 1.5, 0.5), Vector3d(1.0, 0.0, 0.0));
+	Test::assertTrue(rt.occluded(ctx, moved) && !rt.occluded(ctx, vacated, 1.5), string("moved object not found in its new field"));
+}
+
+///////////////////////////////////////////////////////////////////////////
+////	REFLECTIONCACHE.H
+void testReflectionCache()
+{
+	Material boardMat(Vector3d(0.5, 0.5, 0.5), 0.5, 0.0, 0.0, 16.0);
+	Material pieceMat(Vector3d(0.8, 0.2, 0.2), 0.0, 0.0, 0.0, 4.0);
+	Material lightMat(Vector3d(1.0, 1.0, 1.0), 0.0, 0.0, 0.0, 0.0);
+	Vector3d up(0.0, 0.0, 1.0), n(0.0, -1.0, 0.0);
+	Point corner(0.0, 0.0, 0.0);
+
+	// reflective board out of the grid, two walls standing on the fields (2, 3) and (5, 3)
+	TestGridModel model;
+	model.grid.init(corner, 1.0);
+	model.objects_.push_back(Object());
+	model.objects_.at(0).shapes.push_back(new Triangle(Point(0.0, 0.0, 0.0), Point(8.0, 0.0, 0.0), Point(8.0, 8.0, 0.0), up, up, up, &boardMat));
+	model.objects_.at(0).shapes.push_back(new Triangle(Point(0.0, 0.0, 0.0), Point(8.0, 8.0, 0.0), Point(0.0, 8.0, 0.0), up, up, up, &boardMat));
+	for(int k = 1; k <= 2; k++) {
+		model.objects_.push_back(Object());
+		double x = 3.0 * k - 0.8;
+		model.objects_.at(k).shapes.push_back(new Triangle(Point(x, 3.5, 0.0), Point(x + 0.6, 3.5, 0.0), Point(x + 0.6, 3.5, 1.5), n, n, n, &pieceMat));
+		model.objects_.at(k).shapes.push_back(new Triangle(Point(x, 3.5, 0.0), Point(x + 0.6, 3.5, 1.5), Point(x, 3.5, 1.5), n, n, n, &pieceMat));
+		Vector3d cmin, cmax;
+		model.objects_.at(k).getBounds(cmin, cmax);
+		model.grid.insert(k, cmin, cmax);
+	}
+
+	Camera c(Vector3d(4.0, -3.0, 4.0), Vector3d(0.0, 1.0, -0.6), 48, 32, 60);
+	Light light(Vector3d(4.0, 2.0, 8.0), 0.0, &lightMat);
+	RayTracer rt(c, light, &model, 3);
+	RayTracer reference(c, light, &model, 3);
+	ReflectionCache cache;
+	rt.setReflectionCache(&cache);
+	rt.setThreads(1);
+	reference.setThreads(1);
+	vector<Vector3d> image(48 * 32), expected(48 * 32);
+
+	// -- test 1 -- nothing changed, all the reflections of the board are reused
+	rt.render(&image[0]);
+	long long traced = rt.getStats().reflectionRays;
+	rt.render(&image[0]);
+	Test::assertTrue(traced > 0 && rt.getStats().reflectionRays == 0 && rt.getStats().cachedReflections == traced, string("reflections not reused"));
+
+	// -- test 2 -- the reflections the moved wall left or entered are traced again, the image is the same as without the cache
+	Vector3d t(-1.0, 1.0, 0.0);
+	model.objects_.at(2).translate(t);
+	Vector3d cmin, cmax;
+	model.objects_.at(2).getBounds(cmin, cmax);
+	model.grid.insert(2, cmin, cmax);
+	rt.render(&image[0]);
+	reference.render(&expected[0]);
+	bool same = true;
+	for(int i = 0; i < (int)image.size(); i++)
+		same = same && image.at(i) == expected.at(i);
+	Test::assertTrue(cache.getInvalidated() > 0 && rt.getStats().reflectionRays > 0 && rt.getStats().cachedReflections > 0, string("wrong reflections invalidated"));
+	Test::assertTrue(same, string("cached reflections differ from the traced ones"));
+
+	// -- test 3 -- a hidden wall is a change as well
+	model.objects_.at(1).visible = false;
+	rt.render(&image[0]);
+	reference.render(&expected[0]);
+	same = true;
+	for(int i = 0; i < (int)image.size(); i++)
+		same = same && image.at(i) == expected.at(i);
+	Test::assertTrue(cache.getInvalidated() > 0 && same, string("hidden object kept in the reflections"));
+}
+
+///////////////////////////////////////////////////////////////////////////
+////	BVH.H
+
+//! Records the visited objects, stops the traversal at the given distance
+struct TestBvhVisitor {
+	TestBvhVisitor(double& maxDist, double stopAt) : maxDist(maxDist), stopAt(stopAt) { }
+	bool operator()(int object) { visited.push_back(object); maxDist = stopAt; return false; }
+	double& maxDist;
+	double stopAt;
+	vector<int> visited;
+};
+
+void testBvh()
+{
+	Material mat(Vector3d(0.5, 0.5, 0.5), 0.0, 0.0, 0.0, 4.0);
+
+	// unit spheres in the row along x
+	TestModel model;
+	for(int k = 0; k < 4; k++) {
+		model.objects_.push_back(Object());
+		model.objects_.at(k).shapes.push_back(new Sphere(Point(2.0 * k + 0.5, 0.5, 0.5), 0.5, &mat));
+	}
+	model.updateBvh();
+	Bvh& bvh = model.getBvh();
+	long long tests = 0;
+
+	// -- test 1 -- nearer objects visited first, the nodes beyond the shortened distance skipped
+	Ray ray(Point(-1.0, 0.5, 0.5), Vector3d(1.0, 0.0, 0.0));
+	double maxDist = INFINITY;
+	TestBvhVisitor all(maxDist, INFINITY);
+	bvh.traverse(ray, maxDist, all, tests);
+	Test::assertTrue(all.visited.size() == 4 && all.visited.at(0) == 0 && all.visited.at(1) == 1 && all.visited.at(3) == 3, string("wrong order of the objects"));
+	maxDist = INFINITY;
+	TestBvhVisitor first(maxDist, 2.0);
+	bvh.traverse(ray, maxDist, first, tests);
+	Test::assertTrue(first.visited.size() == 1, string("nodes beyond the hit visited"));
+
+	// -- test 2 -- closest hit through the hierarchy, only the first sphere intersected
+	Camera c;
+	Light light(Point(0.0, 0.0, 10.0), 0.0, &mat);
+	RayTracer rt(c, light, &model);
+	RayTracer::Context ctx;
+	Shape::Intersection isC;
+	Test::assertTrue(rt.closestHit(ctx, ray, isC) && isC.object == 0 && eq(isC.t, 1.0) && ctx.stats.triangleTests == 1, string("wrong closest hit"));
+
+	// -- test 3 -- a small move is refitted, the moved object is found at its new place
+	unsigned builds = bvh.getBuilds();
+	Vector3d t(0.0, 0.0, 1.0);
+	model.objects_.at(1).translate(t);
+	model.refitBvh(1);
+	Ray down(Point(2.5, 0.5, 5.0), Vector3d(0.0, 0.0, -1.0));
+	Test::assertTrue(bvh.getBuilds() == builds && rt.closestHit(ctx, down, isC) && isC.object == 1 && eq(isC.t, 3.0), string("refitted object not found"));
+
+	// -- test 4 -- moving an object far away degrades the tree, it is built again
+	Vector3d far(100.0, 0.0, 0.0);
+	model.objects_.at(3).translate(far);
+	model.refitBvh(3);
+	Ray side(Point(106.5, 0.5, -5.0), Vector3d(0.0, 0.0, 1.0));
+	Test::assertTrue(bvh.getBuilds() == builds + 1 && !bvh.degraded() && rt.occluded(ctx, side, 10.0) && !rt.occluded(ctx, side, 3.0), string("degraded tree not built again"));
+
+	// -- test 5 -- an object without shapes is left out of the tree, it gets into it once it has shapes
+	model.objects_.push_back(Object());
+	model.updateBvh();
+	builds = bvh.getBuilds();
+	RayTracer rtEmpty(c, light, &model);
+	Test::assertTrue(bvh.size() == 5 && bvh.cost() >= 1.0 && bvh.cost() < INFINITY && rtEmpty.closestHit(ctx, ray, isC) && isC.object == 0, string("empty object breaks the tree"));
+	model.objects_.at(4).shapes.push_back(new Sphere(Point(2.5, 5.5, 0.5), 0.5, &mat));
+	model.refitBvh(4);
+	RayTracer rtFilled(c, light, &model);
+	Ray up(Point(2.5, 0.0, 0.5), Vector3d(0.0, 1.0, 0.0));
+	Test::assertTrue(bvh.getBuilds() == builds + 1 && rtFilled.closestHit(ctx, up, isC) && isC.object == 4 && eq(isC.t, 5.0), string("object with new shapes not in the tree"));
+}
+
+///////////////////////////////////////////////////////////////////////////
+////	RAYTRACER.H
+void testEstimate()
+{
+	Material mat(Vector3d(0.5, 0.5, 0.5), 0.0, 0.0, 0.0, 4.0);
+	Material lightMat(Vector3d(1.0, 1.0, 1.0), 0.0, 0.0, 0.0, 0.0);
+	Vector3d n(0.0, -1.0, 0.0);
+	TestModel model;
+	model.objects_.push_back(Object());
+	model.objects_.at(0).shapes.push_back(new Triangle(Point(-2.0, 3.0, -2.0), Point(2.0, 3.0, -2.0), Point(0.0, 3.0, 2.0), n, n, n, &mat));
+	model.objects_.at(0).shapes.push_back(new Triangle(Point(-1.0, 3.5, -1.0), Point(1.0, 3.5, -1.0), Point(0.0, 3.5, 1.0), n, n, n, &mat));
+
+	Camera c(Vector3d(0.0, 0.0, 0.0), Vector3d(0.0, 1.0, 0.0), 80, 60, 90);
+	Light light(Vector3d(0.0, -1.0, 0.0), 0.0, &lightMat);
+	RayTracer rt(c, light, &model);
+	rt.setThreads(1);
+	vector<Camera *> cameras(1, rt.camera_);
+
+	// -- test 1 -- the primary rays and the hits of the triangles (without tracing) are close to the rendered ones
+	RenderStats estimate = rt.estimate(cameras);
+	vector<Vector3d> image(80 * 60);
+	rt.render(&image[0]);
+	RenderStats& rendered = rt.getStats();
+	Test::assertTrue(estimate.primaryRays == rendered.primaryRays && estimate.reflectionRays == 0 && estimate.shadowRays == estimate.hits,
+		string("wrong rays estimated"));
+	Test::assertTrue(estimate.hits > rendered.hits / 2 && estimate.hits < rendered.hits * 2 &&
+		estimate.triangleTests > rendered.triangleTests / 2 && estimate.triangleTests < rendered.triangleTests * 2, string("estimate far from the rendering"));
+}
+
+void testShadingKernels()
+{
+	Material mat(Vector3d(0.5, 0.5, 0.5), 0.0, 0.0, 0.0, 4.0);
+	Material lightMat(Vector3d(1.0, 1.0, 1.0), 0.0, 0.0, 0.0, 0.0);
+	Vector3d n(0.0, -1.0, 0.0);
+	TestModel model;
+	model.objects_.push_back(Object());
+	model.objects_.at(0).shapes.push_back(new Triangle(Point(-10.0, 3.0, -10.0), Point(10.0, 3.0, -10.0), Point(0.0, 3.0, 10.0), n, n, n, &mat));
+
+	Camera c(Vector3d(0.0, 0.0, 0.0), Vector3d(0.0, 1.0, 0.0), 10, 10, 90);
+	Light light(Vector3d(0.0, -1.0, 0.0), 0.0, &lightMat);
+	RayTracer rt(c, light, &model, 2);
+	rt.setThreads(1);
+	vector<Vector3d> diffuse(100), image(100);
+
+	// -- test 1 -- materials are classified by their coefficients
+	Test::assertTrue(mat.kernel == Material::KERNEL_DIFFUSE, string("wrong kernel of diffuse material"));
+	Material glass(Vector3d(0.5, 0.5, 0.5), 0.3, 0.5, 1.5, 4.0);
+	Test::assertTrue(glass.kernel == Material::KERNEL_REFLECTIVE_TRANSPARENT, string("wrong kernel of reflective transparent material"));
+
+	// -- test 2 -- the diffuse kernel casts no secondary rays
+	rt.render(&diffuse[0]);
+	Test::assertTrue(rt.getStats().hits == 100 && rt.getStats().reflectionRays == 0 && rt.getStats().refractionRays == 0, string("diffuse kernel cast secondary rays"));
+
+	// -- test 3 -- a material changed after its creation is classified again before rendering
+	mat.reflection = 0.5;
+	rt.render(&image[0]);
+	Test::assertTrue(mat.kernel == Material::KERNEL_REFLECTIVE && rt.getStats().reflectionRays == 100, string("changed material not classified again"));
+	Test::assertTrue(image[55].x_ < diffuse[55].x_, string("reflection (of the black background) not mixed in"));
+
+	// -- test 4 -- glass reflects too little close to normal incidence, only the oblique rays (the corners of the screen) trace both rays unless asked for
+	mat.reflection = 0.0;
+	mat.transparency = 1.0;
+	mat.refractIdx = 1.5;
+	rt.render(&image[0]);
+	Test::assertTrue(mat.kernel == Material::KERNEL_TRANSPARENT && rt.getStats().refractionRays == 100 && rt.getStats().reflectionRays == 20,
+		string("weak Fresnel reflection traced"));
+	rt.setFresnelThreshold(0.0);
+	rt.render(&image[0]);
+	Test::assertTrue(rt.getStats().refractionRays == 100 && rt.getStats().reflectionRays == 100, string("both rays not traced"));
+
+	// -- test 5 -- total internal reflection (into an optically thinner medium) traces the reflected ray only
+	mat.refractIdx = 0.5;
+	rt.setFresnelThreshold(RayTracer::DEFAULT_FRESNEL_THRESHOLD);
+	rt.render(&image[0]);
+	bool finite = true;
+	for(int i = 0; i < 100; i++)
+		finite = finite && image[i].x_ == image[i].x_ && image[i].x_ < INFINITY;
+	Test::assertTrue(rt.getStats().reflectionRays > 0 && rt.getStats().refractionRays > 0 && rt.getStats().refractionRays < 100 && finite,
+		string("wrong total internal reflection"));
+}
+
+void testCropWindow()
+{
+	Material mat(Vector3d(0.5, 0.5, 0.5), 0.3, 0.0, 0.0, 4.0);
+	Vector3d n(0.0, -1.0, 0.0);
+	TestModel model;
+	model.objects_.push_back(Object());
+	model.objects_.at(0).shapes.push_back(new Sphere(Point(0.5, 4.0, 0.0), 1.5, &mat));
+	model.objects_.push_back(Object());
+	model.objects_.at(1).shapes.push_back(new Triangle(Point(-6.0, 8.0, -4.0), Point(6.0, 8.0, -4.0), Point(0.0, 8.0, 5.0), n, n, n, &mat));
+
+	// -- test 1 -- the crop window is clipped by the screen, an empty or outlying one is the full screen
+	Camera c(Vector3d(0.0, 0.0, 0.0), Vector3d(0.0, 1.0, 0.0), 64, 48, 90);
+	c.setCrop(Tile(-8, 40, 24, 16));
+	Tile crop = c.getCrop();
+	Test::assertTrue(crop.x == 0 && crop.y == 40 && crop.width == 16 && crop.height == 8, string("crop window not clipped"));
+	c.setCrop(Tile(10, 10, 0, 5));
+	crop = c.getCrop();
+	Test::assertTrue(crop.x == 0 && crop.y == 0 && crop.width == 64 && crop.height == 48, string("empty crop window not the full screen"));
+	c.setCrop(Tile(70, 10, 8, 8));
+	crop = c.getCrop();
+	Test::assertTrue(crop.x == 0 && crop.y == 0 && crop.width == 64 && crop.height == 48, string("crop window off the screen not the full screen"));
+
+	// -- test 2 -- a tile is written relative to the crop window, the other pixels are not touched
+	c.clearCrop();
+	Light light(Vector3d(2.0, 0.0, 3.0), 0.0, &mat);
+	RayTracer rt(c, light, &model);
+	rt.setThreads(2);
+	vector<Vector3d> full(64 * 48);
+	rt.render(&full[0]);
+	rt.camera_->setCrop(Tile(40, 30, 40, 40));
+	vector<Camera *> cameras(1, rt.camera_);
+	vector<Vector3d> cropped(24 * 18, Vector3d(-1.0));
+	vector<Vector3d *> images(1, &cropped[0]);
+	vector<TileScheduler::Task> tasks(1, TileScheduler::Task(0, Tile(48, 36, 4, 3)));
+	rt.render(cameras, images, tasks);
+	int written = 0;
+	bool inTile = true;
+	for(int i = 0; i < 18; i++)
+		for(int j = 0; j < 24; j++) {
+			bool touched = !(cropped.at(i * 24 + j) == Vector3d(-1.0));
+			bool tile = (j >= 8 && j < 12 && i >= 6 && i < 9);
+			written += touched ? 1 : 0;
+			inTile = inTile && touched == tile && (!tile || cropped.at(i * 24 + j) == full.at((30 + i) * 64 + 40 + j));
+		}
+	Test::assertTrue(written == 12 && inTile, string("tile written outside of its place in the crop window"));
+
+	// -- test 3 -- the cropped render equals the same rectangle of the full one
+	rt.render(&cropped[0]);
+	bool same = true;
+	for(int i = 0; i < 18; i++)
+		for(int j = 0; j < 24; j++)
+			same = same && cropped.at(i * 24 + j) == full.at((30 + i) * 64 + 40 + j);
+	Test::assertTrue(same && rt.getStats().primaryRays == 24 * 18, string("cropped render differs from full one"));
+}
+
+///////////////////////////////////////////////////////////////////////////
+////	SCENEDESCRIPTION.H
+void testSceneDescription()
+{
+	// -- test 1 -- exact keys, the vectors with spaces, the errors name the line
+	SceneDescription scene;
+	string error;
+	istringstream config("# camera\ncamera-position\t[-6.0, -3.0, 6.0]\ncamera-direction [0.5, 0.7, -0.3]\nwidth 80\nheight 60\n"
+						 "light\t[1, 2, 3]\t[0.5, 0.5, 0.5]\t0.4 0.0 6.0\nwhite-piece-shininess 8\r\n");
+	Test::assertTrue(scene.readSettings(config, error) && scene.cameraPosition == Vector3d(-6.0, -3.0, 6.0) &&
+		scene.cameraDirection == Vector3d(0.5, 0.7, -0.3) && scene.width == 80 && scene.height == 60 &&
+		scene.settings.lights.size() == 1 && scene.settings.lights.at(0).range == 6.0 && scene.whitePiece.shininess == 8.0, 
+		string("configuration not read: ") + error);
+	const char* wrong[4] = { "width 80\nheight 60\nlight-position-x [1, 2, 3]\n", "width 80\nheight 6O\n", 
+							 "width 80\nheight 60\ndepth\n", "width 80\n" };
+	const char* errors[4] = { "line 3: unknown key light-position-x", "line 2: wrong value of height: 6O", 
+							  "line 3: wrong value of depth: ", "no camera resolution (width, height)" };
+	for(int i = 0; i < 4; i++) {
+		istringstream is(wrong[i]);
+		Test::assertTrue(!SceneDescription().readSettings(is, error) && error == errors[i], string("wrong configuration accepted: ") + wrong[i]);
+	}
+
+	// -- test 2 -- the pieces are matched exactly, each field once
+	istringstream board("pawn_1_w\tA2\n# comment\nking_b e8\n");
+	Test::assertTrue(scene.readBoard(board, error) && scene.board.size() == 2 && scene.board.at(1).piece == ModelChess::KING_B &&
+		scene.board.at(1).field.x == 4 && scene.board.at(1).field.y == 7, string("board not read: ") + error);
+	istringstream unknown("pawn_1_wx A2\n"), taken("pawn_1_w A2\npawn_2_w A2\n"), outside("pawn_1_w I2\n");
+	vector<Chess::Placement> placements;
+	Test::assertTrue(!Chess::readPlacements(unknown, placements, error) && !Chess::readPlacements(taken, placements, error) &&
+		!Chess::readPlacements(outside, placements, error), string("wrong board accepted"));
+
+	// -- test 3 -- the compiled scene is the same scene
+	ostringstream compiled;
+	scene.write(compiled);
+	SceneDescription read;
+	istringstream is(compiled.str());
+	ostringstream again;
+	Test::assertTrue(read.read(is, error), string("compiled scene not read: ") + error);
+	read.write(again);
+	Test::assertTrue(again.str() == compiled.str() && read.board.size() == 2, string("compiled scene changed"));
+	istringstream truncated(compiled.str().substr(0, compiled.str().size() - 3));
+	Test::assertTrue(!SceneDescription().read(truncated, error), string("truncated scene accepted"));
+}
+
+///////////////////////////////////////////////////////////////////////////
+////	RENDERSERVER.H
+void testRenderServer()
+{
+	// -- test 1 -- the job survives the message
+	RenderJob job;
+	job.priority = 3;
+	job.output = "diagram 1.png";
+	job.board = "pawn_1_w A2\nking_b E8";
+	job.settings = "width 80\nheight 60\n";
+	ostringstream message;
+	job.write(message);
+	RenderJob read;
+	string error;
+	istringstream is(message.str());
+	Test::assertTrue(read.read(is, error) && read.priority == 3 && read.output == job.output && 
+		read.board == job.board + "\n" && read.settings == job.settings, string("job changed by the message"));
+	RenderJob compiled;
+	compiled.output = job.output;
+	compiled.scene = string("RTSC\n@end\0\n", 12);
+	ostringstream binary;
+	compiled.write(binary);
+	istringstream bis(binary.str());
+	Test::assertTrue(read.read(bis, error) && read.scene == compiled.scene, string("compiled scene changed by the message"));
+	istringstream noOutput("@job\n@render\nwidth 80\n@end\n");
+	Test::assertTrue(!RenderJob().read(noOutput, error) && error == "no output", string("job without the output accepted"));
+	istringstream huge("@job\n@output a.png\n@scene 18446744073709551615\n");
+	Test::assertTrue(!RenderJob().read(huge, error) && error == "scene too large", string("huge scene accepted"));
+
+	// -- test 2 -- higher priority first, the same priority in the order of arrival, bounded
+	JobQueue queue(3);
+	int priorities[4] = { 1, 5, 1, 0 };
+	for(int i = 0; i < 3; i++) {
+		job.id = i;
+		job.priority = priorities[i];
+		queue.push(job);
+	}
+	job.priority = priorities[3];
+	Test::assertTrue(!queue.push(job) && queue.size() == 3, string("full queue accepted the job"));
+	int order[3];
+	for(int i = 0; i < 3; i++) {
+		queue.pop(job);
+		order[i] = job.id;
+	}
+	Test::assertTrue(order[0] == 1 && order[1] == 0 && order[2] == 2, string("wrong order of the jobs"));
+	queue.close();
+	Test::assertTrue(!queue.pop(job) && !queue.push(job), string("closed queue used"));
+
+	// -- test 3 -- lines over the local channel
+#ifdef _WIN32
+	string channel = "\\\\.\\pipe\\rtchess-unittest";
+#else
+	string channel = "rtchess-unittest.sock";
+#endif
+	LocalListener listener;
+	LocalConnection client, server;
+	Test::assertTrue(listener.open(channel) && client.connect(channel) && listener.accept(server), string("channel not connected"));
+	string line1, line2;
+	client.write("@job\r\n@end");
+	client.close();
+	Test::assertTrue(server.readLine(line1) && server.readLine(line2) && line1 == "@job" && line2 == "@end" && !server.readLine(line1),
+		string("wrong lines received"));
+	server.close();
+	listener.close();
+}
+
+///////////////////////////////////////////////////////////////////////////
+////	TILEFARM.H
+void testTileFarm()
+{
+	Material mat(Vector3d(0.5, 0.5, 0.5), 0.0, 0.0, 0.0, 4.0);
+	Material lightMat(Vector3d(1.0, 1.0, 1.0), 0.0, 0.0, 0.0, 0.0);
+	Vector3d n(0.0, -1.0, 0.0);
+	TestModel model;
+	model.objects_.push_back(Object());
+	model.objects_.at(0).shapes.push_back(new Triangle(Point(-10.0, 3.0, -10.0), Point(10.0, 3.0, -10.0), Point(0.0, 3.0, 10.0), n, n, n, &mat));
+
+	// 3x2 tiles, the last column and row are partial
+	Camera c(Vector3d(0.0, 0.0, 0.0), Vector3d(0.0, 1.0, 0.0), 70, 40, 90);
+	Light light(Vector3d(0.0, -1.0, 0.0), 0.0, &lightMat);
+	RayTracer rt(c, light, &model);
+	rt.setThreads(1);
+	vector<Vector3d> reference(70 * 40);
+	rt.render(&reference[0]);
+
+	// -- test 1 -- the image assembled from the ranges of the worker is the image rendered at once
+	const unsigned short port = 47391;
+	vector<Vector3d> image(70 * 40, Vector3d(-1.0));
+	TileCoordinator coordinator(70, 40, 4);
+	thread coordinatorThread([&]() { coordinator.run(port, &image[0]); });
+	bool worked = false;
+	for(int attempt = 0; attempt < 50 && !worked; attempt++) {
+		worked = TileWorker::run("127.0.0.1:47391", rt);
+		if(!worked)
+			this_thread::sleep_for(chrono::milliseconds(20));
+	}
+	coordinatorThread.join();
+	bool same = true;
+	for(int i = 0; i < (int)image.size(); i++)
+		same = same && image.at(i) == reference.at(i);
+	Test::assertTrue(worked && coordinator.getWorkers() == 1 && coordinator.getRequeued() == 0, string("worker not served"));
+	Test::assertTrue(same, string("wrong pixels assembled"));
+
+	// -- test 2 -- the range of the lost worker goes to the next one
+	TileCoordinator another(70, 40, 4);
+	thread anotherThread([&]() { another.run(port, &image[0]); });
+	TcpConnection lost;
+	for(int attempt = 0; attempt < 50 && !lost.connect("127.0.0.1:47391"); attempt++)
+		this_thread::sleep_for(chrono::milliseconds(20));
+	string line;
+	lost.write("worker 70 40\n");
+	lost.readLine(line);
+	lost.close();
+	worked = TileWorker::run("127.0.0.1:47391", rt);
+	anotherThread.join();
+	Test::assertTrue(line == "tiles 0 4" && worked && another.getRequeued() == 1 && another.getWorkers() == 2, string("lost range not queued again"));
+}
+
 int main(int argc, char** argv) 
 {
 	// -- TEST Vector.h --
@@ -160,4 +1213,56 @@ int main(int argc, char** argv)
 	
 	// -- TEST Sphere --
 	Test("Sphere", testSphere);	
+
+	// -- TEST Rasterizer --
+	Test("Rasterizer", testRasterizer);
+
+	// -- TEST Scheduler --
+	Test("Scheduler", testScheduler);
+
+	// -- TEST ImageWriter --
+	Test("ImageWriter", testImageWriter);
+
+	// -- TEST Stats --
+	Test("Stats", testStats);
+
+	// -- TEST Heatmap --
+	Test("Heatmap", testHeatmap);
+
+	// -- TEST Light --
+	Test("Light", testSoftShadows);
+	Test("Light", testMultipleLights);
+
+	// -- TEST Decimator --
+	Test("Decimator", testDecimator);
+	Test("Decimator", testLod);
+
+	// -- TEST Arena --
+	Test("Arena", testArena);
+
+	// -- TEST Primitives --
+	Test("Primitives", testPrimitives);
+
+	// -- TEST BoardGrid --
+	Test("BoardGrid", testBoardGrid);
+
+	// -- TEST ReflectionCache --
+	Test("ReflectionCache", testReflectionCache);
+
+	// -- TEST Bvh --
+	Test("Bvh", testBvh);
+
+	// -- TEST RayTracer --
+	Test("RayTracer", testEstimate);
+	Test("RayTracer", testShadingKernels);
+	Test("RayTracer", testCropWindow);
+
+	// -- TEST SceneDescription --
+	Test("SceneDescription", testSceneDescription);
+
+	// -- TEST RenderServer --
+	Test("RenderServer", testRenderServer);
+
+	// -- TEST TileFarm --
+	Test("TileFarm", testTileFarm);
 }
@@ -0,0 +1,127 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <vector>
+#include <cstddef>
+#include <new>
+
+using namespace std;
+
+//! Block (bump pointer) allocator of the scene geometry
+/*!
+	The memory is taken from big blocks, an allocation only moves the offset
+	in the current block. Nothing is freed individually - all the memory is
+	returned in one step by reset() (the blocks are kept and reused by the
+	next scene) or release() (the blocks are freed).
+
+	The objects are created by the placement new:
+
+		Triangle* t = new (arena) Triangle(...);
+
+	and their destructors are NEVER called, so only the objects which do not
+	own any other memory (shapes, bounding volumes, tree nodes) may be
+	allocated from the arena.
+*/
+class Arena
+{
+public:
+	Arena(size_t blockSize = DEFAULT_BLOCK_SIZE) : blockSize_(blockSize), current_(0), offset_(0), used_(0) { }
+	~Arena() { release(); }
+
+	//! Returns the memory of the given size aligned to the given power of two
+	void* allocate(size_t size, size_t alignment = ALIGNMENT);
+
+	//! Forgets all the allocations, the blocks are kept for reuse
+	void reset();
+
+	//! Frees all the blocks
+	void release();
+
+	//! Bytes allocated since the last reset (including the alignment padding)
+	size_t bytesUsed() const { return used_; }
+
+	//! Bytes of all the blocks
+	size_t bytesReserved() const;
+
+	static const size_t DEFAULT_BLOCK_SIZE;
+	static const size_t ALIGNMENT;
+
+private:
+	struct Block {
+		char* data;
+		size_t size;
+	};
+
+	// the arena owns the blocks - not copyable
+	Arena(const Arena&);
+	Arena& operator=(const Arena&);
+
+	size_t blockSize_;
+	vector<Block> blocks_;
+	size_t current_;		// block the allocations are taken from
+	size_t offset_;			// first free byte of the current block
+	size_t used_;
+};
+
+const size_t Arena::DEFAULT_BLOCK_SIZE = 256 * 1024;
+const size_t Arena::ALIGNMENT = 16;
+
+inline void* Arena::allocate(size_t size, size_t alignment)
+{
+	// find the first block (from the current one) the aligned allocation fits in
+	while(current_ < blocks_.size()) {
+		Block& block = blocks_.at(current_);
+		size_t address = (size_t)(block.data + offset_);
+		size_t padding = (alignment - address % alignment) % alignment;
+		if(offset_ + padding + size <= block.size) {
+			offset_ += padding + size;
+			used_ += padding + size;
+			return block.data + offset_ - size;
+		}
+		current_++;
+		offset_ = 0;
+	}
+
+	// new block, big allocations get a block of their own
+	Block block;
+	block.size = (size + alignment > blockSize_) ? size + alignment : blockSize_;
+	block.data = static_cast<char *>(::operator new(block.size));
+	blocks_.push_back(block);
+	current_ = blocks_.size() - 1;
+	offset_ = 0;
+	return allocate(size, alignment);
+}
+
+inline void Arena::reset()
+{
+	current_ = 0;
+	offset_ = 0;
+	used_ = 0;
+}
+
+inline void Arena::release()
+{
+	for(int i = 0; i < (int)blocks_.size(); i++)
+		::operator delete(blocks_.at(i).data);
+	blocks_.clear();
+	reset();
+}
+
+inline size_t Arena::bytesReserved() const
+{
+	size_t bytes = 0;
+	for(int i = 0; i < (int)blocks_.size(); i++)
+		bytes += blocks_.at(i).size;
+	return bytes;
+}
+
+//! Placement new allocating from the arena
+inline void* operator new(size_t size, Arena& arena)
+{
+	return arena.allocate(size);
+}
+
+//! Called only if the constructor throws, the memory is returned by the arena reset
+inline void operator delete(void*, Arena&) { }
+
+#endif
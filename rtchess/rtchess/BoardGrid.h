@@ -0,0 +1,213 @@
+#ifndef _BOARDGRID_H_
+#define _BOARDGRID_H_
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "Vector3d.h"
+#include "Ray.h"
+#include "common.h"
+
+using namespace std;
+
+//! Uniform grid of the chessboard fields (8x8 cells, one cell high)
+/*!
+	Each cell lists the objects (pieces) whose bounding box overlaps the
+	field, usually just the piece standing on it. The rays are walked through
+	the cells in their order by the 3D-DDA (the grid has one layer, so the
+	walk steps in x and y only, the height limits where it starts and ends),
+	so the empty fields cost only the step to the next cell.
+
+	The grid holds at most MAX_OBJECTS objects (indices < MAX_OBJECTS), an
+	object spanning several fields is listed in each of them.
+*/
+class BoardGrid
+{
+public:
+	//! State of the walk of a ray through the cells
+	struct Walk {
+		int x, y;				// current cell
+		int stepX, stepY;		// direction of the steps
+		double tMaxX, tMaxY;	// ray parameter of the next cell boundary in x and y
+		double tDeltaX, tDeltaY;// ray parameter of one cell in x and y
+		double tEnd;			// ray parameter where the ray leaves the grid (or its maximal distance)
+		double tExit;			// ray parameter where the ray leaves the current cell
+	};
+
+	BoardGrid() : cellWidth_(0.0), zMin_(INFINITY), zMax_(-INFINITY), members_(0) { }
+
+	//! Removes all the objects and sets the corner (minimal x and y) and the width of the cells
+	void init(Point& corner, double cellWidth);
+
+	//! Puts the object into all the cells its bounding box overlaps
+	void insert(int object, Vector3d& cmin, Vector3d& cmax);
+
+	//! Removes the object from all the cells
+	void remove(int object);
+
+	//! Returns true if the object is in the grid
+	bool contains(int object) const { return object < MAX_OBJECTS && (members_ & (1ULL << object)) != 0; }
+
+	//! Returns true if no object is in the grid
+	bool empty() const { return members_ == 0; }
+
+	//! Objects of the current cell of the walk
+	vector<int>& cell(Walk& walk) { return cells_[walk.y][walk.x]; }
+
+	//! Bit of the current cell of the walk in the masks of the cells (numbered row by row)
+	static unsigned long long cellBit(const Walk& walk) { return 1ULL << (walk.y * CELLS + walk.x); }
+
+	//! Mask of the cells listing the object
+	unsigned long long cellsOf(int object) const;
+
+	//! Starts the walk of the ray (up to the distance), false if the ray misses the grid
+	bool begin(const Ray& ray, double maxDist, Walk& walk);
+
+	//! Steps to the next cell along the ray, false if the ray leaves the grid
+	bool next(Walk& walk);
+
+	static const int CELLS = 8;
+	static const int MAX_OBJECTS = 64;
+	static const double EPSILON;
+
+private:
+	Point corner_;
+	double cellWidth_;
+	double zMin_, zMax_;			// vertical extent of the objects
+	unsigned long long members_;	// bit mask of the objects in the grid
+	vector<int> cells_[CELLS][CELLS];
+};
+
+const double BoardGrid::EPSILON = 1e-6;
+
+inline void BoardGrid::init(Point& corner, double cellWidth)
+{
+	corner_ = corner;
+	cellWidth_ = cellWidth;
+	zMin_ = INFINITY;
+	zMax_ = -INFINITY;
+	members_ = 0;
+	for(int i = 0; i < CELLS; i++)
+		for(int j = 0; j < CELLS; j++)
+			cells_[i][j].clear();
+}
+
+inline void BoardGrid::insert(int object, Vector3d& cmin, Vector3d& cmax)
+{
+	if(cellWidth_ <= 0.0 || object < 0 || object >= MAX_OBJECTS)
+		return;
+
+	remove(object);
+
+	// the box is padded a bit, so the rays walked along a cell boundary do not miss the object
+	double pad = cellWidth_ * EPSILON;
+	int x0 = (int)floor((cmin.x_ - pad - corner_.x_) / cellWidth_);
+	int x1 = (int)floor((cmax.x_ + pad - corner_.x_) / cellWidth_);
+	int y0 = (int)floor((cmin.y_ - pad - corner_.y_) / cellWidth_);
+	int y1 = (int)floor((cmax.y_ + pad - corner_.y_) / cellWidth_);
+
+	// objects reaching out of the board are not accelerated
+	if(x0 < 0 || y0 < 0 || x1 >= CELLS || y1 >= CELLS)
+		return;
+
+	for(int y = y0; y <= y1; y++)
+		for(int x = x0; x <= x1; x++)
+			cells_[y][x].push_back(object);
+
+	members_ |= 1ULL << object;
+	zMin_ = min(zMin_, cmin.z_ - pad);
+	zMax_ = max(zMax_, cmax.z_ + pad);
+}
+
+inline void BoardGrid::remove(int object)
+{
+	if(!contains(object))
+		return;
+
+	for(int i = 0; i < CELLS; i++)
+		for(int j = 0; j < CELLS; j++)
+			cells_[i][j].erase(std::remove(cells_[i][j].begin(), cells_[i][j].end(), object), cells_[i][j].end());
+	members_ &= ~(1ULL << object);
+}
+
+inline unsigned long long BoardGrid::cellsOf(int object) const
+{
+	unsigned long long mask = 0;
+	if(!contains(object))
+		return mask;
+
+	for(int y = 0; y < CELLS; y++)
+		for(int x = 0; x < CELLS; x++)
+			if(find(cells_[y][x].begin(), cells_[y][x].end(), object) != cells_[y][x].end())
+				mask |= 1ULL << (y * CELLS + x);
+	return mask;
+}
+
+inline bool BoardGrid::begin(const Ray& ray, double maxDist, Walk& walk)
+{
+	if(empty())
+		return false;
+
+	const Point& s = ray.getStart();
+	const Vector3d& d = ray.getDir();
+	double size = CELLS * cellWidth_;
+	double lo[3] = { corner_.x_, corner_.y_, zMin_ };
+	double hi[3] = { corner_.x_ + size, corner_.y_ + size, zMax_ };
+	double start[3] = { s.x_, s.y_, s.z_ };
+	double dir[3] = { d.x_, d.y_, d.z_ };
+
+	// clip the ray by the box of the grid (slabs)
+	double tEnter = 0.0;
+	double tEnd = maxDist;
+	for(int a = 0; a < 3; a++) {
+		if(dir[a] == 0.0) {
+			if(start[a] < lo[a] || start[a] > hi[a])
+				return false;
+			continue;
+		}
+		double t0 = (lo[a] - start[a]) / dir[a];
+		double t1 = (hi[a] - start[a]) / dir[a];
+		if(t0 > t1) swap(t0, t1);
+		tEnter = max(tEnter, t0);
+		tEnd = min(tEnd, t1);
+	}
+	if(tEnter > tEnd)
+		return false;
+
+	// cell the ray enters the grid at
+	double px = s.x_ + d.x_ * tEnter - corner_.x_;
+	double py = s.y_ + d.y_ * tEnter - corner_.y_;
+	walk.x = min(max((int)floor(px / cellWidth_), 0), CELLS - 1);
+	walk.y = min(max((int)floor(py / cellWidth_), 0), CELLS - 1);
+
+	walk.stepX = (d.x_ > 0.0) ? 1 : -1;
+	walk.stepY = (d.y_ > 0.0) ? 1 : -1;
+	walk.tDeltaX = (d.x_ != 0.0) ? cellWidth_ / fabs(d.x_) : INFINITY;
+	walk.tDeltaY = (d.y_ != 0.0) ? cellWidth_ / fabs(d.y_) : INFINITY;
+	walk.tMaxX = (d.x_ != 0.0) ? (corner_.x_ + (walk.x + (walk.stepX > 0)) * cellWidth_ - s.x_) / d.x_ : INFINITY;
+	walk.tMaxY = (d.y_ != 0.0) ? (corner_.y_ + (walk.y + (walk.stepY > 0)) * cellWidth_ - s.y_) / d.y_ : INFINITY;
+	walk.tEnd = tEnd;
+	walk.tExit = min(min(walk.tMaxX, walk.tMaxY), tEnd);
+	return true;
+}
+
+inline bool BoardGrid::next(Walk& walk)
+{
+	if(walk.tExit >= walk.tEnd)
+		return false;
+
+	if(walk.tMaxX < walk.tMaxY) {
+		walk.x += walk.stepX;
+		walk.tMaxX += walk.tDeltaX;
+	} else {
+		walk.y += walk.stepY;
+		walk.tMaxY += walk.tDeltaY;
+	}
+	if(walk.x < 0 || walk.x >= CELLS || walk.y < 0 || walk.y >= CELLS)
+		return false;
+
+	walk.tExit = min(min(walk.tMaxX, walk.tMaxY), walk.tEnd);
+	return true;
+}
+
+#endif
@@ -0,0 +1,350 @@
+#ifndef _BVH_H_
+#define _BVH_H_
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "Vector3d.h"
+#include "Ray.h"
+#include "Arena.h"
+#include "common.h"
+
+using namespace std;
+
+//! Bounding volume hierarchy of the objects of the model (top level)
+/*!
+	Binary tree of axis aligned boxes, each leaf holds one object. The tree is
+	built top-down by the surface area heuristic (SAH). When an object moves
+	only its leaf and the nodes above it are refitted (bottom-up), the shape of
+	the tree stays the same. The refitted tree gets worse as the objects move
+	away from their neighbours, so its SAH cost is tracked and the tree should
+	be built again once the cost grows over the rebuild ratio times the cost of
+	the built tree (see degraded()).
+
+	The nodes are allocated from the arena of the tree, which is reset by each
+	build.
+*/
+class Bvh
+{
+public:
+	struct Node {
+		Vector3d cmin, cmax;	// bounding box
+		Node* parent;
+		Node* child[2];
+		int object;				// object of the leaf, -1 for the inner nodes
+		double area;			// surface of the box
+	};
+
+	Bvh() : arena_(NODE_BLOCK_SIZE), root_(NULL), areaSum_(0.0), leafAreaSum_(0.0), builtCost_(0.0), rebuildRatio_(DEFAULT_REBUILD_RATIO), builds_(0) { }
+
+	//! Builds the tree of the objects with the given bounding boxes (object i has the box cmin[i], cmax[i])
+	/*! Objects with an empty box (without shapes, cmin > cmax) are left out of the tree.
+	*/
+	void build(vector<Vector3d>& cmin, vector<Vector3d>& cmax);
+
+	//! Removes all the objects
+	void clear();
+
+	//! Sets the new bounding box of the object and refits the nodes above it
+	/*! @return false if the object is not in the tree or its box is empty now - the tree has to be built again
+	*/
+	bool refit(int object, Vector3d& cmin, Vector3d& cmax);
+
+	//! SAH cost of the tree - surface of all the nodes relative to the surface of the leaves
+	/*! The moves do not change the leaves, so the cost grows with the surface of the inner nodes.
+	*/
+	double cost() const { return (leafAreaSum_ <= 0.0) ? 0.0 : areaSum_ / leafAreaSum_; }
+
+	//! Returns true if the refitted tree is worse than the built one by more than the rebuild ratio
+	bool degraded() const { return cost() > builtCost_ * rebuildRatio_; }
+
+	void setRebuildRatio(double ratio) { rebuildRatio_ = ratio; }
+	double getRebuildRatio() const { return rebuildRatio_; }
+
+	//! Number of the builds so far
+	unsigned getBuilds() const { return builds_; }
+
+	//! Number of the objects in the tree
+	size_t size() const { return leaves_.size(); }
+
+	//! Returns true if the tree was built (it has no root if all the objects are empty)
+	bool built() const { return !leaves_.empty(); }
+
+	//! Visits the objects whose leaves the ray hits closer than maxDist, nearer nodes first
+	/*!	The visitor is called as visitor(object) and returns true to stop the
+		traversal. It may shorten maxDist (e.g. to the closest hit found), the
+		nodes beyond it are skipped.
+		@param tests is increased by the number of the box tests
+		@return true if the visitor stopped the traversal
+	*/
+	template<class Visitor>
+	bool traverse(const Ray& ray, double& maxDist, Visitor& visitor, long long& tests) const;
+
+	static const double DEFAULT_REBUILD_RATIO;
+	static const size_t NODE_BLOCK_SIZE;
+	static const int MAX_DEPTH = 64;
+
+private:
+	// the nodes live in the arena - not copyable
+	Bvh(const Bvh&);
+	Bvh& operator=(const Bvh&);
+
+	//! Builds the subtree of the objects [first, last) of objects_
+	Node* build(int first, int last, int depth, vector<Vector3d>& cmin, vector<Vector3d>& cmax);
+
+	//! Sets the box of the inner node to the union of its children
+	void fit(Node* node);
+
+	static double area(const Vector3d& cmin, const Vector3d& cmax);
+
+	//! Returns true if the box contains no point (the bounds of an object without shapes)
+	static bool empty(const Vector3d& cmin, const Vector3d& cmax);
+
+	//! Ray parameter where the ray enters the box, false if it misses the box before maxDist
+	static bool hits(const Node* node, const Point& start, const Vector3d& dir, double maxDist, double& tEnter);
+
+	Arena arena_;
+	Node* root_;
+	vector<Node *> leaves_;		// leaf of each object
+	vector<int> objects_;		// objects sorted by the build
+	double areaSum_;			// surface of all the nodes
+	double leafAreaSum_;		// surface of the leaves
+	double builtCost_;			// cost of the tree when it was built
+	double rebuildRatio_;
+	unsigned builds_;
+};
+
+const double Bvh::DEFAULT_REBUILD_RATIO = 1.5;
+const size_t Bvh::NODE_BLOCK_SIZE = 16 * 1024;
+
+//! Orders the objects by the centre of their box along one axis
+struct BvhCentreLess {
+	BvhCentreLess(vector<Vector3d>& cmin, vector<Vector3d>& cmax, int axis) : cmin(cmin), cmax(cmax), axis(axis) { }
+	bool operator()(int a, int b) const {
+		const double* ca = &cmin[a].x_;
+		const double* cb = &cmin[b].x_;
+		const double* da = &cmax[a].x_;
+		const double* db = &cmax[b].x_;
+		return ca[axis] + da[axis] < cb[axis] + db[axis];
+	}
+	vector<Vector3d>& cmin;
+	vector<Vector3d>& cmax;
+	int axis;
+};
+
+inline double Bvh::area(const Vector3d& cmin, const Vector3d& cmax)
+{
+	Vector3d d = cmax - cmin;
+	return 2.0 * (d.x_ * d.y_ + d.y_ * d.z_ + d.z_ * d.x_);
+}
+
+inline bool Bvh::empty(const Vector3d& cmin, const Vector3d& cmax)
+{
+	return !(cmin.x_ <= cmax.x_ && cmin.y_ <= cmax.y_ && cmin.z_ <= cmax.z_);
+}
+
+inline void Bvh::clear()
+{
+	arena_.reset();
+	root_ = NULL;
+	leaves_.clear();
+	objects_.clear();
+	areaSum_ = 0.0;
+	leafAreaSum_ = 0.0;
+	builtCost_ = 0.0;
+}
+
+inline void Bvh::build(vector<Vector3d>& cmin, vector<Vector3d>& cmax)
+{
+	clear();
+	leaves_.assign(cmin.size(), NULL);
+	for(int i = 0; i < (int)cmin.size(); i++)
+		if(!empty(cmin[i], cmax[i]))
+			objects_.push_back(i);
+	if(objects_.empty())
+		return;
+
+	root_ = build(0, (int)objects_.size(), 0, cmin, cmax);
+	root_->parent = NULL;
+	builtCost_ = cost();
+	builds_++;
+}
+
+inline Bvh::Node* Bvh::build(int first, int last, int depth, vector<Vector3d>& cmin, vector<Vector3d>& cmax)
+{
+	Node* node = new (arena_) Node();
+	node->child[0] = node->child[1] = NULL;
+
+	if(last - first == 1) {
+		node->object = objects_[first];
+		node->cmin = cmin[node->object];
+		node->cmax = cmax[node->object];
+		node->area = area(node->cmin, node->cmax);
+		areaSum_ += node->area;
+		leafAreaSum_ += node->area;
+		leaves_[node->object] = node;
+		return node;
+	}
+
+	// split with the lowest SAH cost - objects sorted along each axis, the surfaces of the both sides swept
+	int n = last - first;
+	int bestAxis = 0;
+	int bestSplit = n / 2;
+	double bestCost = INFINITY;
+	vector<double> leftArea(n);
+	for(int axis = 0; axis < 3; axis++) {
+		sort(objects_.begin() + first, objects_.begin() + last, BvhCentreLess(cmin, cmax, axis));
+
+		Vector3d lo(INFINITY), hi(-INFINITY);
+		for(int i = 0; i < n; i++) {
+			int o = objects_[first + i];
+			lo = Vector3d(min(lo.x_, cmin[o].x_), min(lo.y_, cmin[o].y_), min(lo.z_, cmin[o].z_));
+			hi = Vector3d(max(hi.x_, cmax[o].x_), max(hi.y_, cmax[o].y_), max(hi.z_, cmax[o].z_));
+			leftArea[i] = area(lo, hi);
+		}
+
+		lo = Vector3d(INFINITY);
+		hi = Vector3d(-INFINITY);
+		for(int i = n - 1; i > 0; i--) {
+			int o = objects_[first + i];
+			lo = Vector3d(min(lo.x_, cmin[o].x_), min(lo.y_, cmin[o].y_), min(lo.z_, cmin[o].z_));
+			hi = Vector3d(max(hi.x_, cmax[o].x_), max(hi.y_, cmax[o].y_), max(hi.z_, cmax[o].z_));
+			// left side [0, i), right side [i, n)
+			double c = leftArea[i - 1] * i + area(lo, hi) * (n - i);
+			if(c < bestCost) {
+				bestCost = c;
+				bestAxis = axis;
+				bestSplit = i;
+			}
+		}
+	}
+	// deep trees (degenerate SAH splits) are halved, so the traversal stack cannot overflow
+	if(depth >= MAX_DEPTH / 2)
+		bestSplit = n / 2;
+	if(bestAxis != 2)
+		sort(objects_.begin() + first, objects_.begin() + last, BvhCentreLess(cmin, cmax, bestAxis));
+
+	node->object = -1;
+	node->child[0] = build(first, first + bestSplit, depth + 1, cmin, cmax);
+	node->child[1] = build(first + bestSplit, last, depth + 1, cmin, cmax);
+	node->child[0]->parent = node;
+	node->child[1]->parent = node;
+	fit(node);
+	areaSum_ += node->area;
+	return node;
+}
+
+inline void Bvh::fit(Node* node)
+{
+	Node* a = node->child[0];
+	Node* b = node->child[1];
+	node->cmin = Vector3d(min(a->cmin.x_, b->cmin.x_), min(a->cmin.y_, b->cmin.y_), min(a->cmin.z_, b->cmin.z_));
+	node->cmax = Vector3d(max(a->cmax.x_, b->cmax.x_), max(a->cmax.y_, b->cmax.y_), max(a->cmax.z_, b->cmax.z_));
+	node->area = area(node->cmin, node->cmax);
+}
+
+inline bool Bvh::refit(int object, Vector3d& cmin, Vector3d& cmax)
+{
+	if(object < 0 || object >= (int)leaves_.size() || leaves_[object] == NULL || empty(cmin, cmax))
+		return false;
+
+	Node* node = leaves_[object];
+	areaSum_ -= node->area;
+	leafAreaSum_ -= node->area;
+	node->cmin = cmin;
+	node->cmax = cmax;
+	node->area = area(cmin, cmax);
+	areaSum_ += node->area;
+	leafAreaSum_ += node->area;
+
+	// only the nodes on the path to the root change
+	for(node = node->parent; node != NULL; node = node->parent) {
+		areaSum_ -= node->area;
+		fit(node);
+		areaSum_ += node->area;
+	}
+	return true;
+}
+
+inline bool Bvh::hits(const Node* node, const Point& start, const Vector3d& dir, double maxDist, double& tEnter)
+{
+	const double* lo = &node->cmin.x_;
+	const double* hi = &node->cmax.x_;
+	const double* s = &start.x_;
+	const double* d = &dir.x_;
+
+	double tNear = 0.0;
+	double tFar = maxDist;
+	for(int a = 0; a < 3; a++) {
+		if(d[a] == 0.0) {
+			if(s[a] < lo[a] || s[a] > hi[a])
+				return false;
+			continue;
+		}
+		double t0 = (lo[a] - s[a]) / d[a];
+		double t1 = (hi[a] - s[a]) / d[a];
+		if(t0 > t1) swap(t0, t1);
+		tNear = max(tNear, t0);
+		tFar = min(tFar, t1);
+		if(tNear > tFar)
+			return false;
+	}
+	tEnter = tNear;
+	return true;
+}
+
+template<class Visitor>
+inline bool Bvh::traverse(const Ray& ray, double& maxDist, Visitor& visitor, long long& tests) const
+{
+	if(root_ == NULL)
+		return false;
+
+	const Point& start = ray.getStart();
+	const Vector3d& dir = ray.getDir();
+
+	// stack of the nodes to visit with the distance the ray enters them
+	const Node* stack[MAX_DEPTH];
+	double enter[MAX_DEPTH];
+	int top = 0;
+
+	double t;
+	tests++;
+	if(!hits(root_, start, dir, maxDist, t))
+		return false;
+	stack[top] = root_;
+	enter[top++] = t;
+
+	while(top > 0) {
+		const Node* node = stack[--top];
+		if(enter[top] > maxDist)
+			continue;
+
+		if(node->object >= 0) {
+			if(visitor(node->object))
+				return true;
+			continue;
+		}
+
+		// the nearer child is visited first
+		double t0, t1;
+		tests += 2;
+		bool hit0 = hits(node->child[0], start, dir, maxDist, t0);
+		bool hit1 = hits(node->child[1], start, dir, maxDist, t1);
+		if(hit0 && hit1) {
+			int nearer = (t0 <= t1) ? 0 : 1;
+			stack[top] = node->child[1 - nearer];
+			enter[top++] = nearer ? t0 : t1;
+			stack[top] = node->child[nearer];
+			enter[top++] = nearer ? t1 : t0;
+		} else if(hit0) {
+			stack[top] = node->child[0];
+			enter[top++] = t0;
+		} else if(hit1) {
+			stack[top] = node->child[1];
+			enter[top++] = t1;
+		}
+	}
+	return false;
+}
+
+#endif
@@ -1,7 +1,11 @@
 #ifndef _CAMERA_H_
 #define _CAMERA_H_
 
+#include <vector>
+#include <algorithm>
 #include "Vector3d.h"
+#include "Tile.h"
+#include "common.h"
 #include <Eigen\Dense>
 
 #define PI 3.14159265
@@ -9,6 +13,20 @@
 
 using namespace std;
 
+//! Normalized directions of primary rays in structure-of-arrays layout
+/*!	Rays are stored row by row in the order of the pixels of the tile.
+*/
+struct RayBatch
+{
+	void resize(int n) { x.resize(n); y.resize(n); z.resize(n); }
+	int size() const { return (int)x.size(); }
+	Vector3d direction(int i) const { return Vector3d(x[i], y[i], z[i]); }
+
+	vector<double> x;
+	vector<double> y;
+	vector<double> z;
+};
+
 //! Class implementing camera for viewing the scene
 /*!
 	The projection screen is actually virtual and is not anyhow
@@ -29,7 +47,10 @@ class Camera
 public:		
 	const Point screenCenter;			
 	
-	Camera() { }
+	Camera() : screenCenter(Vector3d(0.0, 1.0, 0.0)), 
+			fixedPosition(Vector3d(0.0, 0.0, 0.0)),
+			fixedDirection(Vector3d(0.0, 1.0, 0.0)),
+			jitter_(JITTER_NONE), samples_(1) { }
 
 	//! Constructor
 	Camera(Vector3d position, Vector3d direction, 
@@ -39,10 +60,21 @@ public:
 			horizontalPixels_(horizontalPixels), verticalPixels_(verticalPixels),
 			fieldOfView_(fieldOfView), screenCenter(Vector3d(0.0, 1.0, 0.0)), 
 			fixedPosition(Vector3d(0.0, 0.0, 0.0)),
-			fixedDirection(Vector3d(0.0, 1.0, 0.0))
+			fixedDirection(Vector3d(0.0, 1.0, 0.0)),
+			jitter_(JITTER_NONE), samples_(1)
 	{ 
 		updatePxStep();
 	}
+
+	//! Sub-pixel sample patterns for anti-aliasing
+	enum JitterPattern {
+		JITTER_NONE,		// single sample in the pixel center
+		JITTER_GRID,		// regular n x n grid
+		JITTER_STRATIFIED	// n x n strata, random position within each stratum
+	};
+
+	//! Maximal number of cached ray directions (3 doubles each)
+	static const unsigned RAY_CACHE_LIMIT;
 	
 	//! Destructor
 	~Camera() { }	
@@ -59,6 +91,12 @@ public:
 		updatePxStep();
 	}
 
+	void setLocation(Point position, Vector3d direction) {
+		position_ = position;
+		direction_ = direction.normalize();
+		updatePxStep();
+	}
+
 	void setResolution(unsigned horizontalPixels, unsigned verticalPixels)
 	{
 		horizontalPixels_ = horizontalPixels;
@@ -68,6 +106,25 @@ public:
 
 	unsigned getScreenWidth() { return horizontalPixels_; }
 	unsigned getScreenHeight() { return verticalPixels_; }
+
+	//! Renders only the rectangle of the screen, the image has the size of the rectangle.
+	/*!	The rays keep the directions they have in the full screen, so the
+		pixels equal the same region of the full image. The rectangle is
+		clipped by the screen, an empty one renders the full screen.
+	*/
+	void setCrop(Tile crop)
+	{
+		crop_ = crop;
+		rayCache.resize(0);
+	}
+
+	void clearCrop() { setCrop(Tile()); }
+
+	//! Rendered rectangle of the screen (the full screen if there is no crop window)
+	Tile getCrop();
+
+	unsigned getImageWidth() { return getCrop().width; }
+	unsigned getImageHeight() { return getCrop().height; }
 	 
 	void setFieldOfView(double horizontalAngle) 
 	{
@@ -77,6 +134,25 @@ public:
 
 	double getFieldOfView() { return fieldOfView_; }
 
+	//! Sets the sub-pixel sample pattern, the number of samples is rounded down to a square
+	void setJitter(JitterPattern pattern, unsigned samplesPerPixel);
+
+	JitterPattern getJitter() { return jitter_; }
+	unsigned getSamplesPerPixel() { return samples_; }
+
+	//! Generates normalized directions of the primary rays of the given sample through the tile.
+	/*!	The directions are taken from the cache if prepareRays() was called
+		for the current camera settings, otherwise they are computed.
+	*/
+	void generateRays(Tile& tile, RayBatch& batch, unsigned sample = 0);
+
+	//! Precomputes directions of all primary rays (of the crop window).
+	/*!	The cache stays valid until the camera is changed, so rendering of
+		more frames from the same camera (e.g. batch mode) reuses it. It is
+		not built for resolutions exceeding RAY_CACHE_LIMIT rays.
+	*/
+	void prepareRays();
+
 	double getPxStep() 
 	{
 		return pxStep;
@@ -85,6 +161,25 @@ public:
 	Point getTopLeftPX() { return TLPx; }
 	Vector3d& getWidthStep() { return xStep; } 
 	Vector3d& getHeightStep() { return zStep; } 
+	Vector3d& getForward() { return forward; }
+
+	//! Projects the point onto the virtual projection screen.
+	/*!	x, y are continuous pixel coordinates (centers of pixels have integer
+		coordinates, [0, 0] is the top left pixel), depth is the distance of the
+		point from the camera along the viewing direction.
+		@return false if the point lies behind the camera.
+	*/
+	bool project(Point& p, double& x, double& y, double& depth);
+
+	//! Returns the longer side (in pixels) of the screen rectangle covering the projected box.
+	/*! @return INFINITY if some corner of the box lies behind the camera.
+	*/
+	double projectedSize(Point& cmin, Point& cmax);
+
+	//! Returns the area (in pixels) of the crop window covered by the projected box (the convex hull of its corners).
+	/*! All the pixels are covered if some corner of the box lies behind the camera.
+	*/
+	double projectedArea(Point& cmin, Point& cmax);
 
 	void operator=(Camera other) {
 		position_ = other.position();
@@ -95,7 +190,13 @@ public:
 		TLPx = other.getTopLeftPX();
 		xStep = other.getWidthStep();
 		zStep = other.getHeightStep();
+		forward = other.getForward();
 		pxStep = other.getPxStep();
+		focalDist = other.focalDist;
+		jitter_ = other.getJitter();
+		samples_ = other.getSamplesPerPixel();
+		crop_ = other.crop_;
+		rayCache.resize(0);
 	}
 
 private:
@@ -111,13 +212,140 @@ private:
 	Point TLPx;
 	Vector3d xStep;
 	Vector3d zStep;
+	Vector3d forward;	// unit vector perpendicular to the projection screen
 
 	double pxStep;
+	double focalDist;	// distance of the projection screen from the camera
+
+	JitterPattern jitter_;
+	unsigned samples_;
+	Tile crop_;			// rendered rectangle of the screen, empty - full screen
+	RayBatch rayCache;	// directions of all samples of all pixels of the crop window, empty if not prepared
 
 	//! Recounts the real world distance between pixels on virtual projection screen.
 	void updatePxStep();
+
+	//! Computes directions of the primary rays (no cache)
+	void computeRays(Tile& tile, RayBatch& batch, unsigned sample);
+
+	//! Sub-pixel offset of the sample within the pixel, <-0.5, 0.5)
+	void sampleOffset(int x, int y, unsigned sample, double& dx, double& dy);
+
+	//! Order of the points on the screen by x, then by y
+	static bool leftOf(const Vector3d& a, const Vector3d& b) { return a.x_ < b.x_ || (a.x_ == b.x_ && a.y_ < b.y_); }
+
+	//! Screen rectangle covering the projected box, false if some corner lies behind the camera
+	bool projectBox(Point& cmin, Point& cmax, double& xMin, double& yMin, double& xMax, double& yMax);
 };
 
+const unsigned Camera::RAY_CACHE_LIMIT = 1 << 22;
+
+inline Tile Camera::getCrop()
+{
+	int x0 = max(crop_.x, 0), y0 = max(crop_.y, 0);
+	int x1 = min(crop_.x + crop_.width, (int)horizontalPixels_);
+	int y1 = min(crop_.y + crop_.height, (int)verticalPixels_);
+	if(crop_.size() <= 0 || x1 <= x0 || y1 <= y0)
+		return Tile(0, 0, horizontalPixels_, verticalPixels_);
+	return Tile(x0, y0, x1 - x0, y1 - y0);
+}
+
+inline void Camera::setJitter(JitterPattern pattern, unsigned samplesPerPixel)
+{
+	unsigned n = (unsigned)sqrt((double)max(samplesPerPixel, 1u));
+
+	jitter_ = pattern;
+	samples_ = (pattern == JITTER_NONE) ? 1 : n * n;
+	rayCache.resize(0);
+}
+
+inline void Camera::sampleOffset(int x, int y, unsigned sample, double& dx, double& dy)
+{
+	if(jitter_ == JITTER_NONE) {
+		dx = dy = 0.0;
+		return;
+	}
+
+	unsigned n = (unsigned)(sqrt((double)samples_) + 0.5);
+	double cell = 1.0 / n;
+	double rx = 0.5, ry = 0.5;	// position within the stratum
+
+	if(jitter_ == JITTER_STRATIFIED) {
+		// hash of pixel and sample, the pattern does not depend on the order of rendering
+		unsigned h = (unsigned)x * 73856093u ^ (unsigned)y * 19349663u ^ sample * 83492791u;
+		h ^= h >> 16; h *= 0x7feb352du;
+		h ^= h >> 15; h *= 0x846ca68bu;
+		h ^= h >> 16;
+		rx = (h & 0xffff) / 65536.0;
+		ry = (h >> 16) / 65536.0;
+	}
+
+	dx = ((sample % n) + rx) * cell - 0.5;
+	dy = ((sample / n) + ry) * cell - 0.5;
+}
+
+inline void Camera::prepareRays()
+{
+	Tile screen = getCrop();
+	unsigned rays = screen.size() * samples_;
+
+	if(rayCache.size() == (int)rays || rays > RAY_CACHE_LIMIT)
+		return;
+
+	RayBatch batch;
+	rayCache.resize(rays);
+	for(unsigned s = 0; s < samples_; s++) {
+		computeRays(screen, batch, s);
+		copy(batch.x.begin(), batch.x.end(), rayCache.x.begin() + s * screen.size());
+		copy(batch.y.begin(), batch.y.end(), rayCache.y.begin() + s * screen.size());
+		copy(batch.z.begin(), batch.z.end(), rayCache.z.begin() + s * screen.size());
+	}
+}
+
+inline void Camera::generateRays(Tile& tile, RayBatch& batch, unsigned sample)
+{
+	if(rayCache.size() == 0) {
+		computeRays(tile, batch, sample);
+		return;
+	}
+
+	// the tile lies within the crop window
+	Tile screen = getCrop();
+	batch.resize(tile.size());
+	for(int i = 0; i < tile.height; i++) {
+		int src = sample * screen.size() + (tile.y - screen.y + i) * screen.width + tile.x - screen.x;
+		copy(rayCache.x.begin() + src, rayCache.x.begin() + src + tile.width, batch.x.begin() + i * tile.width);
+		copy(rayCache.y.begin() + src, rayCache.y.begin() + src + tile.width, batch.y.begin() + i * tile.width);
+		copy(rayCache.z.begin() + src, rayCache.z.begin() + src + tile.width, batch.z.begin() + i * tile.width);
+	}
+}
+
+inline void Camera::computeRays(Tile& tile, RayBatch& batch, unsigned sample)
+{
+	// direction to the top left pixel center
+	Vector3d tl = TLPx - position_;
+
+	batch.resize(tile.size());
+	for(int i = 0; i < tile.height; i++) {
+		for(int j = 0; j < tile.width; j++) {
+			double ox, oy;
+			sampleOffset(tile.x + j, tile.y + i, sample, ox, oy);
+
+			double u = tile.x + j + ox;
+			double v = tile.y + i + oy;
+			double dx = tl.x_ + u * xStep.x_ + v * zStep.x_;
+			double dy = tl.y_ + u * xStep.y_ + v * zStep.y_;
+			double dz = tl.z_ + u * xStep.z_ + v * zStep.z_;
+			double invLen = 1.0 / sqrt(dx * dx + dy * dy + dz * dz);
+
+			int k = i * tile.width + j;
+			batch.x[k] = dx * invLen;
+			batch.y[k] = dy * invLen;
+			batch.z[k] = dz * invLen;
+		}
+	}
+}
+
 inline void Camera::updatePxStep() 
 {	
 	//// debug
@@ -152,8 +380,9 @@ inline void Camera::updatePxStep()
 									 0.0,          0.0,          1.0, 0.0,
 									 0.0,          0.0,          0.0, 1.0;
 
+	// Rz is orthonormal - its inverse is the transposition
 	Eigen::RowVector4d dirNew4; dirNew4 << dirNew(0), dirNew(1), dirNew(2), 1.0;
-	Eigen::RowVector4d dirProjX = dirNew4 * Rz.inverse();
+	Eigen::RowVector4d dirProjX = dirNew4 * Rz.transpose();
 	Eigen::RowVector3d dirProjX3; dirProjX3 << dirProjX(0), dirProjX(1), dirProjX(2);
 
 	double angleX = acos(max(min(dirProjX3.dot(dir), 1.0), -1.0));
@@ -232,6 +461,108 @@ inline void Camera::updatePxStep()
 	cout << "dz orig: " << dzDebug << endl;
 	cout << "dz new:  " << zStep << endl;*/
 	/*exit(1);*/
+
+	// viewing direction perpendicular to the screen (xStep and zStep are orthogonal)
+	forward = xStep.cross(zStep).normalize();
+	focalDist = (TLPx - position_).dot(forward);
+
+	// cached ray directions are not valid anymore
+	rayCache.resize(0);
+}
+
+inline bool Camera::project(Point& p, double& x, double& y, double& depth)
+{
+	Vector3d d = p - position_;
+	depth = d.dot(forward);
+	if(depth <= 0.0) 
+		return false;
+
+	// intersection of the camera-point line with the screen, relative to the top left pixel
+	Vector3d s = d * (focalDist / depth) - (TLPx - position_);
+	x = s.dot(xStep) / (pxStep * pxStep);
+	y = s.dot(zStep) / (pxStep * pxStep);
+	return true;
+}
+
+inline bool Camera::projectBox(Point& cmin, Point& cmax, double& xMin, double& yMin, double& xMax, double& yMax)
+{
+	xMin = yMin = INFINITY;
+	xMax = yMax = -INFINITY;
+
+	for(int i = 0; i < 8; i++) {
+		Point corner((i & 1) ? cmax.x_ : cmin.x_, (i & 2) ? cmax.y_ : cmin.y_, (i & 4) ? cmax.z_ : cmin.z_);
+		double x, y, depth;
+		if(!project(corner, x, y, depth))
+			return false;
+		xMin = min(xMin, x); xMax = max(xMax, x);
+		yMin = min(yMin, y); yMax = max(yMax, y);
+	}
+	return true;
+}
+
+inline double Camera::projectedSize(Point& cmin, Point& cmax)
+{
+	double xMin, yMin, xMax, yMax;
+	if(!projectBox(cmin, cmax, xMin, yMin, xMax, yMax))
+		return INFINITY;
+
+	return max(xMax - xMin, yMax - yMin);
+}
+
+inline double Camera::projectedArea(Point& cmin, Point& cmax)
+{
+	Tile crop = getCrop();
+
+	// corners of the box on the screen, in the coordinates of the pixel edges
+	vector<Vector3d> corners;
+	for(int i = 0; i < 8; i++) {
+		Point corner((i & 1) ? cmax.x_ : cmin.x_, (i & 2) ? cmax.y_ : cmin.y_, (i & 4) ? cmax.z_ : cmin.z_);
+		double x, y, depth;
+		if(!project(corner, x, y, depth))
+			return (double)crop.size();
+		corners.push_back(Vector3d(x + 0.5, y + 0.5, 0.0));
+	}
+
+	// convex hull (monotone chain), counterclockwise
+	sort(corners.begin(), corners.end(), leftOf);
+	vector<Vector3d> hull(2 * corners.size());
+	int k = 0;
+	for(int i = 0; i < (int)corners.size(); i++) {
+		while(k >= 2 && (hull[k - 1] - hull[k - 2]).cross(corners[i] - hull[k - 2]).z_ <= 0.0) k--;
+		hull[k++] = corners[i];
+	}
+	for(int i = (int)corners.size() - 2, lower = k + 1; i >= 0; i--) {
+		while(k >= lower && (hull[k - 1] - hull[k - 2]).cross(corners[i] - hull[k - 2]).z_ <= 0.0) k--;
+		hull[k++] = corners[i];
+	}
+	hull.resize(max(k - 1, 0));
+
+	// clipped by the edges of the crop window (Sutherland-Hodgman)
+	double bounds[4] = { (double)crop.x, (double)crop.y, (double)(crop.x + crop.width), (double)(crop.y + crop.height) };
+	for(int edge = 0; edge < 4 && !hull.empty(); edge++) {
+		double sign = (edge < 2) ? 1.0 : -1.0;	// the inside of the left and the top edge is above the bound
+		vector<Vector3d> clipped;
+		for(int i = 0; i < (int)hull.size(); i++) {
+			Vector3d& a = hull[i];
+			Vector3d& b = hull[(i + 1) % hull.size()];
+			double da = sign * (((edge % 2) ? a.y_ : a.x_) - bounds[edge]);
+			double db = sign * (((edge % 2) ? b.y_ : b.x_) - bounds[edge]);
+			if(da >= 0.0)
+				clipped.push_back(a);
+			if((da >= 0.0) != (db >= 0.0))
+				clipped.push_back(a + (b - a) * (da / (da - db)));
+		}
+		hull.swap(clipped);
+	}
+
+	// shoelace formula
+	double area = 0.0;
+	for(int i = 0; i < (int)hull.size(); i++) {
+		Vector3d& a = hull[i];
+		Vector3d& b = hull[(i + 1) % hull.size()];
+		area += a.x_ * b.y_ - b.x_ * a.y_;
+	}
+	return fabs(area) * 0.5;
 }
 
 #endif
\ No newline at end of file
@@ -4,6 +4,7 @@
 // C++ includes
 #include <fstream>
 #include <iostream>
+#include <sstream>
 
 // project includes
 #include "Model.h"
@@ -82,11 +83,6 @@ public:
 
 		// load model
 		load(fileName);
-
-		// create bounding box for each object
-		for(int i = 0; i < (int)objects_.size(); i++) {
-			objects_.at(i).createBoundingBox();
-		}
 	}
 
 	~ModelChess() { }
@@ -95,8 +91,20 @@ public:
 	virtual void load(string fileName);		
 
 	//! Moves the given piece from the given position to the new position in Z plane
+	/*! A piece in the board grid is moved in the grid as well, the bounding volume
+		hierarchy is refitted.
+	*/
 	void move(ModelChess::chessModelObjects piece, chessBoardCoords& from, chessBoardCoords& to);
 
+	//! Grid of the chessboard fields with the pieces standing on them
+	virtual BoardGrid* getGrid() { return &grid_; }
+
+	//! Removes all pieces from the board grid
+	void clearGrid();
+
+	//! Puts the piece into the board grid (into the fields its bounding box overlaps)
+	void addToGrid(ModelChess::chessModelObjects piece);
+
 	//! object visibility getter
 	bool getVisibility(chessModelObjects piece) { return objects_.at(piece).visible; }
 
@@ -111,10 +119,16 @@ public:
 	void setObjectMaterial(chessModelObjects obj, Material* m) {  
 		for(int i = 0; i < (int)objects_.at(obj).shapes.size(); i++)
 			objects_.at(obj).shapes.at(i)->mat_ = m;		
+		for(int i = 0; i < (int)objects_.at(obj).proxy.size(); i++)
+			objects_.at(obj).proxy.at(i)->mat_ = m;
+		for(int i = 0; i < (int)objects_.at(obj).lods.size(); i++)
+			for(int j = 0; j < (int)objects_.at(obj).lods.at(i).size(); j++)
+				objects_.at(obj).lods.at(i).at(j)->mat_ = m;
 	}
 
 private:
 	double fieldWidth;
+	BoardGrid grid_;
 	
 	//! Calculates the chessboard field width in loaded model
 	double calculateFieldWidth();	
@@ -136,6 +150,27 @@ inline void ModelChess::move(ModelChess::chessModelObjects piece, chessBoardCoor
 {
 	Vector3d t((to.x - from.x) * fieldWidth, (to.y - from.y) * fieldWidth, 0.0);	
 	objects_.at(piece).translate(t);
+	refitBvh(piece);
+
+	if(grid_.contains(piece))
+		addToGrid(piece);
+}
+
+inline void ModelChess::clearGrid()
+{
+	// the board starts at the minimal corner of the fields
+	Vector3d cmin, cmax, tmp;
+	objects_.at(CHESSBOARD_W).getBounds(cmin, cmax);
+	objects_.at(CHESSBOARD_B).getBounds(tmp, cmax);
+	Point corner(min(cmin.x_, tmp.x_), min(cmin.y_, tmp.y_), 0.0);
+	grid_.init(corner, fieldWidth);
+}
+
+inline void ModelChess::addToGrid(ModelChess::chessModelObjects piece)
+{
+	Vector3d cmin, cmax;
+	objects_.at(piece).getBounds(cmin, cmax);
+	grid_.insert(piece, cmin, cmax);
 }
 
 inline void ModelChess::load(string fileName)
@@ -143,6 +178,9 @@ inline void ModelChess::load(string fileName)
 	//debug
 	cout << "Loading model " << fileName << "..." << endl;
 
+	// reloading reuses the memory of the previous geometry
+	clear();
+
 	vector<Vector3d> vertices;
 	vector<Vector3d> normals;		
 
@@ -192,7 +230,7 @@ inline void ModelChess::load(string fileName)
 			unsigned in1, in2, in3;
 
 			sscanf(line.c_str(), "%*s %u//%u %u//%u %u//%u", &iv1, &in1, &iv2, &in2, &iv3, &in3);
-			objects_.at(modelObject).shapes.push_back(new Triangle(vertices.at(iv1 - 1), vertices.at(iv2 - 1), vertices.at(iv3 - 1),
+			objects_.at(modelObject).shapes.push_back(new (arena_) Triangle(vertices.at(iv1 - 1), vertices.at(iv2 - 1), vertices.at(iv3 - 1),
 										  normals.at(in1 - 1),  normals.at(in2 - 1),  normals.at(in3 - 1), m));
 		}
 	}	
@@ -206,6 +244,11 @@ inline void ModelChess::load(string fileName)
 
 	// estimate chessboard field width
 	fieldWidth = calculateFieldWidth();		
+
+	// create bounding box for each object
+	for(int i = 0; i < (int)objects_.size(); i++) {
+		objects_.at(i).createBoundingBox(arena_);
+	}
 }
 
 double ModelChess::calculateFieldWidth()
@@ -242,11 +285,19 @@ public:
 	
 	Chess(string modelFile, string configChessboardFile, string configRTFile) { 
 		chessModel = new ModelChess(modelFile);	
+		initChessboard();
 		configureChessboard(configChessboardFile);				
 	}
 
+	//! Loads the model with the pieces in the starting position
+	Chess(string modelFile) {
+		chessModel = new ModelChess(modelFile);
+		initPieces();
+		syncGrid();
+	}
+
 	~Chess() { 
-		//delete chessModel;  // SEGFAULT!!!
+		delete chessModel;
 	}	
 
 	ModelChess* getModel() { return chessModel; }
@@ -278,11 +329,42 @@ public:
 		chessModel->setObjectMaterial((ModelChess::chessModelObjects)33, m);
 	}
 
+	//! Piece standing on a field of the chessboard
+	struct Placement {
+		Placement(chessPieces piece, ModelChess::chessBoardCoords field) : piece(piece), field(field) { }
+		chessPieces piece;
+		ModelChess::chessBoardCoords field;	// [<0;7>, <0;7>]
+	};
+
+	//! Reads the positions of the pieces (format of the configuration file)
+	/*! The names of the pieces must match exactly, each piece and each field is used at most once.
+		@return false and the error (with the line) if the configuration is not valid
+	*/
+	static bool readPlacements(istream& config, vector<Placement>& placements, string& error);
+
+	//! Adds the placement to the list, false and the error if the piece or the field is not valid or already used
+	static bool addPlacement(vector<Placement>& placements, Placement placement, string& error);
+
+	//! Sets the positions of all pieces
+	/*! Pieces not listed are removed from the chessboard. The placements must be valid (see addPlacement).
+	*/
+	void place(const vector<Placement>& placements);
+
+	//! Sets the positions of all pieces from the configuration (format of the configuration file)
+	/*! Pieces not listed in the configuration are removed from the chessboard.
+		@return false and the error (see readPlacements) if the configuration is not valid, the chessboard is not changed then
+	*/
+	bool configure(istream& config, string& error);
+
 private:
 	//vector<ModelChess::chessBoardCoords> pieces;	// pieces' chessboard coordinates [<0;7>, <0;7>]
 	chessPieces chessBoard[HORIZONTAL_FIELDS][HORIZONTAL_FIELDS]; // 8x8 chessboard
 	ModelChess* chessModel;
 
+	// owns the model - not copyable
+	Chess(const Chess&);
+	Chess& operator=(const Chess&);
+
 	//! Sets all fields of the chessboard to NO_PIECE
 	void initChessboard();
 
@@ -297,6 +379,12 @@ private:
 	//! Loads the configuration file and sets the pieces' positions accordingly
 	void configureChessboard(string fileName);
 
+	//! Moves all pieces placed on the chessboard back to their default positions
+	void resetPieces();
+
+	//! Puts the pieces placed on the chessboard into the board grid of the model
+	void syncGrid();
+
 	/*! Converts standard chess coordinates (e.g. F3) to C [y][x] field coords.
 		example:
 			A1 == [0][0]
@@ -326,9 +414,11 @@ void Chess::move(chessPieces piece, ModelChess::chessBoardCoords to)
 		chessBoard[from.y][from.x] = chessPieces::NO_PIECE;
 		chessBoard[to.y][to.x] = piece;
 
-		// move the actual model
+		// move the actual model (the model updates the board grid)
 		if(from.x != -1 && from.y != -1)
 			chessModel->move(piece, from, to);
+		else
+			chessModel->addToGrid(piece);
 	}
 }
 
@@ -400,10 +490,22 @@ ModelChess::chessBoardCoords Chess::coordsChess2Carray(char letter, char number)
 	return ModelChess::chessBoardCoords((int)(letter - 'A'), (int)(number - '1'));
 }
 
-void Chess::configureChessboard(string fileName)
+void Chess::resetPieces()
 {
+	for(int i = 0; i < (int)ModelChess::CHESS_PIECES_COUNT; i++) {
+		chessPieces piece = (chessPieces)i;
+		ModelChess::chessBoardCoords from = pieceCoords(piece);
+		ModelChess::chessBoardCoords to = pieceDefaultCoords(piece);
+		if(from.x != -1 && (from.x != to.x || from.y != to.y))
+			chessModel->move(piece, from, to);
+		chessModel->setVisibility(piece, true);
+	}
+
 	initChessboard();
-	
+}
+
+void Chess::configureChessboard(string fileName)
+{
 	//debug
 	cout << "Loading configuration file " << fileName << "..." << endl;		
 
@@ -412,38 +514,103 @@ void Chess::configureChessboard(string fileName)
 		cerr << "ERROR: The file " << fileName << " cannot be opened." << endl;
 		exit(1);
 	}	
-			
+
+	string error;
+	if(!configure(file, error)) {
+		cerr << "ERROR: " << fileName << ", " << error << endl;
+		exit(1);
+	}
+}
+
+bool Chess::configure(istream& file, string& error)
+{
+	vector<Placement> placements;
+	if(!readPlacements(file, placements, error))
+		return false;
+
+	place(placements);
+	return true;
+}
+
+bool Chess::readPlacements(istream& config, vector<Placement>& placements, string& error)
+{
+	placements.clear();
+
 	string line;
-	char pieceBuf[20];
-	char positionBuf[5];	
 	int lineNum = 0;
-	while(getline(file, line)) {
-		//cout << "line: " << line << endl;
+	while(getline(config, line)) {
 		lineNum++;
-		if(line[0] == '#') continue;	// commentary
-		else {
-			sscanf(line.c_str(), "%s %s", pieceBuf, positionBuf);
-			string piece(pieceBuf);
-			string position(positionBuf);
+		istringstream is(line);
+		string piece, position;
+		is >> piece;
+		if(piece.empty() || piece[0] == '#') continue;	// commentary
+		is >> position;
+
+		ostringstream where;
+		where << "line " << lineNum << ": ";
+
+		// find which object we are reading
+		int i = 0;
+		while(i < (int)ModelChess::CHESS_PIECES_COUNT && piece != ModelChess::modelObjectNames[i])
+			i++;
+		if(i == (int)ModelChess::CHESS_PIECES_COUNT) {
+			error = where.str() + "unknown piece " + piece;
+			return false;
+		}
 
-			// find which object we are reading
-			for(int i = 0; i < (int)ModelChess::CHESS_PIECES_COUNT; i++) {
-				if(piece.find(ModelChess::modelObjectNames[i]) != string::npos) {				
-					//cout << "found at " << i << ", line " << lineNum << endl;
-					ModelChess::chessModelObjects modelObject = (ModelChess::chessModelObjects)i;
-					//cout << "object: " << (int)modelObject << endl;
-					ModelChess::chessBoardCoords to = coordsChess2Carray(position[0], position[1]);
-					//cout << "to: " << position[0] << position[1] << " = " << "[" << to.y << "][" << to.x << "]" << endl;
-					ModelChess::chessBoardCoords from = pieceDefaultCoords(modelObject);
-					//cout << "from: " << "[" << from.y << "][" << from.x << "]" << endl;
-					chessBoard[to.y][to.x] = modelObject;
-					chessModel->move(modelObject, from, to);
-				}
-			}
+		is >> ws;
+		if(position.size() != 2 || !is.eof()) {
+			error = where.str() + "wrong position of " + line;
+			return false;
 		}
-		
-		pieceBuf[0] = '\0';
-		positionBuf[0] = '\0';
+		ModelChess::chessBoardCoords field((int)(toupper(position[0]) - 'A'), (int)(position[1] - '1'));
+		if(!addPlacement(placements, Placement((chessPieces)i, field), error)) {
+			error = where.str() + error;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool Chess::addPlacement(vector<Placement>& placements, Placement placement, string& error)
+{
+	ModelChess::chessBoardCoords& to = placement.field;
+	if((int)placement.piece < 0 || (int)placement.piece >= (int)ModelChess::CHESS_PIECES_COUNT) {
+		error = "unknown piece";
+		return false;
+	}
+	string name = ModelChess::modelObjectNames[placement.piece];
+	if(to.x < 0 || to.x >= HORIZONTAL_FIELDS || to.y < 0 || to.y >= HORIZONTAL_FIELDS) {
+		error = "wrong position of " + name;
+		return false;
+	}
+
+	for(int i = 0; i < (int)placements.size(); i++) {
+		if(placements.at(i).piece == placement.piece) {
+			error = name + " placed twice";
+			return false;
+		}
+		if(placements.at(i).field.x == to.x && placements.at(i).field.y == to.y) {
+			error = name + " placed on the field of " + ModelChess::modelObjectNames[placements.at(i).piece];
+			return false;
+		}
+	}
+
+	placements.push_back(placement);
+	return true;
+}
+
+void Chess::place(const vector<Placement>& placements)
+{
+	resetPieces();
+
+	for(int i = 0; i < (int)placements.size(); i++) {
+		chessPieces piece = placements.at(i).piece;
+		ModelChess::chessBoardCoords to = placements.at(i).field;
+		ModelChess::chessBoardCoords from = pieceDefaultCoords(piece);
+		chessBoard[to.y][to.x] = piece;
+		chessModel->move(piece, from, to);
 	}
 
 	// check which pieces were not set at all and set their visibility to false
@@ -451,6 +618,17 @@ void Chess::configureChessboard(string fileName)
 		if(pieceCoords((Chess::chessPieces)i).x == -1)
 			chessModel->setVisibility((Chess::chessPieces)i, false);
 	}
+
+	syncGrid();
+}
+
+void Chess::syncGrid()
+{
+	chessModel->clearGrid();
+	for(int i = 0; i < HORIZONTAL_FIELDS; i++)
+		for(int j = 0; j < HORIZONTAL_FIELDS; j++)
+			if(chessBoard[i][j] != ModelChess::NO_PIECE)
+				chessModel->addToGrid(chessBoard[i][j]);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,376 @@
+#ifndef _DECIMATOR_H_
+#define _DECIMATOR_H_
+
+#include <vector>
+#include <map>
+#include <queue>
+#include <tuple>
+#include <algorithm>
+#include <Eigen\Dense>
+
+#include "Shape.h"
+#include "Vector3d.h"
+#include "common.h"
+#include "Arena.h"
+
+using namespace std;
+
+//! Simplification of triangle meshes by quadric edge collapse
+/*!
+	Implements the quadric error metric of Garland and Heckbert. Each vertex
+	accumulates the squared distances to the planes of its triangles (4x4
+	quadric), the edge whose collapse adds the least error is collapsed first.
+	The collapsed vertex is placed to the point minimizing the error, unless
+	the point leaves the bounding box of the input (the bounding boxes of the
+	objects stay valid for the simplified shapes).
+
+	Boundary edges of open meshes (fields of the chessboard) get the planes
+	perpendicular to their triangles, so the outline is preserved. Collapses
+	flipping a triangle are rejected. Vertices of the input triangles with
+	equal positions are merged first, the normals of the result are averaged
+	over the neighbouring triangles not turned by more than 60 degrees.
+*/
+class Decimator
+{
+public:
+	//! Builds the mesh of the triangles, other shapes are ignored
+	Decimator(vector<Shape *>& shapes);
+
+	//! Collapses edges until the mesh has at most the given number of triangles
+	/*! @return the number of triangles left (more than the target if no collapse is possible)
+	*/
+	unsigned decimate(unsigned targetTriangles);
+
+	//! Appends the remaining triangles (allocated from the arena) with the given material
+	void getTriangles(Material* material, vector<Shape *>& triangles, Arena& arena);
+
+	unsigned getTrianglesCount() { return faceCount_; }
+
+private:
+	// not aligned, the vertices are kept in std::vector
+	typedef Eigen::Matrix<double, 4, 4, Eigen::DontAlign> Quadric;
+
+	struct Vertex {
+		Vector3d position;
+		Quadric quadric;
+		vector<int> faces;		// incident triangles
+		unsigned version;		// incremented by each collapse into the vertex
+		bool removed;
+	};
+
+	struct Face {
+		int v[3];
+		Vector3d normal;		// orientation of the input triangle (sum of its vertex normals)
+		bool removed;
+	};
+
+	//! Candidate collapse of the edge (v0, v1) into v0 placed at the position
+	struct Collapse {
+		double cost;
+		int v0, v1;
+		unsigned version0, version1;	// collapses of other edges made the candidate stale
+		Vector3d position;
+		bool operator<(const Collapse& other) const { return cost > other.cost; }	// the cheapest on top
+	};
+
+	vector<Vertex> vertices_;
+	vector<Face> faces_;
+	priority_queue<Collapse> queue_;
+	unsigned faceCount_;
+	Vector3d min_;		// bounding box of the input
+	Vector3d max_;
+
+	static const double BOUNDARY_WEIGHT;
+
+	//! Adds the plane (weighted) to the quadric of the vertex
+	void addPlane(int v, Vector3d normal, Vector3d& point, double weight);
+
+	//! Error of the point measured by the quadric
+	static double error(const Eigen::Matrix4d& q, Vector3d& p);
+
+	//! Finds the best position of the collapsed edge and queues the collapse
+	void pushCollapse(int v0, int v1);
+
+	//! Returns true if moving the vertex to the position flips some of its triangles (not shared with other)
+	bool flips(int v, int other, Vector3d& position);
+
+	void collapse(Collapse& c);
+
+	Vector3d faceCross(Face& f) {
+		Vector3d e1 = vertices_.at(f.v[1]).position - vertices_.at(f.v[0]).position;
+		Vector3d e2 = vertices_.at(f.v[2]).position - vertices_.at(f.v[0]).position;
+		return e1.cross(e2);
+	}
+};
+
+const double Decimator::BOUNDARY_WEIGHT = 1000.0;
+
+inline Decimator::Decimator(vector<Shape *>& shapes) : faceCount_(0),
+	min_(INFINITY, INFINITY, INFINITY), max_(-INFINITY, -INFINITY, -INFINITY)
+{
+	map<tuple<double, double, double>, int> index;
+
+	for(int i = 0; i < (int)shapes.size(); i++) {
+		Triangle* tri = dynamic_cast<Triangle *>(shapes.at(i));
+		if(tri == NULL)
+			continue;
+
+		// merge the vertices with equal positions
+		Face f;
+		Vector3d* p[3] = { &tri->v0, &tri->v1, &tri->v2 };
+		for(int k = 0; k < 3; k++) {
+			tuple<double, double, double> key(p[k]->x_, p[k]->y_, p[k]->z_);
+			map<tuple<double, double, double>, int>::iterator it = index.find(key);
+			if(it == index.end()) {
+				Vertex v;
+				v.position = *p[k];
+				v.quadric.setZero();
+				v.version = 0;
+				v.removed = false;
+				it = index.insert(make_pair(key, (int)vertices_.size())).first;
+				vertices_.push_back(v);
+			}
+			f.v[k] = it->second;
+		}
+
+		// degenerated triangle
+		if(f.v[0] == f.v[1] || f.v[1] == f.v[2] || f.v[0] == f.v[2])
+			continue;
+
+		f.normal = tri->n0 + tri->n1 + tri->n2;
+		f.removed = false;
+		for(int k = 0; k < 3; k++)
+			vertices_.at(f.v[k]).faces.push_back((int)faces_.size());
+		faces_.push_back(f);
+		faceCount_++;
+
+		Vector3d minTmp = tri->minCoords();
+		Vector3d maxTmp = tri->maxCoords();
+		min_ = Vector3d(min(min_.x_, minTmp.x_), min(min_.y_, minTmp.y_), min(min_.z_, minTmp.z_));
+		max_ = Vector3d(max(max_.x_, maxTmp.x_), max(max_.y_, maxTmp.y_), max(max_.z_, maxTmp.z_));
+	}
+
+	// planes of the triangles weighted by the area, edges used by one triangle only are the boundary
+	map<pair<int, int>, int> edges;
+	for(int i = 0; i < (int)faces_.size(); i++) {
+		Face& f = faces_.at(i);
+		Vector3d n = faceCross(f);
+		double area = n.length() * 0.5;
+		if(area <= 0.0)
+			continue;
+		n.normalize();
+
+		for(int k = 0; k < 3; k++) {
+			addPlane(f.v[k], n, vertices_.at(f.v[0]).position, area);
+			int a = f.v[k], b = f.v[(k + 1) % 3];
+			edges[make_pair(min(a, b), max(a, b))]++;
+		}
+	}
+
+	for(int i = 0; i < (int)faces_.size(); i++) {
+		Face& f = faces_.at(i);
+		Vector3d n = faceCross(f).normalize();
+		for(int k = 0; k < 3; k++) {
+			int a = f.v[k], b = f.v[(k + 1) % 3];
+			if(edges[make_pair(min(a, b), max(a, b))] != 1)
+				continue;
+
+			// plane containing the edge perpendicular to the triangle
+			Vector3d edge = vertices_.at(b).position - vertices_.at(a).position;
+			Vector3d perpendicular = edge.cross(n);
+			double length = perpendicular.length();
+			if(length <= 0.0)
+				continue;
+			perpendicular = perpendicular * (1.0 / length);
+			double weight = BOUNDARY_WEIGHT * edge.dot(edge);
+			addPlane(a, perpendicular, vertices_.at(a).position, weight);
+			addPlane(b, perpendicular, vertices_.at(a).position, weight);
+		}
+	}
+
+	for(map<pair<int, int>, int>::iterator it = edges.begin(); it != edges.end(); it++)
+		pushCollapse(it->first.first, it->first.second);
+}
+
+inline void Decimator::addPlane(int v, Vector3d normal, Vector3d& point, double weight)
+{
+	Eigen::Vector4d p(normal.x_, normal.y_, normal.z_, -normal.dot(point));
+	vertices_.at(v).quadric += weight * (p * p.transpose());
+}
+
+inline double Decimator::error(const Eigen::Matrix4d& q, Vector3d& p)
+{
+	Eigen::Vector4d v(p.x_, p.y_, p.z_, 1.0);
+	return max(0.0, v.dot(q * v));
+}
+
+inline void Decimator::pushCollapse(int v0, int v1)
+{
+	Vertex& a = vertices_.at(v0);
+	Vertex& b = vertices_.at(v1);
+	Eigen::Matrix4d q = a.quadric + b.quadric;
+
+	// the end points and the middle of the edge
+	Vector3d middle = (a.position + b.position) * 0.5;
+	Vector3d candidates[4] = { a.position, b.position, middle, middle };
+	int count = 3;
+
+	// the optimal point, if the quadric is not singular and the point does not leave the bounding box
+	Eigen::FullPivLU<Eigen::Matrix3d> lu(q.topLeftCorner<3, 3>());
+	lu.setThreshold(1e-6);
+	if(lu.isInvertible()) {
+		Eigen::Vector3d x = lu.solve(Eigen::Vector3d(-q(0, 3), -q(1, 3), -q(2, 3)));
+		if(x(0) >= min_.x_ && x(1) >= min_.y_ && x(2) >= min_.z_ &&
+		   x(0) <= max_.x_ && x(1) <= max_.y_ && x(2) <= max_.z_)
+			candidates[count++] = Vector3d(x(0), x(1), x(2));
+	}
+
+	Collapse c;
+	c.cost = INFINITY;
+	for(int i = 0; i < count; i++) {
+		double e = error(q, candidates[i]);
+		if(e < c.cost) {
+			c.cost = e;
+			c.position = candidates[i];
+		}
+	}
+	c.v0 = v0;
+	c.v1 = v1;
+	c.version0 = a.version;
+	c.version1 = b.version;
+	queue_.push(c);
+}
+
+inline bool Decimator::flips(int v, int other, Vector3d& position)
+{
+	Vertex& vertex = vertices_.at(v);
+	for(int i = 0; i < (int)vertex.faces.size(); i++) {
+		Face& f = faces_.at(vertex.faces.at(i));
+		if(f.removed || f.v[0] == other || f.v[1] == other || f.v[2] == other)
+			continue;
+
+		Vector3d before = faceCross(f);
+		Vector3d saved = vertex.position;
+		vertex.position = position;
+		Vector3d after = faceCross(f);
+		vertex.position = saved;
+
+		if(before.dot(after) <= 0.0)
+			return true;
+	}
+	return false;
+}
+
+inline void Decimator::collapse(Collapse& c)
+{
+	Vertex& a = vertices_.at(c.v0);
+	Vertex& b = vertices_.at(c.v1);
+
+	a.position = c.position;
+	a.quadric += b.quadric;
+	a.version++;
+	b.removed = true;
+
+	// the triangles of the edge disappear, the others of v1 move to v0
+	for(int i = 0; i < (int)b.faces.size(); i++) {
+		Face& f = faces_.at(b.faces.at(i));
+		if(f.removed)
+			continue;
+		if(f.v[0] == c.v0 || f.v[1] == c.v0 || f.v[2] == c.v0) {
+			f.removed = true;
+			faceCount_--;
+			continue;
+		}
+		for(int k = 0; k < 3; k++)
+			if(f.v[k] == c.v1)
+				f.v[k] = c.v0;
+		a.faces.push_back(b.faces.at(i));
+	}
+	b.faces.clear();
+
+	vector<int> faces;
+	vector<int> neighbours;
+	for(int i = 0; i < (int)a.faces.size(); i++) {
+		Face& f = faces_.at(a.faces.at(i));
+		if(f.removed)
+			continue;
+		faces.push_back(a.faces.at(i));
+		for(int k = 0; k < 3; k++)
+			if(f.v[k] != c.v0)
+				neighbours.push_back(f.v[k]);
+	}
+	a.faces.swap(faces);
+
+	// new candidates of the edges around the vertex
+	sort(neighbours.begin(), neighbours.end());
+	neighbours.erase(unique(neighbours.begin(), neighbours.end()), neighbours.end());
+	for(int i = 0; i < (int)neighbours.size(); i++)
+		pushCollapse(c.v0, neighbours.at(i));
+}
+
+inline unsigned Decimator::decimate(unsigned targetTriangles)
+{
+	while(faceCount_ > targetTriangles && !queue_.empty()) {
+		Collapse c = queue_.top();
+		queue_.pop();
+
+		// stale candidate
+		Vertex& a = vertices_.at(c.v0);
+		Vertex& b = vertices_.at(c.v1);
+		if(a.removed || b.removed || a.version != c.version0 || b.version != c.version1)
+			continue;
+
+		if(flips(c.v0, c.v1, c.position) || flips(c.v1, c.v0, c.position))
+			continue;
+
+		collapse(c);
+	}
+
+	return faceCount_;
+}
+
+inline void Decimator::getTriangles(Material* material, vector<Shape *>& triangles, Arena& arena)
+{
+	const double CREASE_COS = 0.5;
+
+	// normals of the triangles oriented as the input ones
+	vector<Vector3d> normals(faces_.size(), Vector3d(0.0, 0.0, 0.0));
+	for(int i = 0; i < (int)faces_.size(); i++) {
+		Face& f = faces_.at(i);
+		if(f.removed)
+			continue;
+		normals.at(i) = faceCross(f);
+		if(normals.at(i).dot(f.normal) < 0.0)
+			normals.at(i) = -normals.at(i);
+	}
+
+	for(int i = 0; i < (int)faces_.size(); i++) {
+		Face& f = faces_.at(i);
+		if(f.removed)
+			continue;
+
+		Vector3d own = normals.at(i);
+		double ownLength = own.length();
+		if(ownLength <= 0.0)
+			continue;
+
+		// area weighted average of the neighbouring triangles except across the creases
+		Vector3d n[3];
+		for(int k = 0; k < 3; k++) {
+			Vertex& v = vertices_.at(f.v[k]);
+			n[k] = Vector3d(0.0, 0.0, 0.0);
+			for(int j = 0; j < (int)v.faces.size(); j++) {
+				Vector3d& other = normals.at(v.faces.at(j));
+				double otherLength = other.length();
+				if(otherLength > 0.0 && own.dot(other) >= CREASE_COS * ownLength * otherLength)
+					n[k] += other;
+			}
+			n[k].normalize();
+		}
+
+		triangles.push_back(new (arena) Triangle(vertices_.at(f.v[0]).position, vertices_.at(f.v[1]).position, vertices_.at(f.v[2]).position,
+										 n[0], n[1], n[2], material));
+	}
+}
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef _HEATMAP_H_
+#define _HEATMAP_H_
+
+#include <vector>
+#include <algorithm>
+#include "Vector3d.h"
+
+using namespace std;
+
+//! Conversion of the per-pixel render cost to a false color image
+/*!
+	The cost (time or the number of intersection tests) is scaled so that the
+	99th percentile maps to the hottest color, a few outliers (e.g. a thread
+	preempted in the middle of a pixel) do not darken the rest of the map.
+	In the tile mode each tile gets the average cost of its pixels, which
+	shows the balance of the work the scheduler hands out.
+*/
+class Heatmap
+{
+public:
+	//! Measured cost
+	enum Metric {
+		METRIC_NONE,
+		METRIC_TIME,	// nanoseconds per pixel
+		METRIC_TESTS	// bounding box and triangle tests per pixel
+	};
+
+	//! Converts the costs to colors, tileSize 1 colors each pixel
+	/*! @return the cost mapped to the hottest color
+	*/
+	static double toColors(const float* cost, int width, int height, int tileSize, vector<Vector3d>& colors);
+
+	//! Color ramp black - blue - red - yellow - white, value from <0.0, 1.0>
+	static Vector3d ramp(double value);
+};
+
+inline Vector3d Heatmap::ramp(double value)
+{
+	const Vector3d stops[5] = {
+		Vector3d(0.0, 0.0, 0.0), Vector3d(0.0, 0.0, 1.0), Vector3d(1.0, 0.0, 0.0),
+		Vector3d(1.0, 1.0, 0.0), Vector3d(1.0, 1.0, 1.0)
+	};
+
+	value = max(0.0, min(1.0, value)) * 4.0;
+	int i = min((int)value, 3);
+	double f = value - i;
+	return Vector3d(stops[i].x_ + (stops[i + 1].x_ - stops[i].x_) * f,
+					stops[i].y_ + (stops[i + 1].y_ - stops[i].y_) * f,
+					stops[i].z_ + (stops[i + 1].z_ - stops[i].z_) * f);
+}
+
+inline double Heatmap::toColors(const float* cost, int width, int height, int tileSize, vector<Vector3d>& colors)
+{
+	vector<float> values(cost, cost + width * height);
+	colors.resize(values.size());
+	if(values.empty())
+		return 0.0;
+
+	// average of the tiles
+	if(tileSize > 1) {
+		for(int ty = 0; ty < height; ty += tileSize) {
+			for(int tx = 0; tx < width; tx += tileSize) {
+				int h = min(tileSize, height - ty);
+				int w = min(tileSize, width - tx);
+				double sum = 0.0;
+				for(int i = ty; i < ty + h; i++)
+					for(int j = tx; j < tx + w; j++)
+						sum += cost[i * width + j];
+				for(int i = ty; i < ty + h; i++)
+					for(int j = tx; j < tx + w; j++)
+						values[i * width + j] = (float)(sum / (w * h));
+			}
+		}
+	}
+
+	// 99th percentile
+	vector<float> sorted(values);
+	size_t k = (size_t)(0.99 * (sorted.size() - 1));
+	nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+	double scale = (sorted[k] > 0.0) ? sorted[k] : 1.0;
+
+	for(int i = 0; i < (int)values.size(); i++)
+		colors[i] = ramp(values[i] / scale);
+
+	return scale;
+}
+
+#endif
@@ -0,0 +1,543 @@
+#ifndef _IMAGEWRITER_H_
+#define _IMAGEWRITER_H_
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <thread>
+#include <cctype>
+#include <cstring>
+#include <cmath>
+#include "Vector3d.h"
+
+// SSE2 quantization (always available on x64, /arch:SSE2 on x86)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RTCHESS_SSE2
+#include <emmintrin.h>
+#endif
+
+// compressed PNG output, define RTCHESS_ZLIB and link zlib to enable it
+#ifdef RTCHESS_ZLIB
+#include <zlib.h>
+#endif
+
+using namespace std;
+
+//! Format of the output image samples
+struct OutputFormat
+{
+	OutputFormat() : bits(8), gamma(1.0), compression(6), threads(0) { }
+	int bits;			// bits per channel, 8 or 16
+	double gamma;		// encoding gamma, 1.0 - linear (no correction), 2.2 - approx. sRGB
+	int compression;	// zlib level of PNG output <0, 9> (with RTCHESS_ZLIB only), 0 - uncompressed
+	unsigned threads;	// threads of the PNG encoder, 0 - all hardware threads
+};
+
+//! Class converting the floating point framebuffer to 8 or 16-bit samples
+/*!
+	Colors are clamped to <0.0, 1.0>, gamma corrected and rounded to the
+	nearest integer. 16-bit samples are stored big endian (as PNG and PPM
+	expect). The linear conversion only clamps, scales and rounds, which is
+	done by SSE2 if available. Gamma correction finds the clamped value in
+	the table of the linear values where the output codes start, beginning
+	with the first code of its bucket (65536 buckets of the square root of
+	the value, finer in the dark tones), so it gives the rounded pow()
+	exactly and the dark tones keep all the codes of the output depth.
+*/
+class Quantizer
+{
+public:
+	Quantizer(int bits = 8, double gamma = 1.0);
+	~Quantizer() { }
+
+	//! Converts n pixels to interleaved RGB samples (3 * n * bytesPerSample() bytes)
+	void quantize(const Vector3d* pixels, int n, unsigned char* out);
+
+	int bytesPerSample() { return bits_ / 8; }
+
+private:
+	int bits_;
+	double scale_;					// 1.0 maps to this value
+	vector<double> starts_;			// linear value where code i + 1 starts, empty for linear output
+	vector<unsigned short> first_;	// code of the linear value (i / 65535)^2
+
+	//! Clamps, scales and rounds the color of one pixel
+	void toInts(const Vector3d& px, unsigned* rgb);
+
+	//! Clamps and gamma corrects the color of one pixel
+	void toCodes(const Vector3d& px, unsigned* rgb);
+};
+
+inline Quantizer::Quantizer(int bits, double gamma) : bits_(bits == 16 ? 16 : 8)
+{
+	double maxValue = (bits_ == 16) ? 65535.0 : 255.0;
+	scale_ = maxValue;
+
+	// code c is the rounded pow(v, 1 / gamma) * maxValue, it starts where that reaches c - 0.5
+	if(gamma != 1.0 && gamma > 0.0) {
+		starts_.resize((int)maxValue);
+		for(int i = 0; i < (int)maxValue; i++)
+			starts_[i] = pow((i + 0.5) / maxValue, gamma);
+		first_.resize(65536);
+		for(int i = 0; i < 65536; i++)
+			first_[i] = (unsigned short)(upper_bound(starts_.begin(), starts_.end(), (i / 65535.0) * (i / 65535.0)) - starts_.begin());
+	}
+}
+
+inline void Quantizer::toInts(const Vector3d& px, unsigned* rgb)
+{
+#ifdef RTCHESS_SSE2
+	const __m128d zero = _mm_setzero_pd();
+	const __m128d one = _mm_set1_pd(1.0);
+	const __m128d scale = _mm_set1_pd(scale_);
+
+	// NaN is clamped to 0 (max returns the second operand)
+	__m128d xy = _mm_loadu_pd(&px.x_);
+	__m128d z = _mm_load_sd(&px.z_);
+	xy = _mm_mul_pd(_mm_min_pd(_mm_max_pd(xy, zero), one), scale);
+	z = _mm_mul_pd(_mm_min_pd(_mm_max_pd(z, zero), one), scale);
+
+	// rounds halves up like the scalar code (not to even as the rounding mode would)
+	const __m128d half = _mm_set1_pd(0.5);
+	xy = _mm_add_pd(xy, half);
+	z = _mm_add_pd(z, half);
+	__m128i v = _mm_unpacklo_epi64(_mm_cvttpd_epi32(xy), _mm_cvttpd_epi32(z));
+	_mm_storeu_si128((__m128i *)rgb, v);
+#else
+	const double* c = &px.x_;
+	for(int k = 0; k < 3; k++) {
+		double v = (c[k] > 0.0) ? ((c[k] < 1.0) ? c[k] : 1.0) : 0.0;
+		rgb[k] = (unsigned)(v * scale_ + 0.5);
+	}
+#endif
+}
+
+inline void Quantizer::toCodes(const Vector3d& px, unsigned* rgb)
+{
+	const double* c = &px.x_;
+	for(int k = 0; k < 3; k++) {
+		double v = (c[k] > 0.0) ? ((c[k] < 1.0) ? c[k] : 1.0) : 0.0;
+		unsigned code = first_[(int)(sqrt(v) * 65535.0)];
+		while(code > 0 && starts_[code - 1] > v)
+			code--;
+		while(code < starts_.size() && starts_[code] <= v)
+			code++;
+		rgb[k] = code;
+	}
+}
+
+inline void Quantizer::quantize(const Vector3d* pixels, int n, unsigned char* out)
+{
+	unsigned rgb[4];
+
+	if(bits_ == 8 && starts_.empty()) {
+		for(int i = 0; i < n; i++) {
+			toInts(pixels[i], rgb);
+			out[3 * i + 0] = (unsigned char)rgb[0];
+			out[3 * i + 1] = (unsigned char)rgb[1];
+			out[3 * i + 2] = (unsigned char)rgb[2];
+		}
+	} else if(bits_ == 8) {
+		for(int i = 0; i < n; i++) {
+			toCodes(pixels[i], rgb);
+			out[3 * i + 0] = (unsigned char)rgb[0];
+			out[3 * i + 1] = (unsigned char)rgb[1];
+			out[3 * i + 2] = (unsigned char)rgb[2];
+		}
+	} else {
+		for(int i = 0; i < n; i++) {
+			if(starts_.empty())
+				toInts(pixels[i], rgb);
+			else
+				toCodes(pixels[i], rgb);
+			for(int k = 0; k < 3; k++) {
+				out[6 * i + 2 * k + 0] = (unsigned char)(rgb[k] >> 8);
+				out[6 * i + 2 * k + 1] = (unsigned char)(rgb[k] & 0xff);
+			}
+		}
+	}
+}
+
+//! Class implementing row-sequential output of the rendered image
+/*!
+	The image is written from the top row to the bottom one, so rows can be
+	passed to the writer as soon as they are rendered and the whole image
+	never needs to be kept in memory. Rows passed in one call are quantized
+	at once and written by one I/O call.
+*/
+class ImageWriter
+{
+public:
+	ImageWriter(OutputFormat format) : format_(format), quantizer_(format.bits, format.gamma),
+		width_(0), height_(0), rowsWritten_(0) { }
+	virtual ~ImageWriter() { }
+
+	//! Creates the writer according to the file extension (.png, .raw, otherwise PPM)
+	static ImageWriter* create(string& fileName, OutputFormat format = OutputFormat());
+
+	//! Opens the file and writes the header.
+	/*! @return false if the file cannot be opened.
+	*/
+	virtual bool open(string& fileName, int width, int height) = 0;
+
+	//! Writes the next count rows of the image
+	virtual void writeRows(Vector3d* rows, int count) = 0;
+
+	//! Finishes the file
+	virtual void close() = 0;
+
+	int getRowsWritten() { return rowsWritten_; }
+
+protected:
+	OutputFormat format_;
+	Quantizer quantizer_;
+	int width_;
+	int height_;
+	int rowsWritten_;
+	ofstream ofs_;
+	vector<unsigned char> samples_;	// quantized rows
+
+	//! Opens the output file
+	bool openFile(string& fileName, int width, int height);
+
+	//! Quantizes the rows into samples_
+	void quantize(Vector3d* rows, int count);
+
+	int rowBytes() { return width_ * 3 * quantizer_.bytesPerSample(); }
+};
+
+inline bool ImageWriter::openFile(string& fileName, int width, int height)
+{
+	width_ = width;
+	height_ = height;
+	rowsWritten_ = 0;
+
+	ofs_.open(fileName, std::ios::out | std::ios::binary);
+	return !ofs_.fail();
+}
+
+inline void ImageWriter::quantize(Vector3d* rows, int count)
+{
+	samples_.resize(rowBytes() * count);
+	if(count > 0)
+		quantizer_.quantize(rows, width_ * count, &samples_[0]);
+}
+
+//! Binary PPM (P6) writer, 8 or 16-bit
+class PpmWriter: public ImageWriter
+{
+public:
+	PpmWriter(OutputFormat format = OutputFormat()) : ImageWriter(format) { }
+
+	virtual bool open(string& fileName, int width, int height);
+	virtual void writeRows(Vector3d* rows, int count);
+	virtual void close() { ofs_.close(); }
+};
+
+inline bool PpmWriter::open(string& fileName, int width, int height)
+{
+	if(!openFile(fileName, width, height))
+		return false;
+
+	ofs_ << "P6\n" << width_ << " " << height_ << "\n" << ((format_.bits == 16) ? 65535 : 255) << "\n";
+	return true;
+}
+
+inline void PpmWriter::writeRows(Vector3d* rows, int count)
+{
+	if(count <= 0)
+		return;
+
+	quantize(rows, count);
+	ofs_.write((const char *)&samples_[0], samples_.size());
+	rowsWritten_ += count;
+}
+
+//! Raw interleaved RGB samples without any header (16-bit big endian)
+class RawWriter: public PpmWriter
+{
+public:
+	RawWriter(OutputFormat format = OutputFormat()) : PpmWriter(format) { }
+
+	virtual bool open(string& fileName, int width, int height) { return openFile(fileName, width, height); }
+};
+
+//! PNG writer (RGB, 8 or 16-bit)
+/*!
+	Rows are written into IDAT chunks as soon as they come. Without zlib the
+	stream consists of uncompressed (stored) deflate blocks. With RTCHESS_ZLIB
+	the rows are "up" filtered and split to parts deflated in parallel, each
+	part is primed with the last 32K of the previous data and ends with a sync
+	flush, so the parts concatenate into a single deflate stream.
+*/
+class PngWriter: public ImageWriter
+{
+public:
+	PngWriter(OutputFormat format = OutputFormat()) : ImageWriter(format), adlerA_(1), adlerB_(0) { }
+
+	virtual bool open(string& fileName, int width, int height);
+	virtual void writeRows(Vector3d* rows, int count);
+	virtual void close();
+
+	static unsigned crc32(unsigned crc, const unsigned char* data, size_t length);
+
+private:
+	vector<unsigned char> raw_;			// filtered rows
+	vector<unsigned char> chunk_;		// deflate data of the rows
+	vector<unsigned char> prevRow_;		// last written row (up filter)
+	vector<unsigned char> window_;		// last 32K of the uncompressed stream
+	unsigned adlerA_;
+	unsigned adlerB_;
+
+	bool compressed() {
+#ifdef RTCHESS_ZLIB
+		return format_.compression > 0;
+#else
+		return false;
+#endif
+	}
+
+	//! Writes the PNG chunk of the given type
+	void writeChunk(const char* type, const unsigned char* data, size_t length);
+
+	//! Stores raw_ to chunk_ as uncompressed deflate blocks
+	void storeBlocks();
+
+	//! Compresses raw_ to chunk_ in parallel
+	void deflateBlocks();
+
+	//! Appends 32-bit big endian number
+	static void put32(vector<unsigned char>& buf, unsigned value);
+
+	static const unsigned MAX_STORED_BLOCK;
+	static const unsigned WINDOW_SIZE;
+	static const unsigned MIN_PART_SIZE;
+};
+
+const unsigned PngWriter::MAX_STORED_BLOCK = 65535;
+const unsigned PngWriter::WINDOW_SIZE = 32768;
+const unsigned PngWriter::MIN_PART_SIZE = 1 << 18;
+
+inline unsigned PngWriter::crc32(unsigned crc, const unsigned char* data, size_t length)
+{
+	static unsigned table[256];
+	static bool tableReady = false;
+
+	if(!tableReady) {
+		for(unsigned n = 0; n < 256; n++) {
+			unsigned c = n;
+			for(int k = 0; k < 8; k++)
+				c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			table[n] = c;
+		}
+		tableReady = true;
+	}
+
+	crc = ~crc;
+	for(size_t i = 0; i < length; i++)
+		crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+inline void PngWriter::put32(vector<unsigned char>& buf, unsigned value)
+{
+	buf.push_back((unsigned char)(value >> 24));
+	buf.push_back((unsigned char)(value >> 16));
+	buf.push_back((unsigned char)(value >> 8));
+	buf.push_back((unsigned char)value);
+}
+
+inline void PngWriter::writeChunk(const char* type, const unsigned char* data, size_t length)
+{
+	vector<unsigned char> header;
+	put32(header, (unsigned)length);
+	header.insert(header.end(), type, type + 4);
+
+	unsigned crc = crc32(0, &header[4], 4);
+	if(length > 0)
+		crc = crc32(crc, data, length);
+
+	vector<unsigned char> footer;
+	put32(footer, crc);
+
+	ofs_.write((const char *)&header[0], header.size());
+	if(length > 0)
+		ofs_.write((const char *)data, length);
+	ofs_.write((const char *)&footer[0], footer.size());
+}
+
+inline bool PngWriter::open(string& fileName, int width, int height)
+{
+	adlerA_ = 1;
+	adlerB_ = 0;
+	prevRow_.clear();
+	window_.clear();
+
+	if(!openFile(fileName, width, height))
+		return false;
+
+	const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	ofs_.write((const char *)signature, 8);
+
+	// width, height, bit depth, color type RGB, deflate, adaptive filtering, no interlace
+	vector<unsigned char> ihdr;
+	put32(ihdr, width_);
+	put32(ihdr, height_);
+	ihdr.push_back((unsigned char)(quantizer_.bytesPerSample() * 8));
+	ihdr.push_back(2);
+	ihdr.push_back(0);
+	ihdr.push_back(0);
+	ihdr.push_back(0);
+	writeChunk("IHDR", &ihdr[0], ihdr.size());
+
+	// zlib header - deflate, 32K window, compression level hint
+	const unsigned char zlibHeader[2] = { 0x78, (unsigned char)(compressed() ? 0x9c : 0x01) };
+	writeChunk("IDAT", zlibHeader, 2);
+
+	return true;
+}
+
+inline void PngWriter::writeRows(Vector3d* rows, int count)
+{
+	if(count <= 0)
+		return;
+
+	quantize(rows, count);
+
+	// each row starts with the filter type (0 - none, 2 - up)
+	int bytes = rowBytes();
+	raw_.resize(count * (bytes + 1));
+	for(int i = 0; i < count; i++) {
+		unsigned char* src = &samples_[i * bytes];
+		unsigned char* dst = &raw_[i * (bytes + 1)];
+		if(!compressed()) {
+			dst[0] = 0;
+			memcpy(dst + 1, src, bytes);
+		} else {
+			dst[0] = 2;
+			for(int j = 0; j < bytes; j++)
+				dst[j + 1] = (unsigned char)(src[j] - (prevRow_.empty() ? 0 : prevRow_[j]));
+			prevRow_.assign(src, src + bytes);
+		}
+	}
+
+	// Adler-32 of the uncompressed stream, sums are reduced every 5552 bytes (they cannot overflow)
+	for(size_t pos = 0; pos < raw_.size(); pos += 5552) {
+		size_t end = min(raw_.size(), pos + 5552);
+		for(size_t i = pos; i < end; i++) {
+			adlerA_ += raw_[i];
+			adlerB_ += adlerA_;
+		}
+		adlerA_ %= 65521;
+		adlerB_ %= 65521;
+	}
+
+	if(compressed())
+		deflateBlocks();
+	else
+		storeBlocks();
+	writeChunk("IDAT", &chunk_[0], chunk_.size());
+
+	rowsWritten_ += count;
+}
+
+inline void PngWriter::storeBlocks()
+{
+	// stored deflate blocks (not final)
+	chunk_.clear();
+	for(size_t pos = 0; pos < raw_.size(); pos += MAX_STORED_BLOCK) {
+		unsigned len = (unsigned)min((size_t)MAX_STORED_BLOCK, raw_.size() - pos);
+		chunk_.push_back(0);
+		chunk_.push_back((unsigned char)(len & 0xff));
+		chunk_.push_back((unsigned char)(len >> 8));
+		chunk_.push_back((unsigned char)(~len & 0xff));
+		chunk_.push_back((unsigned char)((~len >> 8) & 0xff));
+		chunk_.insert(chunk_.end(), raw_.begin() + pos, raw_.begin() + pos + len);
+	}
+}
+
+inline void PngWriter::deflateBlocks()
+{
+#ifdef RTCHESS_ZLIB
+	unsigned threads = (format_.threads > 0) ? format_.threads : thread::hardware_concurrency();
+	size_t parts = max((size_t)1, min((size_t)max(threads, 1u), raw_.size() / MIN_PART_SIZE));
+	size_t partSize = (raw_.size() + parts - 1) / parts;
+	vector<vector<unsigned char> > out(parts);
+
+	// the first part continues the data of the previous call
+	vector<unsigned char> firstDict(window_);
+
+	auto compressPart = [&](size_t p) {
+		size_t begin = p * partSize;
+		size_t end = min(raw_.size(), begin + partSize);
+
+		z_stream zs;
+		memset(&zs, 0, sizeof(zs));
+		deflateInit2(&zs, format_.compression, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+		if(p == 0 && !firstDict.empty())
+			deflateSetDictionary(&zs, &firstDict[0], (uInt)firstDict.size());
+		else if(p > 0) {
+			size_t dict = min((size_t)WINDOW_SIZE, begin);
+			deflateSetDictionary(&zs, &raw_[begin - dict], (uInt)dict);
+		}
+
+		out[p].resize(deflateBound(&zs, (uLong)(end - begin)) + 16);
+		zs.next_in = &raw_[begin];
+		zs.avail_in = (uInt)(end - begin);
+		zs.next_out = &out[p][0];
+		zs.avail_out = (uInt)out[p].size();
+		deflate(&zs, Z_SYNC_FLUSH);
+		out[p].resize(out[p].size() - zs.avail_out);
+		deflateEnd(&zs);
+	};
+
+	vector<thread> pool;
+	for(size_t p = 1; p < parts; p++)
+		pool.push_back(thread(compressPart, p));
+	compressPart(0);
+	for(size_t p = 0; p < pool.size(); p++)
+		pool.at(p).join();
+
+	chunk_.clear();
+	for(size_t p = 0; p < parts; p++)
+		chunk_.insert(chunk_.end(), out[p].begin(), out[p].end());
+
+	// dictionary of the next call
+	window_.insert(window_.end(), raw_.end() - min((size_t)WINDOW_SIZE, raw_.size()), raw_.end());
+	if(window_.size() > WINDOW_SIZE)
+		window_.erase(window_.begin(), window_.end() - WINDOW_SIZE);
+#else
+	storeBlocks();
+#endif
+}
+
+inline void PngWriter::close()
+{
+	// empty final stored block (the stream is byte aligned) and the Adler-32 checksum
+	vector<unsigned char> tail;
+	tail.push_back(1);
+	tail.push_back(0);
+	tail.push_back(0);
+	tail.push_back(0xff);
+	tail.push_back(0xff);
+	put32(tail, (adlerB_ << 16) | adlerA_);
+	writeChunk("IDAT", &tail[0], tail.size());
+	writeChunk("IEND", NULL, 0);
+
+	ofs_.close();
+}
+
+inline ImageWriter* ImageWriter::create(string& fileName, OutputFormat format)
+{
+	string ext = fileName.substr(fileName.find_last_of('.') + 1);
+	transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+	if(ext == "png")
+		return new PngWriter(format);
+	if(ext == "raw")
+		return new RawWriter(format);
+	return new PpmWriter(format);
+}
+
+#endif
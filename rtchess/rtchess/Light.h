@@ -1,6 +1,7 @@
 #ifndef _LIGHT_H_
 #define _LIGHT_H_
 
+#include <cmath>
 #include "Vector3d.h"
 #include "Shape.h"
 
@@ -10,11 +11,44 @@ Sphere DEFAULT_SPHERE(Vector3d(0.0, 0.0, 0.0), 1.0, &DEFAULT_MATERIAL);
 class Light: public Sphere
 {
 public:	
-	Light() : Sphere(DEFAULT_SPHERE) { }
+	Light() : Sphere(DEFAULT_SPHERE), intensity_(1.0), range_(0.0) { }
 	
-	Light(Vector3d& position, double radius, Material* material): 
-		Sphere(position, radius, material) { }
+	Light(Vector3d& position, double radius, Material* material, double intensity = 1.0, double range = 0.0): 
+		Sphere(position, radius, material), intensity_(intensity), range_(range) { }
 	~Light() {  }
+
+	//! Returns the point of the light seen from the given point
+	/*! The sphere is seen as a disk perpendicular to the direction towards
+		its center, (u, v) from <0, 1)^2 are mapped uniformly onto the disk.
+	*/
+	Point sample(Point& from, double u, double v);
+
+	//! Distance falloff 1 / (1 + (distance / range)^2), 1.0 for zero range
+	double attenuation(double distance);
+
+	double intensity_;	// multiplies the color of the light
+	double range_;		// distance at which the intensity falls to one half, 0 - no falloff
 };
 
+inline Point Light::sample(Point& from, double u, double v)
+{
+	Vector3d w = (center_ - from).normalize();
+
+	// any vector not parallel with w
+	Vector3d helper = (fabs(w.x_) < 0.9) ? Vector3d(1.0, 0.0, 0.0) : Vector3d(0.0, 1.0, 0.0);
+	Vector3d a = w.cross(helper).normalize();
+	Vector3d b = w.cross(a);
+
+	double r = radius_ * sqrt(u);
+	double phi = 2.0 * 3.14159265358979323846 * v;
+	return center_ + a * (r * cos(phi)) + b * (r * sin(phi));
+}
+
+inline double Light::attenuation(double distance)
+{
+	if(range_ <= 0.0)
+		return 1.0;
+	return 1.0 / (1.0 + (distance * distance) / (range_ * range_));
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,333 @@
+#ifndef _LOCALCHANNEL_H_
+#define _LOCALCHANNEL_H_
+
+#include <string>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#undef near		// obsolete pointer qualifiers, common names of variables
+#undef far
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+using namespace std;
+
+//! Connection of the local channel - text lines (and raw bytes) in both directions
+/*!
+	A Unix domain socket, on Windows a named pipe. The connection is a plain
+	handle, copies refer to the same connection and it must be closed once.
+*/
+class LocalConnection
+{
+public:
+#ifdef _WIN32
+	LocalConnection(HANDLE handle = INVALID_HANDLE_VALUE, bool accepted = false) : handle_(handle), accepted_(accepted), timeout_(0) { }
+	bool isOpen() const { return handle_ != INVALID_HANDLE_VALUE; }
+#else
+	LocalConnection(int handle = -1) : handle_(handle) { }
+	bool isOpen() const { return handle_ >= 0; }
+#endif
+
+	//! Connects to the channel of the given name
+	bool connect(const string& name);
+
+	//! Writes the whole text
+	bool write(const string& text);
+
+	//! Reads the next line (without the end of line), false at the end of the connection
+	bool readLine(string& line);
+
+	//! Reads exactly the given number of bytes
+	bool read(char* data, size_t size);
+
+	//! The reads fail if no data comes in the given time, 0 waits forever
+	void setTimeout(unsigned milliseconds);
+
+	void close();
+
+private:
+	//! Reads more data into the buffer, false at the end of the connection
+	bool fill();
+
+#ifdef _WIN32
+	HANDLE handle_;
+	bool accepted_;		// server end of the pipe
+	unsigned timeout_;	// milliseconds, 0 - none
+#else
+	int handle_;
+#endif
+	string buffer_;		// data read but not returned yet
+};
+
+//! Listening end of the local channel
+/*! The name is the path of the socket file (the file is replaced), on Windows
+	the name of the pipe (\\.\pipe\name).
+*/
+class LocalListener
+{
+public:
+#ifdef _WIN32
+	LocalListener() : handle_(INVALID_HANDLE_VALUE) { }
+#else
+	LocalListener() : handle_(-1) { }
+#endif
+	~LocalListener() { close(); }
+
+	bool open(const string& name);
+
+	//! Waits for the next client
+	bool accept(LocalConnection& connection);
+
+	void close();
+
+private:
+	// owns the handle - not copyable
+	LocalListener(const LocalListener&);
+	LocalListener& operator=(const LocalListener&);
+
+#ifdef _WIN32
+	//! Creates the instance of the pipe the next client connects to
+	bool createInstance();
+
+	HANDLE handle_;
+#else
+	int handle_;
+#endif
+	string name_;
+};
+
+#ifdef _WIN32
+
+inline bool LocalConnection::connect(const string& name)
+{
+	if(!WaitNamedPipeA(name.c_str(), NMPWAIT_WAIT_FOREVER))
+		return false;
+	handle_ = CreateFileA(name.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+	return isOpen();
+}
+
+inline bool LocalConnection::write(const string& text)
+{
+	DWORD written;
+	for(size_t done = 0; done < text.size(); done += written)
+		if(!WriteFile(handle_, text.data() + done, (DWORD)(text.size() - done), &written, NULL))
+			return false;
+	return true;
+}
+
+inline void LocalConnection::setTimeout(unsigned milliseconds)
+{
+	timeout_ = milliseconds;
+}
+
+inline bool LocalConnection::fill()
+{
+	char buf[4096];
+	DWORD n;
+
+	// the synchronous pipe has no timeout, the data is polled for (a broken pipe fails the read)
+	if(timeout_ > 0) {
+		DWORD start = GetTickCount();
+		DWORD available = 0;
+		while(PeekNamedPipe(handle_, NULL, 0, NULL, &available, NULL) && available == 0) {
+			if(GetTickCount() - start >= timeout_)
+				return false;
+			Sleep(10);
+		}
+	}
+	if(!ReadFile(handle_, buf, sizeof(buf), &n, NULL) || n == 0)
+		return false;
+	buffer_.append(buf, n);
+	return true;
+}
+
+inline void LocalConnection::close()
+{
+	// the server end waits until the client reads everything
+	if(isOpen()) {
+		if(accepted_) {
+			FlushFileBuffers(handle_);
+			DisconnectNamedPipe(handle_);
+		}
+		CloseHandle(handle_);
+	}
+	handle_ = INVALID_HANDLE_VALUE;
+}
+
+inline bool LocalListener::createInstance()
+{
+	handle_ = CreateNamedPipeA(name_.c_str(), PIPE_ACCESS_DUPLEX, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT,
+		PIPE_UNLIMITED_INSTANCES, 4096, 4096, 0, NULL);
+	return handle_ != INVALID_HANDLE_VALUE;
+}
+
+inline bool LocalListener::open(const string& name)
+{
+	name_ = name;
+	return createInstance();
+}
+
+inline bool LocalListener::accept(LocalConnection& connection)
+{
+	if(handle_ == INVALID_HANDLE_VALUE)
+		return false;
+
+	// a client might have connected already since the instance was created
+	if(!ConnectNamedPipe(handle_, NULL) && GetLastError() != ERROR_PIPE_CONNECTED)
+		return false;
+
+	connection = LocalConnection(handle_, true);
+	return createInstance();
+}
+
+inline void LocalListener::close()
+{
+	if(handle_ != INVALID_HANDLE_VALUE)
+		CloseHandle(handle_);
+	handle_ = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+inline bool LocalConnection::connect(const string& name)
+{
+	sockaddr_un address;
+	if(name.size() >= sizeof(address.sun_path))
+		return false;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, name.c_str());
+
+	handle_ = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(handle_ < 0)
+		return false;
+	if(::connect(handle_, (sockaddr *)&address, sizeof(address)) != 0) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+inline bool LocalConnection::write(const string& text)
+{
+	for(size_t done = 0; done < text.size(); ) {
+#ifdef MSG_NOSIGNAL
+		ssize_t n = send(handle_, text.data() + done, text.size() - done, MSG_NOSIGNAL);	// the client leaving must not kill the server
+#else
+		ssize_t n = send(handle_, text.data() + done, text.size() - done, 0);
+#endif
+		if(n <= 0)
+			return false;
+		done += n;
+	}
+	return true;
+}
+
+inline void LocalConnection::setTimeout(unsigned milliseconds)
+{
+	timeval tv;
+	tv.tv_sec = milliseconds / 1000;
+	tv.tv_usec = (milliseconds % 1000) * 1000;
+	setsockopt(handle_, SOL_SOCKET, SO_RCVTIMEO, (const char *)&tv, sizeof(tv));
+}
+
+inline bool LocalConnection::fill()
+{
+	char buf[4096];
+	ssize_t n = recv(handle_, buf, sizeof(buf), 0);
+	if(n <= 0)
+		return false;
+	buffer_.append(buf, n);
+	return true;
+}
+
+inline void LocalConnection::close()
+{
+	if(isOpen())
+		::close(handle_);
+	handle_ = -1;
+}
+
+inline bool LocalListener::open(const string& name)
+{
+	sockaddr_un address;
+	if(name.size() >= sizeof(address.sun_path))
+		return false;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, name.c_str());
+
+	// the socket file of a previous server is replaced
+	unlink(name.c_str());
+	handle_ = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(handle_ < 0)
+		return false;
+	if(bind(handle_, (sockaddr *)&address, sizeof(address)) != 0 || listen(handle_, 16) != 0) {
+		close();
+		return false;
+	}
+	name_ = name;
+	return true;
+}
+
+inline bool LocalListener::accept(LocalConnection& connection)
+{
+	int client = ::accept(handle_, NULL, NULL);
+	if(client < 0)
+		return false;
+	connection = LocalConnection(client);
+	return true;
+}
+
+inline void LocalListener::close()
+{
+	if(handle_ >= 0) {
+		::close(handle_);
+		unlink(name_.c_str());
+	}
+	handle_ = -1;
+}
+
+#endif
+
+inline bool LocalConnection::readLine(string& line)
+{
+	size_t end;
+	while((end = buffer_.find('\n')) == string::npos)
+		if(!fill()) {
+			// the last line without the end of line
+			if(buffer_.empty())
+				return false;
+			line = buffer_;
+			buffer_.clear();
+			return true;
+		}
+
+	line = buffer_.substr(0, (end > 0 && buffer_[end - 1] == '\r') ? end - 1 : end);
+	buffer_.erase(0, end + 1);
+	return true;
+}
+
+inline bool LocalConnection::read(char* data, size_t size)
+{
+	while(buffer_.size() < size)
+		if(!fill())
+			return false;
+
+	buffer_.copy(data, size);
+	buffer_.erase(0, size);
+	return true;
+}
+
+#endif
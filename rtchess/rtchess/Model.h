@@ -2,42 +2,190 @@
 #define _MODEL_H_
 
 #include <vector>
+#include <fstream>
 #include <cctype>
 #include "Shape.h"
 #include "Vector3d.h"
+#include "Decimator.h"
+#include "Arena.h"
+#include "BoardGrid.h"
+#include "Bvh.h"
 #include "common.h"
 
 using namespace std;
 
+//! Object of the model
+/*! The shapes, the bounding box, the proxy and the levels of detail are
+	allocated from the arena of the model and freed with it in one step.
+*/
 class Object
 {	
 public:
 	Object() : visible(true) { }
 	vector<Shape *> shapes;			
 	vector<Shape *> boundingBox;	
+	vector<Shape *> proxy;			// simplified shapes (shadow rays), empty if not created
+	vector<vector<Shape *> > lods;	// levels of detail, each level has half the triangles of the previous one
 	bool visible;
 
 	//! Creates a bounding box for the given obeject - cuboid (12 triangles)
-	void createBoundingBox();
+	void createBoundingBox(Arena& arena);
+
+	//! Returns true if the ray hits the bounding box (or the object has none)
+	bool intersectsBoundingBox(const Ray& ray);
 
 	//! translates the object
 	void translate(Vector3d& t);
+
+	//! Creates the proxy - the shapes decimated to at most the given number of triangles
+	/*! Objects with fewer shapes or with other shapes than triangles get no proxy.
+	*/
+	void createProxy(unsigned targetTriangles, Arena& arena);
+
+	//! Creates the chain of at most the given number of levels of detail (decimated shapes)
+	/*! The chain ends when the level would have less than MIN_LOD_TRIANGLES triangles.
+	*/
+	void createLods(unsigned levels, Arena& arena);
+
+	//! Takes over the levels of detail of the object with the same mesh moved by the offset
+	void copyLods(Object& other, Vector3d& offset, Arena& arena);
+
+	//! Returns true if the shapes are the triangles of the other object moved by the offset
+	bool isMovedCopy(Object& other, Vector3d& offset);
+
+	//! Shapes of the level of detail, level 0 (or a level not created) are the full shapes
+	vector<Shape *>& getShapes(unsigned level) { 
+		return (level == 0 || lods.empty()) ? shapes : lods.at(min((size_t)level, lods.size()) - 1); 
+	}
+
+	//! Corners of the bounding box
+	void getBounds(Vector3d& cmin, Vector3d& cmax);
+
+	static const unsigned MIN_LOD_TRIANGLES;
 };
 
+const unsigned Object::MIN_LOD_TRIANGLES = 8;
+
 void Object::translate(Vector3d& t)
 {
 	// move object
 	for(int i = 0; i < (int)shapes.size(); i++)
 		shapes.at(i)->translate(t);	
+	for(int i = 0; i < (int)proxy.size(); i++)
+		proxy.at(i)->translate(t);
+	for(int i = 0; i < (int)lods.size(); i++)
+		for(int j = 0; j < (int)lods.at(i).size(); j++)
+			lods.at(i).at(j)->translate(t);
 
-	// recompute bounding box
+	// move bounding box (axis aligned, stays the same)
 	for(int i = 0; i < (int)boundingBox.size(); i++)
-		delete boundingBox.at(i);
-	boundingBox.clear();
-	createBoundingBox();
+		boundingBox.at(i)->translate(t);
+}
+
+inline bool Object::intersectsBoundingBox(const Ray& ray)
+{
+	Shape::Intersection is;
+
+	if(boundingBox.empty())
+		return true;
+
+	// the box is made of triangles only, no virtual call needed
+	for(int i = 0; i < (int)boundingBox.size(); i++)
+		if(static_cast<Triangle *>(boundingBox.at(i))->Triangle::intersects(ray, is))
+			return true;
+
+	return false;
 }
 
-void Object::createBoundingBox()
+inline void Object::createProxy(unsigned targetTriangles, Arena& arena)
+{
+	// the old proxy stays in the arena until it is reset
+	proxy.clear();
+
+	if(shapes.size() <= targetTriangles)
+		return;
+	for(int i = 0; i < (int)shapes.size(); i++)
+		if(dynamic_cast<Triangle *>(shapes.at(i)) == NULL)
+			return;
+
+	Decimator decimator(shapes);
+	decimator.decimate(targetTriangles);
+	decimator.getTriangles(shapes.at(0)->mat_, proxy, arena);
+}
+
+inline void Object::createLods(unsigned levels, Arena& arena)
+{
+	lods.clear();
+
+	for(int i = 0; i < (int)shapes.size(); i++)
+		if(dynamic_cast<Triangle *>(shapes.at(i)) == NULL)
+			return;
+
+	// each level continues the decimation of the previous one
+	Decimator decimator(shapes);
+	unsigned target = (unsigned)shapes.size();
+	for(unsigned level = 0; level < levels; level++) {
+		target /= 2;
+		if(target < MIN_LOD_TRIANGLES)
+			break;
+		decimator.decimate(target);
+		lods.push_back(vector<Shape *>());
+		decimator.getTriangles(shapes.at(0)->mat_, lods.back(), arena);
+	}
+}
+
+inline bool Object::isMovedCopy(Object& other, Vector3d& offset)
+{
+	const double EPSILON = 1e-9;
+
+	if(shapes.empty() || shapes.size() != other.shapes.size())
+		return false;
+
+	for(int i = 0; i < (int)shapes.size(); i++) {
+		Triangle* a = dynamic_cast<Triangle *>(shapes.at(i));
+		Triangle* b = dynamic_cast<Triangle *>(other.shapes.at(i));
+		if(a == NULL || b == NULL)
+			return false;
+		if(i == 0)
+			offset = a->v0 - b->v0;
+
+		Vector3d d[3] = { a->v0 - b->v0, a->v1 - b->v1, a->v2 - b->v2 };
+		for(int k = 0; k < 3; k++)
+			if(fabs(d[k].x_ - offset.x_) > EPSILON || fabs(d[k].y_ - offset.y_) > EPSILON || fabs(d[k].z_ - offset.z_) > EPSILON)
+				return false;
+	}
+	return true;
+}
+
+inline void Object::copyLods(Object& other, Vector3d& offset, Arena& arena)
+{
+	lods.assign(other.lods.size(), vector<Shape *>());
+
+	for(int i = 0; i < (int)other.lods.size(); i++) {
+		for(int j = 0; j < (int)other.lods.at(i).size(); j++) {
+			Triangle* tri = new (arena) Triangle(*static_cast<Triangle *>(other.lods.at(i).at(j)));
+			tri->translate(offset);
+			tri->mat_ = shapes.at(0)->mat_;
+			lods.at(i).push_back(tri);
+		}
+	}
+}
+
+inline void Object::getBounds(Vector3d& cmin, Vector3d& cmax)
+{
+	vector<Shape *>& box = boundingBox.empty() ? shapes : boundingBox;
+
+	cmin = Vector3d(INFINITY, INFINITY, INFINITY);
+	cmax = Vector3d(-INFINITY, -INFINITY, -INFINITY);
+	for(int i = 0; i < (int)box.size(); i++) {
+		Vector3d minTmp = box.at(i)->minCoords();
+		Vector3d maxTmp = box.at(i)->maxCoords();
+		cmin = Vector3d(min(cmin.x_, minTmp.x_), min(cmin.y_, minTmp.y_), min(cmin.z_, minTmp.z_));
+		cmax = Vector3d(max(cmax.x_, maxTmp.x_), max(cmax.y_, maxTmp.y_), max(cmax.z_, maxTmp.z_));
+	}
+}
+
+void Object::createBoundingBox(Arena& arena)
 {
 	Vector3d cmin(INFINITY, INFINITY, INFINITY);
 	Vector3d cmax(-INFINITY, -INFINITY, -INFINITY);
@@ -79,18 +227,19 @@ void Object::createBoundingBox()
 	// sample normal - not used in bounding box's triangles
 	Vector3d n(1.0, 0.0, 0.0);
 
-	boundingBox.push_back(new Triangle(v[0], v[1], v[3], n, n, n, NULL));
-	boundingBox.push_back(new Triangle(v[0], v[3], v[2], n, n, n, NULL));
-	boundingBox.push_back(new Triangle(v[0], v[1], v[5], n, n, n, NULL));
-	boundingBox.push_back(new Triangle(v[0], v[5], v[4], n, n, n, NULL));
-	boundingBox.push_back(new Triangle(v[1], v[3], v[7], n, n, n, NULL));
-	boundingBox.push_back(new Triangle(v[1], v[7], v[5], n, n, n, NULL));
-	boundingBox.push_back(new Triangle(v[3], v[2], v[7], n, n, n, NULL));
-	boundingBox.push_back(new Triangle(v[2], v[6], v[7], n, n, n, NULL));
-	boundingBox.push_back(new Triangle(v[2], v[0], v[6], n, n, n, NULL));
-	boundingBox.push_back(new Triangle(v[0], v[4], v[6], n, n, n, NULL));
-	boundingBox.push_back(new Triangle(v[4], v[5], v[7], n, n, n, NULL));
-	boundingBox.push_back(new Triangle(v[4], v[7], v[6], n, n, n, NULL));
+	boundingBox.clear();
+	boundingBox.push_back(new (arena) Triangle(v[0], v[1], v[3], n, n, n, NULL));
+	boundingBox.push_back(new (arena) Triangle(v[0], v[3], v[2], n, n, n, NULL));
+	boundingBox.push_back(new (arena) Triangle(v[0], v[1], v[5], n, n, n, NULL));
+	boundingBox.push_back(new (arena) Triangle(v[0], v[5], v[4], n, n, n, NULL));
+	boundingBox.push_back(new (arena) Triangle(v[1], v[3], v[7], n, n, n, NULL));
+	boundingBox.push_back(new (arena) Triangle(v[1], v[7], v[5], n, n, n, NULL));
+	boundingBox.push_back(new (arena) Triangle(v[3], v[2], v[7], n, n, n, NULL));
+	boundingBox.push_back(new (arena) Triangle(v[2], v[6], v[7], n, n, n, NULL));
+	boundingBox.push_back(new (arena) Triangle(v[2], v[0], v[6], n, n, n, NULL));
+	boundingBox.push_back(new (arena) Triangle(v[0], v[4], v[6], n, n, n, NULL));
+	boundingBox.push_back(new (arena) Triangle(v[4], v[5], v[7], n, n, n, NULL));
+	boundingBox.push_back(new (arena) Triangle(v[4], v[7], v[6], n, n, n, NULL));
 }
 
 class Model 
@@ -99,18 +248,103 @@ public:
 	//! Constructor
 	Model() : visible(true) { }	
 
-	//! Destructor
-	~Model() { }
+	//! Destructor - the geometry is freed with the arena
+	virtual ~Model() { }
 
 	/*!
 		Loads model from .OBJ file. Expects parameters v, vn, f.
 	*/
 	virtual void load(string fileName) = 0;		
 
+	//! Creates the proxies of all objects (see Object::createProxy)
+	void createProxies(unsigned targetTriangles) {
+		for(int i = 0; i < (int)objects_.size(); i++)
+			objects_.at(i).createProxy(targetTriangles, arena_);
+	}
+
+	//! Creates the levels of detail of all objects, objects with the same mesh (pieces of one type) share the decimation
+	void createLods(unsigned levels);
+
+	//! Removes all the geometry, the memory is kept by the arena for the next load
+	void clear() {
+		for(int i = 0; i < (int)objects_.size(); i++)
+			objects_.at(i) = Object();
+		arena_.reset();
+		bvh_.clear();
+	}
+
+	//! Arena all the geometry of the model is allocated from
+	Arena& getArena() { return arena_; }
+
+	//! Grid of the objects walked by the rays instead of testing each object, NULL if the model has none
+	virtual BoardGrid* getGrid() { return NULL; }
+
+	//! Bounding volume hierarchy of the objects (see updateBvh)
+	Bvh& getBvh() { return bvh_; }
+
+	//! Builds the bounding volume hierarchy if there is none or the objects were added
+	void updateBvh() {
+		if(!bvh_.built() || bvh_.size() != objects_.size())
+			buildBvh();
+	}
+
+	//! Refits the bounding volume hierarchy to the moved object, builds it again if the refitted one is too bad
+	/*! Every object moved by Object::translate has to be refitted before the next rendering.
+	*/
+	void refitBvh(int object);
+
 	vector<Object> objects_;	
 	bool visible;
+
+protected:
+	Arena arena_;
+	Bvh bvh_;
+
+private:
+	// the geometry lives in the arena - not copyable
+	Model(const Model&);
+	Model& operator=(const Model&);
+
+	void buildBvh();
 };
 
+inline void Model::buildBvh()
+{
+	vector<Vector3d> cmin(objects_.size()), cmax(objects_.size());
+	for(int i = 0; i < (int)objects_.size(); i++)
+		objects_.at(i).getBounds(cmin.at(i), cmax.at(i));
+	bvh_.build(cmin, cmax);
+}
+
+inline void Model::refitBvh(int object)
+{
+	if(!bvh_.built() || bvh_.size() != objects_.size())
+		return;
+
+	Vector3d cmin, cmax;
+	objects_.at(object).getBounds(cmin, cmax);
+	if(!bvh_.refit(object, cmin, cmax) || bvh_.degraded())
+		buildBvh();
+}
+
+inline void Model::createLods(unsigned levels)
+{
+	vector<int> decimated;		// objects whose levels were decimated (one per mesh)
+	for(int i = 0; i < (int)objects_.size(); i++) {
+		Vector3d offset;
+		int j = 0;
+		while(j < (int)decimated.size() && !objects_.at(i).isMovedCopy(objects_.at(decimated.at(j)), offset))
+			j++;
+
+		if(j < (int)decimated.size()) {
+			objects_.at(i).copyLods(objects_.at(decimated.at(j)), offset, arena_);
+		} else {
+			objects_.at(i).createLods(levels, arena_);
+			decimated.push_back(i);
+		}
+	}
+}
+
 class ModelGeneral : public Model
 {
 public:	
@@ -122,9 +356,9 @@ public:
 		// DEBUG - generate a few spheres
 		objects_.push_back(Object());
 
-		objects_.at(0).shapes.push_back(new Sphere(Vector3d(0.0, 0.0, -10003.0), 10000.0, new Material(Vector3d(0.2, 0.2, 0.2), 0.9, 0.0, 0.0, 0.0)));  // ground		
-		objects_.at(0).shapes.push_back(new Sphere(Vector3d(5.0, 50.0, 3.0), 5.0, new Material(Vector3d(0.8, 0.15, 0.15), 0.1, 0.0, 0.0, 10.0))); // red
-		objects_.at(0).shapes.push_back(new Sphere(Vector3d(1.0, 40.0, 5.0), 3.0, new Material(Vector3d(0.15, 0.8, 0.15), 0.8, 0.0, 1.5, 50.0))); // green		
+		objects_.at(0).shapes.push_back(new (arena_) Sphere(Vector3d(0.0, 0.0, -10003.0), 10000.0, new (arena_) Material(Vector3d(0.2, 0.2, 0.2), 0.9, 0.0, 0.0, 0.0)));  // ground		
+		objects_.at(0).shapes.push_back(new (arena_) Sphere(Vector3d(5.0, 50.0, 3.0), 5.0, new (arena_) Material(Vector3d(0.8, 0.15, 0.15), 0.1, 0.0, 0.0, 10.0))); // red
+		objects_.at(0).shapes.push_back(new (arena_) Sphere(Vector3d(1.0, 40.0, 5.0), 3.0, new (arena_) Material(Vector3d(0.15, 0.8, 0.15), 0.8, 0.0, 1.5, 50.0))); // green		
 	}
 
 	ModelGeneral(string& fileName)
@@ -132,17 +366,11 @@ public:
 		// debug
 		cout << "Loading model from " << fileName << "..." << endl;		
 
-		m = new Material(Vector3d(0.15, 0.15, 0.85), 0.3, 0.0, 0.0, 15.0);
+		m = new (arena_) Material(Vector3d(0.15, 0.15, 0.85), 0.3, 0.0, 0.0, 15.0);
 
 		load(fileName); 
 	}
 
-	~ModelGeneral() {
-		for(int i = 0; i < (int)objects_.at(0).shapes.size(); i++) {
-			delete objects_.at(0).shapes.at(i);
-		}
-	}
-
 	virtual void load(string fileName);		
 
 	// TODO -> move somwhere else
@@ -181,7 +409,7 @@ inline void ModelGeneral::load(string fileName) {
 			unsigned iv1, iv2, iv3;
 			unsigned in1, in2, in3;
 			sscanf(line.c_str(), "%*s %u//%u %u//%u %u//%u", &iv1, &in1, &iv2, &in2, &iv3, &in3);
-			objects_.at(0).shapes.push_back(new Triangle(vertices.at(iv1 - 1), vertices.at(iv2 - 1), vertices.at(iv3 - 1),
+			objects_.at(0).shapes.push_back(new (arena_) Triangle(vertices.at(iv1 - 1), vertices.at(iv2 - 1), vertices.at(iv3 - 1),
 										  normals.at(in1 - 1),  normals.at(in2 - 1),  normals.at(in3 - 1), m));
 		}
 	}	
@@ -0,0 +1,117 @@
+#ifndef _PRIMITIVES_H_
+#define _PRIMITIVES_H_
+
+#include <vector>
+#include <typeinfo>
+#include "Shape.h"
+#include "Ray.h"
+
+using namespace std;
+
+//! Shapes sorted by type into homogeneous arrays
+/*!
+	The intersection loops run over each array separately, so the type of the
+	primitive is known at compile time and Triangle::intersects or
+	Sphere::intersects is called directly (and inlined) instead of through the
+	virtual Shape::intersects. Only the shapes of exactly these types are
+	sorted, the others (e.g. derived shapes overriding intersects) keep the
+	virtual call.
+
+	The arrays hold the pointers of the original shapes, they must be built
+	again when the shapes change (moving the shapes is fine).
+*/
+class PrimitiveSet
+{
+public:
+	PrimitiveSet() { }
+
+	//! Sorts the shapes, the order within one type is kept
+	void build(vector<Shape *>& shapes);
+
+	//! Finds the intersection closer than isC.t
+	/*! @return true if such intersection was found (isC is updated)
+	*/
+	bool closest(const Ray& ray, Shape::Intersection& isC);
+
+	//! Returns true if the ray hits any shape closer than maxDist
+	/*! @param tests is increased by the number of intersection tests done
+	*/
+	bool any(const Ray& ray, double maxDist, long long& tests);
+
+	size_t size() const { return triangles.size() + spheres.size() + others.size(); }
+
+	vector<Triangle *> triangles;
+	vector<Sphere *> spheres;
+	vector<Shape *> others;
+
+private:
+	template<class T>
+	static bool closest(vector<T *>& shapes, const Ray& ray, Shape::Intersection& isC);
+
+	template<class T>
+	static bool any(vector<T *>& shapes, const Ray& ray, double maxDist, long long& tests);
+};
+
+//! Statically dispatched intersection of the known types, virtual call of the others
+inline bool intersectPrimitive(Triangle* shape, const Ray& ray, Shape::Intersection& is) { return shape->Triangle::intersects(ray, is); }
+inline bool intersectPrimitive(Sphere* shape, const Ray& ray, Shape::Intersection& is) { return shape->Sphere::intersects(ray, is); }
+inline bool intersectPrimitive(Shape* shape, const Ray& ray, Shape::Intersection& is) { return shape->intersects(ray, is); }
+
+inline void PrimitiveSet::build(vector<Shape *>& shapes)
+{
+	triangles.clear();
+	spheres.clear();
+	others.clear();
+
+	for(int i = 0; i < (int)shapes.size(); i++) {
+		Shape* shape = shapes.at(i);
+		if(typeid(*shape) == typeid(Triangle))
+			triangles.push_back(static_cast<Triangle *>(shape));
+		else if(typeid(*shape) == typeid(Sphere))
+			spheres.push_back(static_cast<Sphere *>(shape));
+		else
+			others.push_back(shape);
+	}
+}
+
+template<class T>
+inline bool PrimitiveSet::closest(vector<T *>& shapes, const Ray& ray, Shape::Intersection& isC)
+{
+	Shape::Intersection is;
+	bool found = false;
+
+	for(int i = 0; i < (int)shapes.size(); i++) {
+		if(intersectPrimitive(shapes[i], ray, is) && is.t < isC.t) {
+			isC = is;
+			found = true;
+		}
+	}
+	return found;
+}
+
+template<class T>
+inline bool PrimitiveSet::any(vector<T *>& shapes, const Ray& ray, double maxDist, long long& tests)
+{
+	Shape::Intersection is;
+
+	for(int i = 0; i < (int)shapes.size(); i++) {
+		tests++;
+		if(intersectPrimitive(shapes[i], ray, is) && is.t < maxDist)
+			return true;
+	}
+	return false;
+}
+
+inline bool PrimitiveSet::closest(const Ray& ray, Shape::Intersection& isC)
+{
+	bool found = closest(triangles, ray, isC);
+	found = closest(spheres, ray, isC) || found;
+	return closest(others, ray, isC) || found;
+}
+
+inline bool PrimitiveSet::any(const Ray& ray, double maxDist, long long& tests)
+{
+	return any(triangles, ray, maxDist, tests) || any(spheres, ray, maxDist, tests) || any(others, ray, maxDist, tests);
+}
+
+#endif
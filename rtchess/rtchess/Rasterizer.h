@@ -0,0 +1,194 @@
+#ifndef _RASTERIZER_H_
+#define _RASTERIZER_H_
+
+#include <vector>
+#include <cmath>
+#include "Camera.h"
+#include "Model.h"
+#include "Shape.h"
+#include "common.h"
+
+using namespace std;
+
+//! Class implementing the visibility buffer for primary rays
+/*!
+	All primary rays start at the camera position, so the closest triangle
+	seen through each pixel can be found by rasterizing the visible objects
+	onto the virtual projection screen, using the same TLPx/xStep/zStep
+	parametrization as the ray tracer. For each pixel the buffer keeps the
+	closest triangle, its object and its depth along the viewing direction.
+
+	Rasterization is sampled at the pixel centers, so the result differs from
+	ray casting only at the outlines of the objects. These pixels are reported
+	by needsTrace() and should be ray traced instead.
+
+	Only the crop window of the camera (and the pixels around it the outlines
+	are found by) is rasterized, the pixels are still addressed in the screen.
+
+	Only triangle models are supported, rasterize() fails for any other shape.
+*/
+class Rasterizer
+{
+public:
+	//! The objects are rasterized in the given levels of detail (NULL - full shapes)
+	Rasterizer(Camera& camera, Model* model, const unsigned char* lod = NULL);
+	~Rasterizer() { }
+
+	//! Rasterizes all visible objects of the model.
+	/*! @return false if the model contains other shapes than triangles.
+	*/
+	bool rasterize();
+
+	//! Returns the closest triangle seen through the pixel, NULL if there is none.
+	Triangle* at(int x, int y) { return tris_[(y - y0_) * width_ + x - x0_]; }
+
+	//! Returns the index of the object seen through the pixel, -1 if none
+	int objectAt(int x, int y) { return objs_[(y - y0_) * width_ + x - x0_]; }
+
+	//! Returns true if the pixel lies on the outline of some object.
+	bool needsTrace(int x, int y);
+
+	static const double NEAR_PLANE;
+
+private:
+	Camera& camera_;
+	Model* model_;
+	const unsigned char* lod_;	//!< level of detail of each object, NULL - full shapes
+	int x0_;					//!< rasterized rectangle of the screen
+	int y0_;
+	int width_;
+	int height_;
+
+	vector<Triangle *> tris_;	//!< closest triangle per pixel
+	vector<int> objs_;			//!< index of the object the triangle belongs to, -1 if none
+	vector<double> depth_;		//!< depth of the closest triangle
+
+	//! Clips the triangle by the near plane and rasterizes the rest.
+	void rasterizeTriangle(Triangle* tri, int obj);
+
+	//! Rasterizes the triangle given by its projected screen coordinates.
+	void rasterizeProjected(Triangle* tri, int obj, double* x, double* y, double* w);
+};
+
+const double Rasterizer::NEAR_PLANE = 1e-6;
+
+inline Rasterizer::Rasterizer(Camera& camera, Model* model, const unsigned char* lod) : camera_(camera), model_(model), lod_(lod)
+{
+	// the outlines at the border of the crop window depend on the pixels just outside
+	Tile crop = camera.getCrop();
+	x0_ = max(crop.x - 1, 0);
+	y0_ = max(crop.y - 1, 0);
+	width_ = min(crop.x + crop.width + 1, (int)camera.getScreenWidth()) - x0_;
+	height_ = min(crop.y + crop.height + 1, (int)camera.getScreenHeight()) - y0_;
+}
+
+inline bool Rasterizer::rasterize()
+{
+	tris_.assign(width_ * height_, (Triangle *)NULL);
+	objs_.assign(width_ * height_, -1);
+	depth_.assign(width_ * height_, INFINITY);
+
+	for(int i = 0; i < (int)model_->objects_.size(); i++) {
+		if(!model_->objects_.at(i).visible)
+			continue;
+
+		vector<Shape *>& shapes = model_->objects_.at(i).getShapes((lod_ != NULL) ? lod_[i] : 0);
+		for(int j = 0; j < (int)shapes.size(); j++) {
+			Triangle* tri = dynamic_cast<Triangle *>(shapes.at(j));
+			if(tri == NULL)
+				return false;
+			rasterizeTriangle(tri, i);
+		}
+	}
+
+	return true;
+}
+
+inline bool Rasterizer::needsTrace(int x, int y)
+{
+	int obj = objectAt(x, y);
+
+	for(int i = max(y - 1, y0_); i <= min(y + 1, y0_ + height_ - 1); i++)
+		for(int j = max(x - 1, x0_); j <= min(x + 1, x0_ + width_ - 1); j++)
+			if(objectAt(j, i) != obj)
+				return true;
+
+	return false;
+}
+
+inline void Rasterizer::rasterizeTriangle(Triangle* tri, int obj)
+{
+	Point v[3] = { tri->v0, tri->v1, tri->v2 };
+	double d[3];
+	int behind = 0;
+
+	for(int i = 0; i < 3; i++) {
+		d[i] = (v[i] - camera_.position()).dot(camera_.getForward()) - NEAR_PLANE;
+		if(d[i] < 0.0) behind++;
+	}
+
+	if(behind == 3)
+		return;
+
+	// clip by the near plane (Sutherland-Hodgman), result has at most 4 vertices
+	Point poly[4];
+	int n = 0;
+	for(int i = 0; i < 3; i++) {
+		int k = (i + 1) % 3;
+		if(d[i] >= 0.0)
+			poly[n++] = v[i];
+		if((d[i] >= 0.0) != (d[k] >= 0.0)) {
+			Vector3d edge = v[k] - v[i];
+			poly[n++] = v[i] + edge * (d[i] / (d[i] - d[k]));
+		}
+	}
+
+	double x[4], y[4], w[4];
+	for(int i = 0; i < n; i++)
+		camera_.project(poly[i], x[i], y[i], w[i]);
+
+	// triangle fan
+	for(int i = 1; i + 1 < n; i++) {
+		double fx[3] = { x[0], x[i], x[i + 1] };
+		double fy[3] = { y[0], y[i], y[i + 1] };
+		double fw[3] = { w[0], w[i], w[i + 1] };
+		rasterizeProjected(tri, obj, fx, fy, fw);
+	}
+}
+
+inline void Rasterizer::rasterizeProjected(Triangle* tri, int obj, double* x, double* y, double* w)
+{
+	double area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+
+	// triangle seen edge-on
+	if(fabs(area) < 1e-12)
+		return;
+
+	int xMin = max(x0_, (int)ceil(min(x[0], min(x[1], x[2]))));
+	int xMax = min(x0_ + width_ - 1, (int)floor(max(x[0], max(x[1], x[2]))));
+	int yMin = max(y0_, (int)ceil(min(y[0], min(y[1], y[2]))));
+	int yMax = min(y0_ + height_ - 1, (int)floor(max(y[0], max(y[1], y[2]))));
+
+	double invArea = 1.0 / area;
+	for(int i = yMin; i <= yMax; i++) {
+		for(int j = xMin; j <= xMax; j++) {
+			// barycentric coordinates of the pixel center
+			double l0 = ((x[2] - x[1]) * (i - y[1]) - (y[2] - y[1]) * (j - x[1])) * invArea;
+			double l1 = ((x[0] - x[2]) * (i - y[2]) - (y[0] - y[2]) * (j - x[2])) * invArea;
+			double l2 = 1.0 - l0 - l1;
+			if(l0 < 0.0 || l1 < 0.0 || l2 < 0.0)
+				continue;
+
+			// perspective correct depth
+			double depth = 1.0 / (l0 / w[0] + l1 / w[1] + l2 / w[2]);
+			int k = (i - y0_) * width_ + j - x0_;
+			if(depth < depth_[k]) {
+				depth_[k] = depth;
+				tris_[k] = tri;
+				objs_[k] = obj;
+			}
+		}
+	}
+}
+
+#endif
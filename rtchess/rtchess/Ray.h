@@ -5,11 +5,16 @@
 class Ray	
 {
 public:
-	Ray(Point& start, Vector3d& direction) : start_(start), direction_(direction.normalize()) { }
+	Ray(const Point& start, const Vector3d& direction) : start_(start), direction_(direction) { direction_.normalize(); }
+	//! Constructor for already normalized direction
+	Ray(const Point& start, const Vector3d& direction, bool normalized) : start_(start), direction_(direction) 
+	{ 
+		if(!normalized) direction_.normalize(); 
+	}
 	~Ray(void) { }
 	
-	Point getStart() const { return start_; } 
-	Vector3d getDir() const { return direction_; } 
+	const Point& getStart() const { return start_; } 
+	const Vector3d& getDir() const { return direction_; } 
 
 private:
 	Point start_;
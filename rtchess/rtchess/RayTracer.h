@@ -4,194 +4,1009 @@
 #include "Camera.h"
 #include "Light.h"
 #include "Model.h"
+#include "Primitives.h"
+#include "Rasterizer.h"
+#include "Scheduler.h"
+#include "Stats.h"
+#include "Heatmap.h"
+#include "ReflectionCache.h"
 #include "common.h"
 
 class RayTracer 
 {
 public:
-	RayTracer(Camera& camera, Light &light, Model* model, unsigned maxDepth = 0): model_(model), maxDepth_(maxDepth)
+	RayTracer(Camera& camera, Light &light, Model* model, unsigned maxDepth = 0): 
+		model_(model), maxDepth_(maxDepth), rasterizePrimary_(false), threads_(0), heatmap_(Heatmap::METRIC_NONE),
+		shadowSamples_(16), shadowProbes_(4), lightThreshold_(0.0), fresnelThreshold_(DEFAULT_FRESNEL_THRESHOLD), shadowProxies_(false), proxyBounce_(0), lodPixels_(0.0), boardGrid_(true),
+		reflections_(NULL), cacheReflections_(false)
 	{ 
 		camera_ = new Camera(camera);
 		light_ = new Light(light);
+		lights_.push_back(light_);
+		initPrimitives();
 	}
 
 	~RayTracer()
 	{
 		delete camera_;
-		delete light_;
+		for(int i = 0; i < (int)lights_.size(); i++)
+			delete lights_.at(i);
 	}
 
-	void setModel(Model *model) { model_ = model; }
+	void setModel(Model *model) { model_ = model; initPrimitives(); }
 	void render(Vector3d* image);	
+
+	//! Renders more views of the model at once.
+	/*! Tiles of all views are rendered by one pool of threads, images[i] 
+		must have the resolution of the crop window of cameras[i] (see Camera::setCrop).
+	*/
+	void render(vector<Camera *>& cameras, vector<Vector3d *>& images);
+
+	//! Renders only the given tiles of the views, the other pixels of the images are not touched
+	/*! If prepared is true, the setup of prepare() is not done again, so a caller
+		rendering the tiles in more parts prepares the views only once (the model
+		must not change in between).
+	*/
+	void render(vector<Camera *>& cameras, vector<Vector3d *>& images, vector<TileScheduler::Task>& tasks, bool prepared = false);
+
+	//! Sorts the primitives of the model, allocates the cost buffers and picks the levels of detail of the views and updates the reflection cache, done by each rendering unless told otherwise
+	void prepare(vector<Camera *>& cameras);
+
+	//! Renders more views, streaming finished bands of rows to the writers.
+	/*! Only a window of bands is kept in memory, so the memory does not grow 
+		with the resolution. The writers must be opened. The visibility buffer
+		covers the whole screen, so the rasterization is not used here.
+	*/
+	void render(vector<Camera *>& cameras, vector<ImageWriter *>& writers);
+
+	//! Estimates the counters of the rendering of the views without tracing any ray (dry run)
+	/*! The primary rays test all the triangles of the objects whose projected
+		bounding boxes they pass (one triangle with the rasterized primary
+		visibility) and hit the part of the box the object fills. The
+		secondary rays of an object hit the others in proportion to the solid
+		angles of their mean cross-sections. The hits cast the shadow rays of all the lights (the probes of an area light).
+		The secondary rays cost as much as the primary ones on average. The
+		rays stopped early by the board grid, the culled lights and the faces
+		turned away from the lights are not considered, the counters of the
+		default scene are within a factor of two - it is meant to compare the
+		scenes and the settings, not to predict the time.
+	*/
+	RenderStats estimate(vector<Camera *>& cameras);
+
+	//! Per-thread state of the rendering
+	struct Context {
+		Context() : camera(NULL), view(0), cost(NULL), lod(NULL), reflection(NULL), cells(0), weight(1.0) { }
+		Camera* camera;		// camera of the view being rendered
+		int view;			// index of the view
+		RenderStats stats;	// counters of the thread
+		float* cost;		// cost of the pixels of the view (heatmap), NULL if not measured
+		const unsigned char* lod;	// level of detail of the objects in the view, NULL - full shapes
+		ReflectionCache::Entry* reflection;	// reflection cache entry of the pixel being rendered, NULL - no cache
+		unsigned long long cells;	// cells of the board grid walked by the rays so far
+		double weight;		// contribution of the traced ray to the color of the pixel
+	};
 	
 	Camera* camera_;
-	Light* light_;
+	Light* light_;			// main (key) light, the first one of lights_
+	vector<Light *> lights_;
 	Model* model_;
 	unsigned maxDepth_;
 
 	void setDepth(unsigned depth) { maxDepth_ = depth; }
+
+	//! Adds another light source (fill, rim...) to the main light
+	void addLight(Light& light) { lights_.push_back(new Light(light)); }
+
+	//! Lights contributing less than the threshold at the shaded point are skipped (no shadow rays)
+	void setLightThreshold(double threshold) { lightThreshold_ = threshold; }
+
+	//! A transparent surface traces only the dominant of its reflected and refracted rays if the other one contributes less to the pixel
+	/*! The traced ray takes over the weight of the skipped one. 0 traces both rays always.
+	*/
+	void setFresnelThreshold(double threshold) { fresnelThreshold_ = threshold; }
+
+	static const double DEFAULT_FRESNEL_THRESHOLD;
 	void setBackgroundColor(Vector3d color) { bgrdColor = color; }
 
+	//! Solves the primary visibility by rasterization instead of ray casting
+	void setRasterizePrimary(bool rasterize) { rasterizePrimary_ = rasterize; }
+
+	//! Number of rendering threads, 0 stands for all hardware threads
+	void setThreads(unsigned threads) { threads_ = threads; }
+
+	//! Statistics of the last rendering
+	RenderStats& getStats() { return stats_; }
+
+	//! Measures the cost of each pixel by the given metric (METRIC_NONE disables it)
+	void setHeatmap(Heatmap::Metric metric) { heatmap_ = metric; }
+	Heatmap::Metric getHeatmap() { return heatmap_; }
+
+	//! Cost of the pixels of the view in the last rendering, NULL if not measured
+	float* getCost(int view) { return (view < (int)costs_.size() && !costs_.at(view).empty()) ? &costs_.at(view)[0] : NULL; }
+
+	//! Finds the closest intersection of the ray with the model (with the proxies of the objects if asked to)
+	bool closestHit(Context& ctx, Ray& ray, Shape::Intersection& isC, bool proxies = false);
+
+	//! Returns true if the ray hits any object of the model closer than maxDist (any-hit query of the shadow rays)
+	/*! The object of the origin (the shaded intersection, if given) is tested with the shapes
+		the origin lies on, a proxy of the object might cover the surface and shadow it.
+	*/
+	bool occluded(Context& ctx, Ray& ray, double maxDist = INFINITY, Shape::Intersection* origin = NULL);
+
+	//! Returns the visible fraction of the light seen from the point (soft shadows of the light with a radius)
+	double lightVisibility(Context& ctx, Light* light, Point& from, Shape::Intersection* origin = NULL);
+
+	//! Shadow rays of the area light per shading point.
+	/*! The probes (stratified over the whole light) are cast first. Only if 
+		they disagree (penumbra) the remaining samples are cast as well. Both 
+		numbers are rounded down to a square.
+	*/
+	void setShadowSampling(unsigned samples, unsigned probes);
+
+	//! Coefficients of the Phong model - ambient (of the main light), diffuse and specular
+	static const double AMBIENT, DIFFUSE, SPECULAR;
+
+	//! Traces the shadow rays and the secondary rays of the given bounce and deeper against the proxies of the objects
+	/*! Bounce 0 uses the full shapes for all the secondary rays. The proxies must be created in the model.
+	*/
+	void setProxies(bool shadows, unsigned bounce) { shadowProxies_ = shadows; proxyBounce_ = bounce; }
+
+	//! Picks the level of detail of each object by its projected size, 0 renders the full shapes
+	/*! The coarsest level with at least one triangle per given number of pixels of the projected
+		bounding box is used for all rays of the view. The levels must be created in the model.
+	*/
+	void setLod(double pixelsPerTriangle) { lodPixels_ = pixelsPerTriangle; }
+
+	//! Finds the objects in the board grid of the model (if it has one) by walking the rays through its cells
+	void setBoardGrid(bool enabled) { boardGrid_ = enabled; }
+
+	//! Reuses the reflections of the primary hits on the static objects from the previous renderings, NULL disables it
+	/*! The cache stays owned by the caller, it is used only when the rays walk the board grid (see ReflectionCache).
+	*/
+	void setReflectionCache(ReflectionCache* cache) { reflections_ = cache; }
+
+	//! Levels of detail of the objects in the view in the last rendering, NULL if not used
+	const unsigned char* getLod(int view) { return (view < (int)lods_.size() && !lods_.at(view).empty()) ? &lods_.at(view)[0] : NULL; }
+
 private:
 	Vector3d bgrdColor;
+	bool rasterizePrimary_;
+	unsigned threads_;
+	RenderStats stats_;
+	Heatmap::Metric heatmap_;
+	vector<vector<float> > costs_;	// per-pixel cost of each view
+	unsigned shadowSamples_;		// shadow rays in the penumbra
+	unsigned shadowProbes_;			// shadow rays deciding whether the point is in the penumbra
+	double lightThreshold_;			// minimal unshadowed contribution of a light worth the shadow rays
+	double fresnelThreshold_;		// minimal contribution to the pixel of the weaker ray of a transparent surface worth tracing
+	bool shadowProxies_;			// shadow rays test the proxies of the objects
+	unsigned proxyBounce_;			// secondary rays of this and deeper bounces test the proxies, 0 - none
+	double lodPixels_;				// projected pixels per triangle of the level of detail, 0 - full shapes
+	bool boardGrid_;				// pieces are found by walking the board grid of the model (if it has one)
+	vector<vector<unsigned char> > lods_;	// level of detail of the objects in each view
+	ReflectionCache* reflections_;	// reflections kept between the renderings, NULL - none
+	bool cacheReflections_;			// the cache is used by the current rendering
+
+	//! Type-sorted shapes of one object
+	struct ObjectPrimitives {
+		vector<PrimitiveSet> levels;	// full shapes and the levels of detail
+		PrimitiveSet proxy;
+	};
+	vector<ObjectPrimitives> primitives_;	// one per object of the model
 	
-	Vector3d trace(Ray& ray, unsigned depth, bool inside);		
+	Vector3d trace(Context& ctx, Ray& ray, unsigned depth, bool inside);		
+
+	//! Renders the tiles of the scheduler into the images of the views (see prepare())
+	void render(vector<Camera *>& cameras, vector<Vector3d *>& images, TileScheduler& scheduler, bool prepared = false);
+
+	//! Renders one tile of the view, the image starts with the given row of the crop window
+	void renderTile(Context& ctx, Tile& tile, Vector3d* image, Rasterizer* raster, int firstRow = 0);
+
+	//! Allocates the cost buffers of the views (if the heatmap is enabled)
+	void initCosts(vector<Camera *>& cameras);
+
+	//! Picks the levels of detail of the objects in each view (if enabled)
+	void initLods(vector<Camera *>& cameras);
+
+	//! Invalidates the entries of the reflection cache the changes of the model might affect (if the cache is used)
+	void initReflections(vector<Camera *>& cameras);
+
+	//! Sorts the shapes of the model by type (see PrimitiveSet), classifies their materials and builds its bounding volume hierarchy if needed, called before each rendering
+	void initPrimitives();
+
+	//! Tests the object, isC is updated if the ray hits it closer
+	bool hitObject(Context& ctx, Ray& ray, int object, bool proxies, Shape::Intersection& isC);
+
+	//! Returns true if the object blocks the ray before maxDist
+	bool blocks(Context& ctx, Ray& ray, int object, double maxDist, Shape::Intersection* origin);
+
+	//! Visitor of the bounding volume hierarchy finding the closest hit
+	struct ClosestVisitor {
+		ClosestVisitor(RayTracer& rt, Context& ctx, Ray& ray, bool proxies, Shape::Intersection& isC) : rt(rt), ctx(ctx), ray(ray), proxies(proxies), isC(isC) { }
+		bool operator()(int object) { rt.hitObject(ctx, ray, object, proxies, isC); return false; }
+		RayTracer& rt; Context& ctx; Ray& ray; bool proxies; Shape::Intersection& isC;
+	};
+
+	//! Visitor of the bounding volume hierarchy stopping at the first object blocking the ray
+	struct OcclusionVisitor {
+		OcclusionVisitor(RayTracer& rt, Context& ctx, Ray& ray, double maxDist, Shape::Intersection* origin) : rt(rt), ctx(ctx), ray(ray), maxDist(maxDist), origin(origin) { }
+		bool operator()(int object) { return rt.blocks(ctx, ray, object, maxDist, origin); }
+		RayTracer& rt; Context& ctx; Ray& ray; double maxDist; Shape::Intersection* origin;
+	};
+
+	//! Shapes of the object the rays of the view are tested with - the level of detail or the proxy (if coarser)
+	PrimitiveSet& shapesOf(Context& ctx, int object, bool proxy);
+
+	//! Area of the triangles of the object projected along the direction (the silhouette of a closed surface)
+	double projectedSurface(int object, Vector3d& direction);
+
+	//! Traces the primary ray whose closest triangle (of the given object) is already known from the visibility buffer
+	Vector3d tracePrimary(Context& ctx, Ray& ray, Triangle* tri, int object);
+
+	//! Evaluates the color at the intersection by the kernel of its material (see Material::Kernel)
+	Vector3d shade(Context& ctx, Ray& ray, Shape::Intersection& isC, unsigned depth, bool inside);
+
+	//! Shading kernel - shadows and shading, the reflection and the refraction only if the kernel has them
+	template <int KERNEL>
+	Vector3d shade(Context& ctx, Ray& ray, Shape::Intersection& isC, unsigned depth, bool inside);
+
+	//! Traces the reflected ray of the hit contributing to its color with the weight (reuses the reflection cache if possible)
+	Vector3d traceReflection(Context& ctx, Ray& reflected, Shape::Intersection& isC, unsigned depth, bool inside, double weight);
 };
 
+const double RayTracer::AMBIENT = 0.2;
+const double RayTracer::DIFFUSE = 3.5;
+const double RayTracer::SPECULAR = 5.0;
+const double RayTracer::DEFAULT_FRESNEL_THRESHOLD = 0.05;
+
 inline void RayTracer::render(Vector3d* image)
 {
-	int w = camera_->getScreenWidth();
-	int h = camera_->getScreenHeight();
-	double pxw = camera_->getPxStep();
+	vector<Camera *> cameras(1, camera_);
+	vector<Vector3d *> images(1, image);
+
+	render(cameras, images);
+}
+
+inline void RayTracer::render(vector<Camera *>& cameras, vector<Vector3d *>& images)
+{
+	TileScheduler scheduler;
+	for(int v = 0; v < (int)cameras.size(); v++)
+		scheduler.addView(v, cameras.at(v)->getCrop());
+	render(cameras, images, scheduler);
+}
+
+inline void RayTracer::render(vector<Camera *>& cameras, vector<Vector3d *>& images, vector<TileScheduler::Task>& tasks, bool prepared)
+{
+	TileScheduler scheduler;
+	for(int i = 0; i < (int)tasks.size(); i++)
+		scheduler.addTask(tasks.at(i));
+	render(cameras, images, scheduler, prepared);
+}
+
+inline void RayTracer::prepare(vector<Camera *>& cameras)
+{
+	initPrimitives();
+	initCosts(cameras);
+	initLods(cameras);
+	initReflections(cameras);
+}
+
+inline void RayTracer::render(vector<Camera *>& cameras, vector<Vector3d *>& images, TileScheduler& scheduler, bool prepared)
+{
+	vector<Rasterizer *> rasters(cameras.size(), (Rasterizer *)NULL);
+	StopWatch total;
+	stats_.reset();
+	if(!prepared)
+		prepare(cameras);
+
+	for(int v = 0; v < (int)cameras.size(); v++) {
+		Camera* camera = cameras.at(v);
+		StopWatch watch;
+
+		// visibility buffer (hybrid mode), falls back to ray casting for unsupported models
+		// the buffer is sampled in pixel centers, so it is not used with anti-aliasing
+		if(rasterizePrimary_ && camera->getSamplesPerPixel() == 1 && camera->getJitter() == Camera::JITTER_NONE) {
+			rasters.at(v) = new Rasterizer(*camera, model_, getLod(v));
+			if(!rasters.at(v)->rasterize()) {
+				delete rasters.at(v);
+				rasters.at(v) = NULL;
+			}
+		}
+		stats_.visibilityTime += watch.lap();
+
+		// directions of primary rays are reused by the following frames
+		camera->prepareRays();
+		stats_.rayGenerationTime += watch.lap();
+	}
+
+	// render tiles of all views
+	atomic<int> done(0);
+	mutex statsMutex;
+	scheduler.run(threads_, [&](unsigned /*threadIdx*/) {
+		Context ctx;
+		TileScheduler::Task task;
+		while(scheduler.next(task)) {
+			ctx.camera = cameras.at(task.view);
+			ctx.view = task.view;
+			ctx.cost = getCost(task.view);
+			ctx.lod = getLod(task.view);
+			renderTile(ctx, task.tile, images.at(task.view), rasters.at(task.view));
+			printf("\r%.3lf %%", (double)(++done) / (double)scheduler.size() * 100.0);
+		}
+
+		lock_guard<mutex> lock(statsMutex);
+		stats_.merge(ctx.stats);
+	});
+
+	for(int v = 0; v < (int)rasters.size(); v++)
+		delete rasters.at(v);
+
+	stats_.totalTime = total.lap();
+}
+
+inline void RayTracer::render(vector<Camera *>& cameras, vector<ImageWriter *>& writers)
+{
+	TileScheduler scheduler;
+	vector<BandWindow *> windows;
+	StopWatch total;
+	stats_.reset();
+	prepare(cameras);
 
-	//// TopLeft screen pixel position	
-	Point pxTL = camera_->getTopLeftPX();
-	Point px = pxTL;
-	Vector3d wStep = camera_->getWidthStep();
-	Vector3d hStep = camera_->getHeightStep();	
+	// two bands per thread keep all threads busy while the oldest band is being finished
+	unsigned threads = (threads_ > 0) ? threads_ : TileScheduler::hardwareThreads();
 
-	// trace ray through each pixel	
-	for(int i = 0; i < h; i++) {		
-		px = pxTL + i * hStep;
-		for(int j = 0; j < w; j++) {			
-			printf("\r%.3lf %%", (double)(i * w + j) / (double)(h * w) * 100.0);			
-			Ray ray(camera_->position(), px - camera_->position());
-			image[i * w + j] = trace(ray, maxDepth_, false);
-			px = px + wStep;
-		}		
+	for(int v = 0; v < (int)cameras.size(); v++) {
+		Camera* camera = cameras.at(v);
+		StopWatch watch;
+		camera->prepareRays();
+		stats_.rayGenerationTime += watch.lap();
+		scheduler.addView(v, camera->getCrop());
+		windows.push_back(new BandWindow(writers.at(v), camera->getImageWidth(), camera->getImageHeight(), 2 * threads));
 	}
+
+	atomic<int> done(0);
+	mutex statsMutex;
+	scheduler.run(threads, [&](unsigned /*threadIdx*/) {
+		Context ctx;
+		TileScheduler::Task task;
+		while(scheduler.next(task)) {
+			BandWindow* window = windows.at(task.view);
+			int band = (task.tile.y - cameras.at(task.view)->getCrop().y) / window->getBandHeight();
+			Vector3d* rows = window->acquire(band);
+
+			ctx.camera = cameras.at(task.view);
+			ctx.view = task.view;
+			ctx.cost = getCost(task.view);
+			ctx.lod = getLod(task.view);
+			renderTile(ctx, task.tile, rows, NULL, band * window->getBandHeight());
+
+			// the thread finishing the band writes it (including waiting for the writer)
+			StopWatch watch;
+			window->finishTile(band);
+			ctx.stats.outputTime += watch.lap();
+			printf("\r%.3lf %%", (double)(++done) / (double)scheduler.size() * 100.0);
+		}
+
+		lock_guard<mutex> lock(statsMutex);
+		stats_.merge(ctx.stats);
+	});
+
+	for(int v = 0; v < (int)windows.size(); v++)
+		delete windows.at(v);
+
+	stats_.totalTime = total.lap();
 }
 
-inline Vector3d RayTracer::trace(Ray& ray, unsigned depth, bool inside)
-{		
-	bool intersectsBoundingBox;
-	Shape::Intersection is, isC;	// intersection info
-	isC.t = INFINITY;						
-	Vector3d color;					// resulting pixel color
-
-	// find closest intersection
-	#pragma omp parallel for
-	for(int i = 0; i < (int)model_->objects_.size(); i ++) {
-		// check preset visibility of object
-		if(!model_->objects_.at(i).visible) 
-			continue;
+inline RenderStats RayTracer::estimate(vector<Camera *>& cameras)
+{
+	RenderStats estimate;
+	initPrimitives();
+	initLods(cameras);
+	BoardGrid* grid = boardGrid_ ? model_->getGrid() : NULL;
+	int n = (int)model_->objects_.size();
 
-		intersectsBoundingBox = false;
+	// shadow rays of one shaded point
+	double shadowRays = 0.0;
+	for(int i = 0; i < (int)lights_.size(); i++)
+		shadowRays += (lights_.at(i)->radius_ > 0.0) ? shadowProbes_ : 1;
 
-		// check intersection with bounding box		
-		if(model_->objects_.at(i).boundingBox.size() > 0) {
-			for(int j = 0; j < (int)model_->objects_.at(i).boundingBox.size(); j++)
-				if(model_->objects_.at(i).boundingBox.at(j)->intersects(ray, is))
-					intersectsBoundingBox = true;			
-		} else {
-			intersectsBoundingBox = true;
+	// secondary rays of the object i hitting the object j - the solid angle of the mean cross-section of j (a quarter
+	// of its surface) seen from the center of i, at most the half of the directions
+	vector<Vector3d> center(n), cmin(n), cmax(n);
+	vector<double> crossSection(n, 0.0);
+	vector<double> bounces(n, 0.0);		// secondary rays of a hit
+	for(int i = 0; i < n; i++) {
+		Object& o = model_->objects_.at(i);
+		if(!o.visible || o.shapes.empty())
+			continue;
+		o.getBounds(cmin[i], cmax[i]);
+		center[i] = (cmin[i] + cmax[i]) * 0.5;
+		for(int k = 0; k < (int)o.shapes.size(); k++) {
+			Triangle* t = dynamic_cast<Triangle *>(o.shapes.at(k));
+			if(t != NULL)
+				crossSection[i] += (t->v1 - t->v0).cross(t->v2 - t->v0).length() * 0.5 / 4.0;
 		}
-		
-		// check intersction with the object
-		if(intersectsBoundingBox) {
-			for(int j = 0; j < (int)model_->objects_.at(i).shapes.size(); j++) {		
-				if(model_->objects_.at(i).shapes.at(j)->intersects(ray, is) && (is.t < isC.t))
-					isC = is;					
-			}		
+		Material* material = o.shapes.front()->mat_;
+		bounces[i] = ((material->reflection > 0.0) ? 1.0 : 0.0) + ((material->transparency > 0.0) ? 1.0 : 0.0);
+	}
+	vector<vector<double> > reach(n, vector<double>(n, 0.0));
+	for(int i = 0; i < n; i++) {
+		double sum = 0.0;
+		for(int j = 0; j < n; j++) {
+			// the objects around the center of i (the other half of the board) are not seen from its surface
+			Vector3d& c = center[i];
+			double d = (center[j] - c).length();
+			bool inside = c.x_ >= cmin[j].x_ && c.y_ >= cmin[j].y_ && c.z_ >= cmin[j].z_ && c.x_ <= cmax[j].x_ && c.y_ <= cmax[j].y_ && c.z_ <= cmax[j].z_;
+			if(j == i || crossSection[i] <= 0.0 || crossSection[j] <= 0.0 || inside)
+				continue;
+			reach[i][j] = min(0.5, crossSection[j] / (d * d) / (2.0 * PI));
+			sum += reach[i][j];
 		}
+		for(int j = 0; j < n && sum > 1.0; j++)
+			reach[i][j] /= sum;
 	}
 
-	// some intersection found
-	if(isC.t < INFINITY) {					
-		Vector3d cop(0.0, 0.0, 0.0);	// color of object at the given pixel.
-		Vector3d cr(0.0, 0.0, 0.0);		// color of reflected ray
-		Vector3d ct(0.0, 0.0, 0.0);		// color of refracted ray
+	for(int v = 0; v < (int)cameras.size(); v++) {
+		Context ctx;
+		ctx.lod = getLod(v);
+		unsigned samples = cameras.at(v)->getSamplesPerPixel();
+		double rays = (double)cameras.at(v)->getCrop().size() * samples;
+		if(rays <= 0.0)
+			continue;
 
-		// hack - move interscetion point along a normal vector a bit (double imprecision workaround)
-		Point isectOut(isC.isect + (isC.normal * 0.00001));
-		Point isectIn(isC.isect - (isC.normal * 0.00001));		
+		// the primary rays through the projected boxes
+		vector<double> hits(n, 0.0);
+		double covered = 0.0, passed = 0.0, boxTests = 0.0, triangleTests = 0.0;
+		for(int i = 0; i < n; i++) {
+			if(crossSection[i] <= 0.0)
+				continue;
+			// the part of the box the object fills seen from the camera
+			Vector3d d = (center[i] - cameras.at(v)->position()).normalize();
+			Vector3d size = cmax[i] - cmin[i];
+			double box = fabs(d.x_) * size.y_ * size.z_ + fabs(d.y_) * size.x_ * size.z_ + fabs(d.z_) * size.x_ * size.y_;
+			double fill = (box > 0.0) ? min(1.0, projectedSurface(i, d) / box) : 1.0;
+			double area = cameras.at(v)->projectedArea(cmin[i], cmax[i]) * samples;
+			hits[i] = area * fill;
 
-		// cast shadow rays
-		Vector3d lv((light_->center_ - isectOut).normalize());	// vector aiming to light
-		bool illuminated = true;
-		if(inside || lv.dot(isC.normal) < 0.0) {		// inside object or face turned away from light			
-			illuminated = false;			
-		} else {
-			for(int i = 0; i < (int)model_->objects_.size() && illuminated; i++) {
-				// check preset visibility of object
-				if(!model_->objects_.at(i).visible) 
+			// the objects out of the grid are tested by all the rays
+			boxTests += (grid != NULL && !grid->contains(i)) ? rays : area;
+			triangleTests += area * shapesOf(ctx, i, false).size();
+			passed += area;
+			covered += hits[i];
+		}
+		if(covered <= 0.0) {
+			estimate.primaryRays += (long long)rays;
+			continue;
+		}
+		// the objects overlap (independently), each ray hits one of them at most
+		double missed = 1.0;
+		for(int i = 0; i < n; i++)
+			missed *= 1.0 - min(hits[i] / rays, 1.0);
+		for(int i = 0; i < n; i++)
+			hits[i] *= rays * (1.0 - missed) / covered;
+
+		// the secondary rays of each bounce
+		double shaded = 0.0, secondary = 0.0;
+		for(unsigned depth = maxDepth_; ; depth--) {
+			vector<double> next(n, 0.0);
+			for(int i = 0; i < n; i++) {
+				shaded += hits[i];
+				if(depth == 0 || bounces[i] == 0.0)
 					continue;
+				Material* material = model_->objects_.at(i).shapes.front()->mat_;
+				if(material->reflection > 0.0)		estimate.reflectionRays += (long long)hits[i];
+				if(material->transparency > 0.0)	estimate.refractionRays += (long long)hits[i];
+				secondary += hits[i] * bounces[i];
+				for(int j = 0; j < n; j++)
+					next[j] += hits[i] * bounces[i] * reach[i][j];
+			}
+			if(depth == 0)
+				break;
+			hits.swap(next);
+		}
 
-				intersectsBoundingBox = false;
-				
-				// check intersection with the bounding box
-				if(model_->objects_.at(i).boundingBox.size() > 0) {
-					for(int j = 0; j < (int)model_->objects_.at(i).boundingBox.size(); j++)
-						if(model_->objects_.at(i).boundingBox.at(j)->intersects(Ray(isectOut, lv), is))
-							intersectsBoundingBox = true;			
-				} else {
-					intersectsBoundingBox = true;
-				}
-				
-				// check intersction with the object
-				if(intersectsBoundingBox) {
-					for(int j = 0; j < (int)model_->objects_.at(i).shapes.size(); j++) {			
-						if(model_->objects_.at(i).shapes.at(j)->intersects(Ray(isectOut, lv), is)) {
-							illuminated = false;
-							break;
-						}
-					}
+		double traced = shaded * shadowRays + secondary;
+		estimate.primaryRays += (long long)rays;
+		estimate.shadowRays += (long long)(shaded * shadowRays);
+		estimate.hits += (long long)shaded;
+		estimate.boundingBoxTests += (long long)(boxTests / rays * (traced + (rasterizePrimary_ ? 0.0 : rays)));
+		estimate.triangleTests += (long long)(triangleTests / rays * (traced + (rasterizePrimary_ ? 0.0 : rays)) + (rasterizePrimary_ ? rays : 0.0));
+		estimate.traversalSteps += (long long)(passed / rays * (traced + (rasterizePrimary_ ? 0.0 : rays)));
+	}
+
+	return estimate;
+}
+
+inline double RayTracer::projectedSurface(int object, Vector3d& direction)
+{
+	// a closed surface covers its silhouette twice (front and back), an open one (a plane) might cover it once
+	double faces = 0.0;
+	Vector3d oriented(0.0, 0.0, 0.0);	// sum of the oriented areas, zero for a closed surface
+	vector<Shape *>& shapes = model_->objects_.at(object).shapes;
+	for(int k = 0; k < (int)shapes.size(); k++) {
+		Triangle* t = dynamic_cast<Triangle *>(shapes.at(k));
+		if(t == NULL)
+			continue;
+		Vector3d area = (t->v1 - t->v0).cross(t->v2 - t->v0) * 0.5;
+		faces += fabs(area.dot(direction));
+		oriented += area;
+	}
+	return (faces + fabs(oriented.dot(direction))) * 0.5;
+}
+
+inline void RayTracer::initCosts(vector<Camera *>& cameras)
+{
+	costs_.assign(cameras.size(), vector<float>());
+	if(heatmap_ == Heatmap::METRIC_NONE)
+		return;
+
+	for(int v = 0; v < (int)cameras.size(); v++)
+		costs_.at(v).assign(cameras.at(v)->getImageWidth() * cameras.at(v)->getImageHeight(), 0.0f);
+}
+
+inline void RayTracer::initLods(vector<Camera *>& cameras)
+{
+	lods_.assign(cameras.size(), vector<unsigned char>());
+	if(lodPixels_ <= 0.0)
+		return;
+
+	for(int v = 0; v < (int)cameras.size(); v++) {
+		for(int i = 0; i < (int)model_->objects_.size(); i++) {
+			Object& object = model_->objects_.at(i);
+			Vector3d cmin, cmax;
+			object.getBounds(cmin, cmax);
+			double size = cameras.at(v)->projectedSize(cmin, cmax);
+
+			// the coarsest level which still has the triangles the object deserves on the screen
+			double wanted = size * size / lodPixels_;
+			unsigned level = 0;
+			while(level < object.lods.size() && level < 255 && object.lods.at(level).size() >= wanted)
+				level++;
+			lods_.at(v).push_back((unsigned char)level);
+		}
+	}
+}
+
+inline void RayTracer::initReflections(vector<Camera *>& cameras)
+{
+	// the rays of a reflection must walk the grid to know the pieces which might change it
+	BoardGrid* grid = boardGrid_ ? model_->getGrid() : NULL;
+	cacheReflections_ = (reflections_ != NULL && grid != NULL && !grid->empty());
+	if(cacheReflections_)
+		reflections_->update(model_, grid, cameras);
+}
+
+inline void RayTracer::initPrimitives()
+{
+	model_->updateBvh();
+	primitives_.resize(model_->objects_.size());
+	for(int i = 0; i < (int)model_->objects_.size(); i++) {
+		Object& o = model_->objects_.at(i);
+		ObjectPrimitives& p = primitives_.at(i);
+		p.levels.resize(o.lods.size() + 1);
+		for(int level = 0; level <= (int)o.lods.size(); level++)
+			p.levels.at(level).build(o.getShapes(level));
+		p.proxy.build(o.proxy);
+
+		// the materials might have changed since the last rendering
+		for(int j = 0; j < (int)o.shapes.size(); j++)
+			o.shapes.at(j)->mat_->classify();
+	}
+}
+
+inline PrimitiveSet& RayTracer::shapesOf(Context& ctx, int object, bool proxy)
+{
+	ObjectPrimitives& p = primitives_.at(object);
+	PrimitiveSet& shapes = p.levels.at((ctx.lod != NULL) ? min((size_t)ctx.lod[object], p.levels.size() - 1) : 0);
+	return (proxy && p.proxy.size() > 0 && p.proxy.size() < shapes.size()) ? p.proxy : shapes;
+}
+
+inline void RayTracer::renderTile(Context& ctx, Tile& tile, Vector3d* image, Rasterizer* raster, int firstRow)
+{
+	// the image (and the cost) covers the crop window
+	Tile crop = ctx.camera->getCrop();
+	int w = crop.width;
+	unsigned samples = ctx.camera->getSamplesPerPixel();
+	RayBatch batch;
+	StopWatch watch;
+	StopWatch pixelWatch;
+
+	for(unsigned s = 0; s < samples; s++) {
+		watch.lap();
+		ctx.camera->generateRays(tile, batch, s);
+		ctx.stats.rayGenerationTime += watch.lap();
+		ctx.stats.primaryRays += tile.size();
+
+		for(int i = 0; i < tile.height; i++) {
+			for(int j = 0; j < tile.width; j++) {
+				int x = tile.x + j;
+				int y = tile.y + i;
+				int k = (y - crop.y) * w + x - crop.x;
+				Ray ray(ctx.camera->position(), batch.direction(i * tile.width + j), true);
+				Vector3d color;
+				long long tests = ctx.stats.boundingBoxTests + ctx.stats.triangleTests;
+				if(ctx.cost != NULL && heatmap_ == Heatmap::METRIC_TIME)
+					pixelWatch.lap();
+				ctx.reflection = cacheReflections_ ? reflections_->at(ctx.view, x, y, s) : NULL;
+				ctx.weight = 1.0;
+
+				if(raster != NULL && !raster->needsTrace(x, y))
+					color = tracePrimary(ctx, ray, raster->at(x, y), raster->objectAt(x, y));
+				else
+					color = trace(ctx, ray, maxDepth_, false);
+
+				if(ctx.cost != NULL) {
+					if(heatmap_ == Heatmap::METRIC_TIME)
+						ctx.cost[k] += (float)(pixelWatch.lap() * 1e9);
+					else
+						ctx.cost[k] += (float)(ctx.stats.boundingBoxTests + ctx.stats.triangleTests - tests);
 				}
+
+				if(s == 0)	image[k - firstRow * w] = color;
+				else		image[k - firstRow * w] += color;
 			}
 		}
+		ctx.stats.tracingTime += watch.lap();
+	}
+
+	// box filter of the samples
+	if(samples > 1)
+		for(int i = tile.y - crop.y - firstRow; i < tile.y - crop.y - firstRow + tile.height; i++)
+			for(int j = tile.x - crop.x; j < tile.x - crop.x + tile.width; j++)
+				image[i * w + j] = image[i * w + j] * (1.0 / samples);
+}
+
+inline Vector3d RayTracer::tracePrimary(Context& ctx, Ray& ray, Triangle* tri, int object)
+{
+	Shape::Intersection isC;
+
+	if(tri == NULL)
+		return bgrdColor;
+
+	// the pixel center might be just outside of the rasterized triangle due to imprecision
+	ctx.stats.triangleTests++;
+	if(!tri->intersects(ray, isC))
+		return trace(ctx, ray, maxDepth_, false);
 
-		// evaluate Phong reflection and shading model
-		Vector3d R, V;
-		
-		double Ia = 0.0, Id = 0.0, Is = 0.0;
-		double ka = 0.2, kd = 3.5, ks = 5.0;
-		//double ka = 0.0, kd = 3.5, ks = 5.0;		
-		
-		// ambient
-		Ia = ka;
+	ctx.stats.hits++;
+	isC.object = object;
+	isC.shapes = &shapesOf(ctx, object, false);
+	return shade(ctx, ray, isC, maxDepth_, false);
+}
+
+inline Vector3d RayTracer::trace(Context& ctx, Ray& ray, unsigned depth, bool inside)
+{		
+	Shape::Intersection isC;	// intersection info
 
-		if(illuminated) {		
-			// diffuse		
-			Id = lv.dot(isC.normal) * kd;			
+	// some intersection found, deep bounces might be traced against the proxies
+	if(closestHit(ctx, ray, isC, proxyBounce_ > 0 && maxDepth_ - depth >= proxyBounce_)) {
+		ctx.stats.hits++;
+		return shade(ctx, ray, isC, depth, inside);
+	}
+
+	// no intersection
+	if(depth == maxDepth_)			
+		return bgrdColor;
+	else
+		return Vector3d(0.0, 0.0, 0.0);	// background color - BLACK
+}
 
-			// specular
-			R = -lv + isC.normal * (2 * lv.dot(isC.normal));	// reflected light ray
-			V = (camera_->position() - isectOut).normalize();	// viewer-intersection ray
-			Is = pow(max(0.0, R.dot(V)), isC.obj->mat_->shininess) * ks;			
+inline bool RayTracer::hitObject(Context& ctx, Ray& ray, int object, bool proxies, Shape::Intersection& isC)
+{
+	Object& o = model_->objects_.at(object);
+
+	// check preset visibility of object
+	if(!o.visible) 
+		return false;
+
+	// check intersection with bounding box		
+	if(o.boundingBox.size() > 0) {
+		ctx.stats.boundingBoxTests++;
+		if(!o.intersectsBoundingBox(ray))
+			return false;
+	}
+	
+	// check intersction with the object (level of detail or proxy)
+	PrimitiveSet& shapes = shapesOf(ctx, object, proxies);
+	ctx.stats.traversalSteps++;
+	ctx.stats.triangleTests += shapes.size();
+	if(shapes.closest(ray, isC)) {
+		isC.object = object;
+		isC.shapes = &shapes;
+		return true;
+	}
+	return false;
+}
+
+inline bool RayTracer::blocks(Context& ctx, Ray& ray, int object, double maxDist, Shape::Intersection* origin)
+{
+	Object& o = model_->objects_.at(object);
+
+	// check preset visibility of object
+	if(!o.visible) 
+		return false;
+
+	// check intersection with the bounding box
+	if(o.boundingBox.size() > 0) {
+		ctx.stats.boundingBoxTests++;
+		if(!o.intersectsBoundingBox(ray))
+			return false;
+	}
+
+	// the proxy will do, except for the object of the origin tested with the shapes the origin lies on
+	PrimitiveSet& shapes = (origin != NULL && origin->object == object) ? *origin->shapes : shapesOf(ctx, object, shadowProxies_);
+
+	// any intersection with the object will do
+	ctx.stats.traversalSteps++;
+	return shapes.any(ray, maxDist, ctx.stats.triangleTests);
+}
+
+inline bool RayTracer::closestHit(Context& ctx, Ray& ray, Shape::Intersection& isC, bool proxies)
+{
+	BoardGrid* grid = boardGrid_ ? model_->getGrid() : NULL;
+	isC.t = INFINITY;
+
+	// without the grid the objects are found in the bounding volume hierarchy, isC.t limits its traversal
+	if(grid == NULL) {
+		ClosestVisitor visitor(*this, ctx, ray, proxies, isC);
+		model_->getBvh().traverse(ray, isC.t, visitor, ctx.stats.boundingBoxTests);
+		return isC.t < INFINITY;
+	}
+
+	// objects out of the grid (chessboard)
+	for(int i = 0; i < (int)model_->objects_.size(); i ++)
+		if(!grid->contains(i))
+			hitObject(ctx, ray, i, proxies, isC);
+
+	// objects in the grid cell by cell, up to the closest hit so far
+	BoardGrid::Walk walk;
+	if(grid->begin(ray, isC.t, walk)) {
+		unsigned long long tested = 0;		// objects spanning more cells are tested once
+		do {
+			vector<int>& objects = grid->cell(walk);
+			ctx.cells |= BoardGrid::cellBit(walk);
+			for(int i = 0; i < (int)objects.size(); i++) {
+				if(tested & (1ULL << objects[i]))
+					continue;
+				tested |= 1ULL << objects[i];
+				hitObject(ctx, ray, objects[i], proxies, isC);
+			}
+			// nothing in the next cells is closer
+			if(isC.t <= walk.tExit)
+				break;
+		} while(grid->next(walk));
+	}
+
+	return isC.t < INFINITY;
+}
+
+inline bool RayTracer::occluded(Context& ctx, Ray& ray, double maxDist, Shape::Intersection* origin)
+{
+	BoardGrid* grid = boardGrid_ ? model_->getGrid() : NULL;
+
+	ctx.stats.shadowRays++;
+	if(grid == NULL) {
+		OcclusionVisitor visitor(*this, ctx, ray, maxDist, origin);
+		return model_->getBvh().traverse(ray, maxDist, visitor, ctx.stats.boundingBoxTests);
+	}
+
+	for(int i = 0; i < (int)model_->objects_.size(); i++)
+		if(!grid->contains(i) && blocks(ctx, ray, i, maxDist, origin))
+			return true;
+
+	BoardGrid::Walk walk;
+	if(grid->begin(ray, maxDist, walk)) {
+		unsigned long long tested = 0;
+		do {
+			vector<int>& objects = grid->cell(walk);
+			ctx.cells |= BoardGrid::cellBit(walk);
+			for(int i = 0; i < (int)objects.size(); i++) {
+				if(tested & (1ULL << objects[i]))
+					continue;
+				tested |= 1ULL << objects[i];
+				if(blocks(ctx, ray, objects[i], maxDist, origin))
+					return true;
+			}
+		} while(grid->next(walk));
+	}
+
+	return false;
+}
+
+inline void RayTracer::setShadowSampling(unsigned samples, unsigned probes)
+{
+	unsigned n = (unsigned)sqrt((double)max(samples, 1u));
+	unsigned m = (unsigned)sqrt((double)max(probes, 1u));
+	shadowSamples_ = n * n;
+	shadowProbes_ = min(m, n) * min(m, n);
+}
+
+inline double RayTracer::lightVisibility(Context& ctx, Light* light, Point& from, Shape::Intersection* origin)
+{
+	// jitter hashed from the point, the result does not depend on the order of rendering
+	unsigned h = (unsigned)(long long)(from.x_ * 1e5) * 73856093u ^ 
+				 (unsigned)(long long)(from.y_ * 1e5) * 19349663u ^ 
+				 (unsigned)(long long)(from.z_ * 1e5) * 83492791u;
+
+	unsigned visible = 0;
+	unsigned cast = 0;
+	unsigned passes[2] = { (unsigned)(sqrt((double)shadowProbes_) + 0.5), (unsigned)(sqrt((double)shadowSamples_) + 0.5) };
+
+	// probes first, then the full stratification in the penumbra
+	for(int pass = 0; pass < 2; pass++) {
+		unsigned n = passes[pass];
+		for(unsigned i = 0; i < n * n; i++) {
+			h ^= h >> 16; h *= 0x7feb352du;
+			h ^= h >> 15; h *= 0x846ca68bu;
+			h ^= h >> 16;
+
+			double u = ((i % n) + (h & 0xffff) / 65536.0) / n;
+			double v = ((i / n) + (h >> 16) / 65536.0) / n;
+			Point p = light->sample(from, u, v);
+			Vector3d d = p - from;
+			double dist = d.length();
+
+			Ray shadowRay(from, d * (1.0 / dist), true);
+			if(!occluded(ctx, shadowRay, dist, origin))
+				visible++;
+			cast++;
+		}
+
+		// fully lit or fully shadowed
+		if(visible == 0 || visible == cast)
+			break;
+	}
+
+	return (double)visible / cast;
+}
+
+inline Vector3d RayTracer::shade(Context& ctx, Ray& ray, Shape::Intersection& isC, unsigned depth, bool inside)
+{
+	switch(isC.obj->mat_->kernel) {
+	case Material::KERNEL_DIFFUSE:		return shade<Material::KERNEL_DIFFUSE>(ctx, ray, isC, depth, inside);
+	case Material::KERNEL_REFLECTIVE:	return shade<Material::KERNEL_REFLECTIVE>(ctx, ray, isC, depth, inside);
+	case Material::KERNEL_TRANSPARENT:	return shade<Material::KERNEL_TRANSPARENT>(ctx, ray, isC, depth, inside);
+	default:							return shade<Material::KERNEL_REFLECTIVE_TRANSPARENT>(ctx, ray, isC, depth, inside);
+	}
+}
+
+template <int KERNEL>
+inline Vector3d RayTracer::shade(Context& ctx, Ray& ray, Shape::Intersection& isC, unsigned depth, bool inside)
+{
+	const bool reflective = (KERNEL & Material::KERNEL_REFLECTIVE) != 0;
+	const bool transparent = (KERNEL & Material::KERNEL_TRANSPARENT) != 0;
+	Material* mat = isC.obj->mat_;
+
+	// no light reaches the inside of an object, only the refracted ray
+	if(!transparent && inside)
+		return Vector3d(0.0, 0.0, 0.0);
+
+	// hack - move interscetion point along a normal vector a bit (double imprecision workaround)
+	Point isectOut(isC.isect + (isC.normal * 0.00001));
+
+	// evaluate Phong reflection and shading model
+	Vector3d R, V;
+	double Id = 0.0, Is = 0.0;
+	
+	// ambient (of the main light)
+	Vector3d lit(light_->mat_->color * AMBIENT);
+
+	// direct light of each light source
+	V = (ctx.camera->position() - isectOut).normalize();	// viewer-intersection ray
+	for(int i = 0; i < (int)lights_.size() && !inside; i++) {
+		Light* light = lights_.at(i);
+		Vector3d lv((light->center_ - isectOut).normalize());	// vector aiming to light
+		if(lv.dot(isC.normal) < 0.0)		// face turned away from light
+			continue;
+
+		// diffuse		
+		Id = lv.dot(isC.normal) * DIFFUSE;			
+
+		// specular
+		R = (-lv).reflect(isC.normal);			// reflected light ray
+		Is = pow(max(0.0, R.dot(V)), mat->shininess) * SPECULAR;			
+
+		// importance of the light - its contribution if nothing shadowed it
+		double weight = light->intensity_ * light->attenuation((light->center_ - isectOut).length());
+		if(weight * (Id + Is) * light->mat_->color.max() * mat->color.max() < lightThreshold_) {
+			ctx.stats.culledLights++;
+			continue;
+		}
+
+		// cast shadow rays
+		double visibility = 1.0;		// visible fraction of the light
+		if(light->radius_ > 0.0)
+			visibility = lightVisibility(ctx, light, isectOut, &isC);
+		else {
+			Ray shadowRay(isectOut, lv);
+			visibility = occluded(ctx, shadowRay, INFINITY, &isC) ? 0.0 : 1.0;
 		}
 
-		cop = light_->mat_->color * isC.obj->mat_->color * (Ia + Id + Is);
+		if(visibility > 0.0)
+			lit += light->mat_->color * (weight * visibility * (Id + Is));
+	}
+
+	// color of object at the given pixel, the opaque matte object is done
+	Vector3d color(lit * mat->color);
+	if(!reflective && !transparent)
+		return color;
 
-		// reflective object
-		if(!inside && isC.obj->mat_->reflection > 0.0 && depth > 0) {
-			cr = trace(Ray(isectOut, ray.getDir() + isC.normal * (2 * (-(ray.getDir())).dot(isC.normal))) , depth - 1, false);
+	// reflective object
+	if(reflective && !transparent) {
+		Vector3d cr(0.0, 0.0, 0.0);		// color of reflected ray
+		if(depth > 0) {
+			Ray reflected(isectOut, ray.getDir().reflect(isC.normal));
+			cr = traceReflection(ctx, reflected, isC, depth, false, mat->reflection);
 		}
+		color = mat->reflection * cr + (1.0 - mat->reflection) * color;
+	}
 
-		// transparent object
-		if(isC.obj->mat_->transparency > 0.0 && depth > 0) {
-			double ref = inside ? (1.0 / isC.obj->mat_->refractIdx) : (isC.obj->mat_->refractIdx); // n1 / n2 - ratio of refr. idxs
-			Vector3d normal = inside ? isC.normal : -isC.normal;
-			double cosI = normal.dot(ray.getDir()); // cosine of incident ray
-			Vector3d refrDir(ref * ray.getDir() + (ref * cosI - sqrt(1.0 - ref * ref * (1.0 - cosI * cosI))) * normal);
-			ct = trace(Ray(inside ? isectOut : isectIn, refrDir.normalize()), depth - 1, inside ? false : true);
+	// transparent object - the light passing through the surface is split by the Fresnel term, inside only the surface is seen
+	if(transparent) {
+		double ref = inside ? (mat->refractIdx) : (1.0 / mat->refractIdx); // n1 / n2 - ratio of refr. idxs
+		Vector3d normal = inside ? -isC.normal : isC.normal;	// facing the incident ray
+		double through = inside ? 1.0 : mat->transparency;		// part of the light passing through the surface
+		double coat = (reflective && !inside) ? (1.0 - through) * mat->reflection : 0.0;	// mirror reflection of the rest
+		double fr = ray.getDir().fresnel(normal, ref);			// 1.0 on total internal reflection
+		double wr = coat + through * fr;	// weights of the reflected and the refracted ray
+		double wt = through * (1.0 - fr);
+
+		// the weaker ray is not traced if it would contribute too little to the pixel
+		if(wr < wt && ctx.weight * wr < fresnelThreshold_) {
+			wt += wr;
+			wr = 0.0;
+		} else if(wt <= wr && ctx.weight * wt < fresnelThreshold_) {
+			wr += wt;
+			wt = 0.0;
 		}
 
-		if(inside) {
-			color = ct;
-		} else {
-			color = isC.obj->mat_->transparency * ct + 
-				(1.0 - isC.obj->mat_->transparency) * (isC.obj->mat_->reflection * cr + (1.0 - isC.obj->mat_->reflection) * cop);
+		// fresnel() and refract() might disagree at the critical angle, the reflection takes all then
+		Vector3d refrDir;
+		if(wt > 0.0 && depth > 0 && !ray.getDir().refract(normal, ref, refrDir)) {
+			wr += wt;
+			wt = 0.0;
+		}
+
+		color = inside ? Vector3d(0.0, 0.0, 0.0) : (1.0 - through - coat) * color;
+		Point isectIn(isC.isect - (isC.normal * 0.00001));
+		if(wr > 0.0 && depth > 0) {
+			// the ray reflected inside stays inside
+			Ray reflected(inside ? isectIn : isectOut, ray.getDir().reflect(isC.normal));
+			color += wr * traceReflection(ctx, reflected, isC, depth, inside, wr);
+		}
+		if(wt > 0.0 && depth > 0) {
+			Ray refracted(inside ? isectOut : isectIn, refrDir.normalize());
+			double weight = ctx.weight;
+			ctx.stats.refractionRays++;
+			ctx.weight *= wt;
+			color += wt * trace(ctx, refracted, depth - 1, !inside);
+			ctx.weight = weight;
 		}
-	} 
-	// no intersection
-	else {
-		if(depth == maxDepth_)			
-			color = bgrdColor;
-		else
-			color = Vector3d(0.0, 0.0, 0.0);	// background color - BLACK
 	}
 
 	return color;
 }
 
-#endif
\ No newline at end of file
+inline Vector3d RayTracer::traceReflection(Context& ctx, Ray& reflected, Shape::Intersection& isC, unsigned depth, bool inside, double weight)
+{
+	// the reflection of a primary hit on a static object (out of the grid) might be known from the last frame
+	ReflectionCache::Entry* entry = (depth == maxDepth_ && ctx.reflection != NULL && !model_->getGrid()->contains(isC.object)) ? ctx.reflection : NULL;
+	if(entry != NULL && entry->matches(reflected, depth - 1)) {
+		ctx.stats.cachedReflections++;
+		return entry->color;
+	}
+
+	ctx.stats.reflectionRays++;
+	unsigned long long cells = ctx.cells;
+	double pathWeight = ctx.weight;
+	ctx.cells = 0;
+	ctx.weight *= weight;
+	Vector3d cr = trace(ctx, reflected, depth - 1, inside);
+	if(entry != NULL)
+		entry->store(reflected, depth - 1, ctx.cells, cr);
+	ctx.cells |= cells;
+	ctx.weight = pathWeight;
+	return cr;
+}
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef _REFLECTIONCACHE_H_
+#define _REFLECTIONCACHE_H_
+
+#include <vector>
+#include <cmath>
+#include "Vector3d.h"
+#include "Ray.h"
+#include "Tile.h"
+#include "Camera.h"
+#include "Model.h"
+#include "BoardGrid.h"
+
+using namespace std;
+
+//! Reflections of the primary hits on the static objects (chessboard) kept between the frames
+/*!
+	Each pixel (and sample) of each view keeps the color of the reflected
+	ray of its primary hit, the reflected ray and the mask of the cells of the
+	board grid the rays of the reflection (deeper bounces and shadow rays
+	included) walked through. Only the pieces listed in these cells can
+	change the reflection, so when a piece moves (or is hidden) only the
+	entries which walked its old or new cells are traced again. The others
+	are reused while the reflected ray stays the same (the camera does not
+	move).
+
+	The objects out of the grid must not change, any change of them clears
+	the cache. Neither the lights, the materials nor the settings of the ray
+	tracer are watched - the owner clears the cache when they change.
+*/
+class ReflectionCache
+{
+public:
+	//! Reflection of one primary hit
+	struct Entry {
+		Entry() : cells(0), depth(0), valid(false) { }
+
+		//! Returns true if the entry holds the reflection of the ray traced to the depth
+		bool matches(const Ray& ray, unsigned depth) const;
+
+		void store(const Ray& ray, unsigned depth, unsigned long long cells, Vector3d& color);
+
+		Point origin;				// reflected ray
+		Vector3d direction;
+		Vector3d color;
+		unsigned long long cells;	// cells of the grid walked by the rays of the reflection
+		unsigned depth;				// remaining depth of the reflected ray
+		bool valid;
+	};
+
+	ReflectionCache() : invalidated_(0) { }
+
+	//! Invalidates the entries the objects changed since the last update might affect, sizes the entries of the views
+	/*! Called before each rendering using the cache, the grid is the one the rays walk.
+	*/
+	void update(Model* model, BoardGrid* grid, vector<Camera *>& cameras);
+
+	//! Entry of the pixel (of the screen) and the sample of the view
+	Entry* at(int view, int x, int y, unsigned sample);
+
+	//! Removes all the entries
+	void clear() { objects_.clear(); views_.clear(); }
+
+	//! Entries invalidated by the last update
+	long long getInvalidated() { return invalidated_; }
+
+	//! Bounds of an object differing less are not a change (moving a piece back and forth leaves rounding errors)
+	static const double EPSILON;
+
+private:
+	//! State of the object the entries were traced with
+	struct ObjectState {
+		Vector3d cmin, cmax;
+		bool visible;
+		bool inGrid;
+		unsigned long long cells;	// cells of the grid listing the object
+	};
+
+	//! Entries of one view
+	struct View {
+		View() : samples(0) { }
+		Tile crop;					// pixels of the entries
+		unsigned samples;
+		vector<Entry> entries;
+	};
+
+	//! Returns true if the object did not change
+	static bool same(ObjectState& a, ObjectState& b);
+
+	vector<ObjectState> objects_;
+	vector<View> views_;
+	long long invalidated_;
+};
+
+const double ReflectionCache::EPSILON = 1e-9;
+
+inline bool ReflectionCache::Entry::matches(const Ray& ray, unsigned depth) const
+{
+	// the same camera gives exactly the same rays
+	const Point& s = ray.getStart();
+	const Vector3d& d = ray.getDir();
+	return valid && this->depth == depth &&
+		origin.x_ == s.x_ && origin.y_ == s.y_ && origin.z_ == s.z_ &&
+		direction.x_ == d.x_ && direction.y_ == d.y_ && direction.z_ == d.z_;
+}
+
+inline void ReflectionCache::Entry::store(const Ray& ray, unsigned depth, unsigned long long cells, Vector3d& color)
+{
+	origin = ray.getStart();
+	direction = ray.getDir();
+	this->depth = depth;
+	this->cells = cells;
+	this->color = color;
+	valid = true;
+}
+
+inline bool ReflectionCache::same(ObjectState& a, ObjectState& b)
+{
+	return a.visible == b.visible && a.inGrid == b.inGrid && a.cells == b.cells &&
+		fabs(a.cmin.x_ - b.cmin.x_) < EPSILON && fabs(a.cmin.y_ - b.cmin.y_) < EPSILON && fabs(a.cmin.z_ - b.cmin.z_) < EPSILON &&
+		fabs(a.cmax.x_ - b.cmax.x_) < EPSILON && fabs(a.cmax.y_ - b.cmax.y_) < EPSILON && fabs(a.cmax.z_ - b.cmax.z_) < EPSILON;
+}
+
+inline void ReflectionCache::update(Model* model, BoardGrid* grid, vector<Camera *>& cameras)
+{
+	vector<ObjectState> objects(model->objects_.size());
+	for(int i = 0; i < (int)objects.size(); i++) {
+		// a hidden object is never hit, wherever it is
+		ObjectState& s = objects.at(i);
+		s.visible = model->objects_.at(i).visible;
+		s.inGrid = !s.visible || grid->contains(i);
+		s.cells = s.visible ? grid->cellsOf(i) : 0;
+		if(s.visible)
+			model->objects_.at(i).getBounds(s.cmin, s.cmax);
+	}
+
+	// the cells the changed pieces left or entered
+	unsigned long long dirty = 0;
+	bool all = (objects.size() != objects_.size());
+	for(int i = 0; i < (int)objects.size() && !all; i++) {
+		if(same(objects.at(i), objects_.at(i)))
+			continue;
+		all = !objects.at(i).inGrid || !objects_.at(i).inGrid;
+		dirty |= objects.at(i).cells | objects_.at(i).cells;
+	}
+	objects_.swap(objects);
+
+	invalidated_ = 0;
+	views_.resize(cameras.size());
+	for(int v = 0; v < (int)cameras.size(); v++) {
+		View& view = views_.at(v);
+		Tile crop = cameras.at(v)->getCrop();
+		unsigned samples = cameras.at(v)->getSamplesPerPixel();
+		bool resized = crop.x != view.crop.x || crop.y != view.crop.y || crop.width != view.crop.width ||
+			crop.height != view.crop.height || samples != view.samples;
+
+		for(int i = 0; i < (int)view.entries.size(); i++) {
+			Entry& e = view.entries[i];
+			if(e.valid && (all || resized || (e.cells & dirty) != 0)) {
+				e.valid = false;
+				invalidated_++;
+			}
+		}
+
+		if(resized) {
+			view.crop = crop;
+			view.samples = samples;
+			view.entries.assign(crop.size() * samples, Entry());
+		}
+	}
+}
+
+inline ReflectionCache::Entry* ReflectionCache::at(int view, int x, int y, unsigned sample)
+{
+	View& v = views_.at(view);
+	return &v.entries[(sample * v.crop.height + y - v.crop.y) * v.crop.width + x - v.crop.x];
+}
+
+#endif
@@ -0,0 +1,406 @@
+#ifndef _RENDERSERVER_H_
+#define _RENDERSERVER_H_
+
+#include <string>
+#include <vector>
+#include <queue>
+#include <sstream>
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "Chess.h"
+#include "Material.h"
+#include "ReflectionCache.h"
+#include "LocalChannel.h"
+
+using namespace std;
+
+//! Render job of the server
+/*!
+	The job is sent as text lines, the lines starting with '@' are the keys,
+	the other lines are the contents of the last section:
+
+		@job
+		@priority 5					(optional, higher first, default 0)
+		@output diagram.png			(written by the server)
+		@board						(chessboard configuration file)
+		pawn_1_w A2
+		...
+		@render						(ray tracer configuration file - camera, light, materials, settings)
+		camera-position [...]
+		...
+		@end
+
+	Instead of the board and the render settings the job might carry the
+	compiled scene (see SceneDescription) as the given number of raw bytes
+	following the key:
+
+		@scene 1234
+		<bytes of the compiled scene>
+
+	The message "@shutdown" stops the server.
+*/
+struct RenderJob
+{
+	RenderJob() : id(0), priority(0), sequence(0) { }
+
+	//! Reads the job, false if the message is not a valid job
+	bool read(istream& is, string& error);
+
+	//! Writes the job as the message
+	void write(ostream& os) const;
+
+	//! Largest compiled scene accepted (they take a few KB), a larger size is refused before anything is allocated
+	static const size_t MAX_SCENE;
+
+	int id;						// number given by the server
+	int priority;				// jobs of higher priority are rendered first
+	unsigned long long sequence;// order of the arrival (the same priority is first come, first served)
+	string output;				// image file
+	string board;				// chessboard configuration
+	string settings;			// ray tracer configuration
+	string scene;				// compiled scene description, replaces the board and the settings
+	LocalConnection client;		// the result is reported to
+	chrono::steady_clock::time_point queued;	// time of the arrival
+};
+
+//! Priority queue of the render jobs of bounded capacity, shared by the threads
+class JobQueue
+{
+public:
+	JobQueue(size_t capacity) : capacity_(capacity), closed_(false), sequence_(0) { }
+
+	//! Adds the job, false if the queue is full or closed
+	bool push(RenderJob& job);
+
+	//! Waits for the job of the highest priority, false if the queue is closed and empty
+	bool pop(RenderJob& job);
+
+	//! Refuses the new jobs, the queued ones are still taken
+	void close();
+
+	size_t size();
+
+private:
+	//! Ordering of the heap - lower priority (or later arrival) is "less"
+	struct Later {
+		bool operator()(const RenderJob& a, const RenderJob& b) const {
+			return (a.priority != b.priority) ? a.priority < b.priority : a.sequence > b.sequence;
+		}
+	};
+
+	priority_queue<RenderJob, vector<RenderJob>, Later> jobs_;
+	size_t capacity_;
+	bool closed_;
+	unsigned long long sequence_;
+	mutex mutex_;
+	condition_variable ready_;
+};
+
+//! Worker of the server with its own copy of the model
+struct RenderWorker
+{
+	RenderWorker(string& modelFile) : chess(modelFile), proxyTriangles(0), lodLevels(0) { }
+
+	Chess chess;
+	Material whitePiece, blackPiece, whiteField, blackField;	// materials of the last job, the model points to them
+	unsigned proxyTriangles;	// triangles of the proxies created in the model, 0 - none
+	unsigned lodLevels;			// levels of detail created in the model, 0 - none
+	ReflectionCache reflections;	// reflections of the chessboard of the previous jobs
+	string reflectionSettings;	// compiled settings the reflections were traced with
+};
+
+//! Renders the job by the worker, false (and the error) if it fails
+typedef bool (*RenderFunction)(RenderWorker& worker, RenderJob& job, string& error);
+
+//! Long-running server rendering the jobs sent over the local channel
+/*!
+	The model is loaded once by each worker when the server starts. The jobs
+	wait in the priority queue (at most the capacity, further jobs are
+	refused) and the workers take them one by one. Each worker renders with
+	the threads given by the ray tracer configuration of the job.
+
+	The client gets "accepted <id>" when the job is queued and then either
+	"done <id> queued <ms> render <ms> total <ms>" or "error <id> <message>".
+*/
+class RenderServer
+{
+public:
+	RenderServer(string& modelFile, RenderFunction render, unsigned workers = 1, size_t capacity = DEFAULT_CAPACITY);
+	~RenderServer();
+
+	//! Serves the clients of the channel until the shutdown message, false if the channel cannot be opened
+	/*! The queued jobs are finished before it returns.
+	*/
+	bool run(const string& channel);
+
+	static const size_t DEFAULT_CAPACITY;
+
+	//! Milliseconds a client has to send the whole job, a slower (or stalled) one is dropped
+	static const unsigned CLIENT_TIMEOUT;
+
+private:
+	// owns the workers - not copyable
+	RenderServer(const RenderServer&);
+	RenderServer& operator=(const RenderServer&);
+
+	//! Reads the message of the client, returns false on shutdown
+	bool serve(LocalConnection& client);
+
+	//! Renders the jobs of the queue until it is closed
+	void work(RenderWorker* worker);
+
+	void log(const string& message);
+
+	RenderFunction render_;
+	vector<RenderWorker *> workers_;
+	JobQueue queue_;
+	int jobs_;					// jobs accepted so far
+	mutex logMutex_;
+};
+
+const size_t RenderJob::MAX_SCENE = 1024 * 1024;
+const size_t RenderServer::DEFAULT_CAPACITY = 64;
+const unsigned RenderServer::CLIENT_TIMEOUT = 5000;
+
+inline bool RenderJob::read(istream& is, string& error)
+{
+	string line;
+	string* section = NULL;
+	bool started = false;
+
+	while(getline(is, line)) {
+		if(!line.empty() && line[line.size() - 1] == '\r')
+			line.erase(line.size() - 1);
+
+		if(line.empty() || line[0] != '@') {
+			if(section != NULL)
+				*section += line + "\n";
+			continue;
+		}
+
+		istringstream key(line.substr(1));
+		string name;
+		key >> name;
+		if(name == "job")				started = true;
+		else if(name == "priority")		key >> priority;
+		else if(name == "output")		getline(key >> ws, output);
+		else if(name == "board")		section = &board;
+		else if(name == "render")		section = &settings;
+		else if(name == "scene") {
+			size_t bytes = 0;
+			key >> bytes;
+			if(key.fail() || bytes > MAX_SCENE) {
+				error = "scene too large";
+				return false;
+			}
+			scene.resize(bytes);
+			if(bytes > 0 && !is.read(&scene[0], bytes)) {
+				error = "incomplete scene";
+				return false;
+			}
+			section = NULL;
+		}
+		else if(name == "end")			break;
+		else {
+			error = "unknown key " + line;
+			return false;
+		}
+	}
+
+	if(!started)			error = "not a job";
+	else if(output.empty())	error = "no output";
+	else if(settings.empty() && scene.empty())	error = "no render settings";
+	else					return true;
+	return false;
+}
+
+inline void RenderJob::write(ostream& os) const
+{
+	os << "@job\n" << "@priority " << priority << "\n" << "@output " << output << "\n";
+	if(!scene.empty()) {
+		os << "@scene " << scene.size() << "\n" << scene << "\n@end\n";
+		return;
+	}
+	os << "@board\n" << board;
+	if(!board.empty() && board[board.size() - 1] != '\n')
+		os << "\n";
+	os << "@render\n" << settings;
+	if(!settings.empty() && settings[settings.size() - 1] != '\n')
+		os << "\n";
+	os << "@end\n";
+}
+
+inline bool JobQueue::push(RenderJob& job)
+{
+	lock_guard<mutex> lock(mutex_);
+	if(closed_ || jobs_.size() >= capacity_)
+		return false;
+
+	job.sequence = sequence_++;
+	jobs_.push(job);
+	ready_.notify_one();
+	return true;
+}
+
+inline bool JobQueue::pop(RenderJob& job)
+{
+	unique_lock<mutex> lock(mutex_);
+	while(jobs_.empty() && !closed_)
+		ready_.wait(lock);
+	if(jobs_.empty())
+		return false;
+
+	job = jobs_.top();
+	jobs_.pop();
+	return true;
+}
+
+inline void JobQueue::close()
+{
+	lock_guard<mutex> lock(mutex_);
+	closed_ = true;
+	ready_.notify_all();
+}
+
+inline size_t JobQueue::size()
+{
+	lock_guard<mutex> lock(mutex_);
+	return jobs_.size();
+}
+
+inline RenderServer::RenderServer(string& modelFile, RenderFunction render, unsigned workers, size_t capacity) :
+	render_(render), queue_(capacity), jobs_(0)
+{
+	for(unsigned i = 0; i < max(workers, 1u); i++)
+		workers_.push_back(new RenderWorker(modelFile));
+}
+
+inline RenderServer::~RenderServer()
+{
+	for(int i = 0; i < (int)workers_.size(); i++)
+		delete workers_.at(i);
+}
+
+inline bool RenderServer::run(const string& channel)
+{
+	LocalListener listener;
+	if(!listener.open(channel))
+		return false;
+
+	vector<thread> pool;
+	for(int i = 0; i < (int)workers_.size(); i++)
+		pool.push_back(thread(&RenderServer::work, this, workers_.at(i)));
+	log("Serving " + channel);
+
+	// the clients are served one by one, each has a limited time to send the job
+	LocalConnection client;
+	while(listener.accept(client) && serve(client))
+		;
+
+	queue_.close();
+	for(int i = 0; i < (int)pool.size(); i++)
+		pool.at(i).join();
+	log("Server stopped");
+	return true;
+}
+
+inline bool RenderServer::serve(LocalConnection& client)
+{
+	string line, message;
+	chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::milliseconds(CLIENT_TIMEOUT);
+	bool complete = false;
+	client.setTimeout(CLIENT_TIMEOUT);
+	while(chrono::steady_clock::now() < deadline && client.readLine(line)) {
+		message += line + "\n";
+		if(line == "@end" || line == "@shutdown") {
+			complete = true;
+			break;
+		}
+
+		// the raw bytes of the compiled scene follow its key
+		unsigned long bytes = 0;
+		if(sscanf(line.c_str(), "@scene %lu", &bytes) == 1 && bytes > 0) {
+			if(bytes > RenderJob::MAX_SCENE) {
+				client.write("error 0 scene too large\n");
+				client.close();
+				return true;
+			}
+			string scene(bytes, '\0');
+			if(!client.read(&scene[0], bytes))
+				break;
+			message += scene;
+		}
+	}
+
+	if(line == "@shutdown") {
+		client.write("stopping\n");
+		client.close();
+		return false;
+	}
+
+	// the client stalled or left in the middle of the job
+	if(!complete) {
+		log("Client dropped (incomplete job)");
+		client.write("error 0 incomplete job\n");
+		client.close();
+		return true;
+	}
+
+	RenderJob job;
+	string error;
+	istringstream is(message);
+	if(!job.read(is, error)) {
+		client.write("error 0 " + error + "\n");
+		client.close();
+		return true;
+	}
+
+	job.id = ++jobs_;
+	job.client = client;
+	job.queued = chrono::steady_clock::now();
+	ostringstream reply;
+	if(!queue_.push(job)) {
+		reply << "error " << job.id << " queue full\n";
+		client.write(reply.str());
+		client.close();
+		return true;
+	}
+	reply << "accepted " << job.id << "\n";
+	client.write(reply.str());
+	return true;
+}
+
+inline void RenderServer::work(RenderWorker* worker)
+{
+	RenderJob job;
+	while(queue_.pop(job)) {
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		string error;
+		bool rendered = render_(*worker, job, error);
+		chrono::steady_clock::time_point end = chrono::steady_clock::now();
+
+		ostringstream reply;
+		if(rendered) {
+			reply << "done " << job.id
+				  << " queued " << chrono::duration_cast<chrono::milliseconds>(start - job.queued).count()
+				  << " render " << chrono::duration_cast<chrono::milliseconds>(end - start).count()
+				  << " total " << chrono::duration_cast<chrono::milliseconds>(end - job.queued).count();
+		} else {
+			reply << "error " << job.id << " " << error;
+		}
+		log(reply.str() + " (" + job.output + ")");
+		job.client.write(reply.str() + "\n");
+		job.client.close();
+	}
+}
+
+inline void RenderServer::log(const string& message)
+{
+	lock_guard<mutex> lock(logMutex_);
+	cout << message << endl;
+}
+
+#endif
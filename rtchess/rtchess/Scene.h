@@ -2,13 +2,18 @@
 #define _SCENE_H_
 
 #include <string>
+#include <vector>
 #include <fstream>
+#include <iomanip>
+#include <cstdio>
 
 #include "Camera.h"
 #include "Vector3d.h"
 #include "RayTracer.h"
 #include "Model.h"
 #include "Light.h"
+#include "ImageWriter.h"
+#include "TileFarm.h"
 
 using namespace std;
 
@@ -23,19 +28,23 @@ public:
 	Scene(string& modelFile) 
 	{ 				
 		model_ = new ModelGeneral(modelFile);
+		ownsModel_ = true;
 		init(DEFALUT_CAMERA, DEFAULT_LIGHT);
 	}
 
 	Scene(Camera& camera, Light& light, string& fileName)
 	{ 		
 		model_ = new ModelGeneral(fileName);
+		ownsModel_ = true;
 		init(camera, light);		
 	}		
 
+	//! The model stays owned by the caller
 	Scene(Model *model) 
 	{ 
 		assert(model != NULL);
 		model_ = model;
+		ownsModel_ = false;
 		init(DEFALUT_CAMERA, DEFAULT_LIGHT);
 	}
 
@@ -43,21 +52,28 @@ public:
 	{ 
 		assert(model != NULL);
 		model_ = model;
+		ownsModel_ = false;
 		init(camera, light);	
 	}
 	
 	//! Destructor
 	~Scene(void) 
 	{
-		delete model_;
+		if(ownsModel_)
+			delete model_;
 		delete rayTracer;
 		delete[] image;
+		for(int i = 0; i < (int)views_.size(); i++) {
+			delete views_.at(i).camera;
+			delete[] views_.at(i).image;
+		}
+		for(int i = 0; i < (int)lightMaterials_.size(); i++)
+			delete lightMaterials_.at(i);
 	}	
 
 	void setCameraLocation(Vector3d position, Vector3d direction) 
 	{
-		rayTracer->camera_->setPosition(position);
-		rayTracer->camera_->setDirection(direction);
+		rayTracer->camera_->setLocation(position, direction);
 	}
 
 	void setCameraResolution(unsigned screenWidth, unsigned screenHeight)
@@ -69,6 +85,17 @@ public:
 	{
 		rayTracer->camera_->setFieldOfView(horizontalAngle);	
 	}
+
+	void setCameraJitter(Camera::JitterPattern pattern, unsigned samplesPerPixel)
+	{
+		rayTracer->camera_->setJitter(pattern, samplesPerPixel);
+	}
+
+	//! Renders only the rectangle of the screen of the main camera, the image has its size
+	void setCameraCrop(int x, int y, int width, int height)
+	{
+		rayTracer->camera_->setCrop(Tile(x, y, width, height));
+	}
 	
 	void setLightPosition(Vector3d position)
 	{
@@ -80,50 +107,417 @@ public:
 		rayTracer->light_->radius_ = radius;
 	}
 
+	//! Adds another light (fill, rim...), range 0 means no distance falloff
+	void addLight(Point position, Vector3d color, double intensity, double radius, double range);
+
+	//! Lights contributing less than the threshold at a point cast no shadow rays there
+	void setLightThreshold(double threshold) { rayTracer->setLightThreshold(threshold); }
+
+	//! A transparent surface traces only its dominant ray if the other one contributes less than the threshold to the pixel
+	void setFresnelThreshold(double threshold) { rayTracer->setFresnelThreshold(threshold); }
+
+	//! Shadow rays of the area light (light with radius > 0) in the penumbra and the probes deciding it
+	void setShadowSampling(unsigned samples, unsigned probes) { rayTracer->setShadowSampling(samples, probes); }
+
 	void setRecursionDepth(int depth) { rayTracer->setDepth(depth); }
 	void setBackgroundColor(Vector3d color) { rayTracer->setBackgroundColor(color); }
+	void setRasterizePrimary(bool rasterize) { rayTracer->setRasterizePrimary(rasterize); }
+
+	//! Decimates each object of the model to at most the given number of triangles for the proxy rays
+	void createProxies(unsigned targetTriangles) { model_->createProxies(targetTriangles); }
+
+	//! Traces the shadow rays and the secondary rays of the given bounce and deeper against the proxies
+	void setProxies(bool shadows, unsigned bounce) { rayTracer->setProxies(shadows, bounce); proxyShadows_ = shadows; proxyBounce_ = bounce; }
+
+	//! Creates the chains of the levels of detail (each level halves the triangles of the previous one)
+	void createLods(unsigned levels) { model_->createLods(levels); }
+
+	//! Renders each object in the level of detail given by its projected size, 0 renders the full shapes
+	void setLod(double pixelsPerTriangle) { rayTracer->setLod(pixelsPerTriangle); lodPixels_ = pixelsPerTriangle; }
 
-	//! Main rendering function
+	//! Finds the pieces by walking the rays through the fields of the board grid
+	void setBoardGrid(bool enabled) { rayTracer->setBoardGrid(enabled); }
+
+	//! The bounding volume hierarchy refitted by the moves is built again once its SAH cost grows by this ratio
+	void setBvhRebuild(double ratio) { model_->getBvh().setRebuildRatio(ratio); }
+
+	//! Reuses the reflections of the chessboard kept in the cache (owned by the caller) since the previous renderings
+	void setReflectionCache(ReflectionCache* cache) { rayTracer->setReflectionCache(cache); }
+	void setThreads(unsigned threads) { rayTracer->setThreads(threads); }
+	void setOutputFormat(OutputFormat format) { outputFormat_ = format; }
+
+	//! Enables the heatmap of the render cost, tile mode averages the cost over the tiles
+	void setHeatmap(Heatmap::Metric metric, bool tiles) { rayTracer->setHeatmap(metric); heatmapTiles_ = tiles; }
+
+	//! Adds another view of the scene, rendered together with the main camera.
+	/*! The view takes over the resolution, field of view and sampling the main 
+		camera has at the time of adding the view.
+	*/
+	void addView(Point position, Vector3d direction, string& outputFile);
+
+	int getViewsCount() { return (int)views_.size(); }
+
+	//! Main rendering function, renders the main camera and all added views
 	void render();
 
-	//! Save rendered image to .PNG file
-	void saveImage(string& fileName);
+	//! Renders the scene and writes finished rows directly to the output files
+	/*! Rows of all views are streamed to the files (PPM or PNG) as they are 
+		rendered, the images are not kept in memory.
+		@return false if an output file cannot be opened (nothing is rendered)
+	*/
+	bool renderStreaming(string& fileName);
+
+	//! Renders the main camera by the workers connected to the port (see TileCoordinator)
+	/*! The workers render the same scene (rtchess -worker), the views are not rendered.
+		@return false if the port cannot be opened
+	*/
+	bool renderDistributed(unsigned short port, int tilesPerRange = TileCoordinator::DEFAULT_TILES_PER_RANGE, unsigned timeout = TileCoordinator::DEFAULT_TIMEOUT);
+
+	//! Renders the tiles of the main camera given by the coordinator at the address ("host:port") until it is done
+	bool renderWorker(string& address) { return TileWorker::run(address, *rayTracer); }
+
+	//! Estimates the counters of the rendering of the main camera and the views without tracing (see RayTracer::estimate)
+	RenderStats estimate();
+
+	//! Save rendered image to .PNG, .PPM or .RAW file
+	/*! @return false if the file cannot be written
+	*/
+	bool saveImage(string& fileName);
+
+	//! Saves the images of all added views to their output files
+	/*! @return false if a file cannot be written (its name is in failedFile), the other views are saved
+	*/
+	bool saveViews(string& failedFile);
+
+	//! Statistics of the last rendering (including the time of saving the images)
+	RenderStats& getStats() { return rayTracer->getStats(); }
+
+	//! Saves the statistics as JSON next to the output image (output.png -> output.stats.json)
+	void saveStats(string& imageFile);
+
+	//! Saves the heatmaps of the main camera and all views next to their images (output.png -> output.heatmap.png)
+	void saveHeatmaps(string& imageFile);
+
+	//! Compares the last rendering of the main camera with the reference rendered without the approximations (proxies, levels of detail)
+	/*! Prints the times, ray counts and the error of the approximation, saves the reference
+		and the difference image next to the image (output.reference.png, output.diff.png).
+	*/
+	void compareWithReference(string& imageFile);
 
 private:	
+	//! Additional view of the scene
+	struct View {
+		Camera* camera;
+		Vector3d* image;
+		string outputFile;
+	};
+
 	RayTracer* rayTracer;	//!< ray tracer
 	Model* model_;			//!< loaded model (triangle model or spheres)
+	bool ownsModel_;		//!< the model was loaded by the scene (a given model is owned by the caller)
 	Vector3d *image;		//!< output image (matrix of RGB vectors)
+	vector<View> views_;	//!< additional views
+	vector<Material *> lightMaterials_;	//!< colors of the added lights
+	OutputFormat outputFormat_;	//!< bit depth, gamma and compression of the saved images
+	bool heatmapTiles_;			//!< heatmap averaged over the tiles
+	bool proxyShadows_;			//!< shadow rays traced against the proxies
+	unsigned proxyBounce_;		//!< bounce from which the secondary rays are traced against the proxies
+	double lodPixels_;			//!< projected pixels per triangle of the levels of detail
 
 	//! Initalizes teh object
 	void init(Camera camera, Light light)
 	{				
 		rayTracer = new RayTracer(camera, light, model_);
-		image = new Vector3d[camera.getScreenHeight() * camera.getScreenWidth()];		
+		image = NULL;
+		heatmapTiles_ = false;
+		proxyShadows_ = false;
+		proxyBounce_ = 0;
+		lodPixels_ = 0.0;
 	}		
+
+	//! Saves the image of the given camera to PPM or PNG file, returns false if the file cannot be opened
+	bool writeImage(string& fileName, Camera* camera, Vector3d* img);
+
+	//! Saves the heatmap of the given view (0 - main camera)
+	void writeHeatmap(string& imageFile, Camera* camera, int view);
+
+	//! Returns the name of the file next to the image (output.png, ".stats.json" -> output.stats.json)
+	static string siblingFile(string& imageFile, string suffix);
 };
 
+inline void Scene::addView(Point position, Vector3d direction, string& outputFile)
+{
+	View view;
+	view.camera = new Camera(*rayTracer->camera_);
+	view.camera->setLocation(position, direction);
+	view.camera->clearCrop();	// the crop window is a region of the main view
+	view.image = NULL;
+	view.outputFile = outputFile;
+	views_.push_back(view);
+}
+
+inline void Scene::addLight(Point position, Vector3d color, double intensity, double radius, double range)
+{
+	Material* material = new Material(DEFAULT_LIGHT_MATERIAL);
+	material->color = color;
+	lightMaterials_.push_back(material);
+
+	Light light(position, radius, material, intensity, range);
+	rayTracer->addLight(light);
+}
+
 inline void Scene::render()
 {
 	// DEBUG
 	cout << "Rendering scene... " << endl;
 
-	rayTracer->render(image);
+	vector<Camera *> cameras(1, rayTracer->camera_);
+	vector<Vector3d *> images;
+
+	// the resolution might have been changed since the last rendering
+	delete[] image;
+	image = new Vector3d[rayTracer->camera_->getImageHeight() * rayTracer->camera_->getImageWidth()];
+	images.push_back(image);
+
+	for(int i = 0; i < (int)views_.size(); i++) {
+		Camera* camera = views_.at(i).camera;
+		delete[] views_.at(i).image;
+		views_.at(i).image = new Vector3d[camera->getImageHeight() * camera->getImageWidth()];
+		cameras.push_back(camera);
+		images.push_back(views_.at(i).image);
+	}
+
+	rayTracer->render(cameras, images);
+}
+
+inline RenderStats Scene::estimate()
+{
+	vector<Camera *> cameras(1, rayTracer->camera_);
+	for(int i = 0; i < (int)views_.size(); i++)
+		cameras.push_back(views_.at(i).camera);
+	return rayTracer->estimate(cameras);
+}
+
+inline bool Scene::renderDistributed(unsigned short port, int tilesPerRange, unsigned timeout)
+{
+	// DEBUG
+	cout << "Rendering scene by the workers... " << endl;
+
+	Camera* camera = rayTracer->camera_;
+	delete[] image;
+	image = new Vector3d[camera->getImageHeight() * camera->getImageWidth()];
+
+	StopWatch total;
+	rayTracer->getStats().reset();
+	TileCoordinator coordinator(camera->getImageWidth(), camera->getImageHeight(), tilesPerRange, timeout);
+	bool rendered = coordinator.run(port, image);
+	rayTracer->getStats().totalTime = total.lap();
+	return rendered;
 }
 
-inline void Scene::saveImage(string &fileName)
+inline bool Scene::renderStreaming(string& fileName)
+{
+	// DEBUG
+	cout << "Rendering scene to file " << fileName << "... " << endl;
+
+	vector<Camera *> cameras(1, rayTracer->camera_);
+	vector<string> fileNames(1, fileName);
+	for(int i = 0; i < (int)views_.size(); i++) {
+		cameras.push_back(views_.at(i).camera);
+		fileNames.push_back(views_.at(i).outputFile);
+	}
+
+	vector<ImageWriter *> writers;
+	for(int i = 0; i < (int)cameras.size(); i++) {
+		writers.push_back(ImageWriter::create(fileNames.at(i), outputFormat_));
+		if(!writers.back()->open(fileNames.at(i), cameras.at(i)->getImageWidth(), cameras.at(i)->getImageHeight())) {
+			cerr << "ERROR: The file " << fileNames.at(i) << " cannot be opened." << endl;
+
+			// the files opened so far would keep just their headers
+			delete writers.back();
+			for(int j = 0; j < i; j++) {
+				writers.at(j)->close();
+				delete writers.at(j);
+				remove(fileNames.at(j).c_str());
+			}
+			return false;
+		}
+	}
+
+	rayTracer->render(cameras, writers);
+
+	for(int i = 0; i < (int)writers.size(); i++) {
+		writers.at(i)->close();
+		delete writers.at(i);
+	}
+	return true;
+}
+
+inline bool Scene::saveImage(string &fileName)
+{
+	return writeImage(fileName, rayTracer->camera_, image);
+}
+
+inline bool Scene::saveViews(string& failedFile)
+{
+	bool saved = true;
+	for(int i = 0; i < (int)views_.size(); i++)
+		if(!writeImage(views_.at(i).outputFile, views_.at(i).camera, views_.at(i).image) && saved) {
+			failedFile = views_.at(i).outputFile;
+			saved = false;
+		}
+	return saved;
+}
+
+inline bool Scene::writeImage(string& fileName, Camera* camera, Vector3d* img)
 {
 	// DEBUG
 	cout << "Saving rendered image to file " << fileName << endl;
 
-	// Save result to a PPM image
-	ofstream ofs(fileName, std::ios::out | std::ios::binary);
-	ofs << "P6\n" << rayTracer->camera_->getScreenWidth() << " " << rayTracer->camera_->getScreenHeight() << "\n255\n";
-	for (unsigned i = 0; i < rayTracer->camera_->getScreenWidth() * rayTracer->camera_->getScreenHeight(); i++) {
-		ofs <<	(unsigned char)(min(image[i].x_, 1.0) * 255) << 
-				(unsigned char)(min(image[i].y_, 1.0) * 255) << 
-				(unsigned char)(min(image[i].z_, 1.0) * 255);
+	StopWatch watch;
+
+	ImageWriter* writer = ImageWriter::create(fileName, outputFormat_);
+	if(!writer->open(fileName, camera->getImageWidth(), camera->getImageHeight())) {
+		cerr << "ERROR: The file " << fileName << " cannot be opened." << endl;
+		delete writer;
+		return false;
 	}
-	ofs.close();	
+	writer->writeRows(img, camera->getImageHeight());
+	writer->close();
+	delete writer;
+
+	rayTracer->getStats().outputTime += watch.lap();
+	return true;
+}
+
+inline string Scene::siblingFile(string& imageFile, string suffix)
+{
+	size_t idxExt = imageFile.find_last_of('.');
+	size_t idxDir = imageFile.find_last_of("/\\");
+	if(idxExt == string::npos || (idxDir != string::npos && idxExt < idxDir))
+		idxExt = imageFile.size();
+	return imageFile.substr(0, idxExt) + suffix;
+}
+
+inline void Scene::saveStats(string& imageFile)
+{
+	string fileName = siblingFile(imageFile, ".stats.json");
+
+	// DEBUG
+	cout << "Saving statistics to file " << fileName << endl;
+
+	if(!rayTracer->getStats().saveJson(fileName))
+		cerr << "ERROR: The file " << fileName << " cannot be opened." << endl;
+}
+
+inline void Scene::saveHeatmaps(string& imageFile)
+{
+	writeHeatmap(imageFile, rayTracer->camera_, 0);
+	for(int i = 0; i < (int)views_.size(); i++)
+		writeHeatmap(views_.at(i).outputFile, views_.at(i).camera, i + 1);
+}
+
+inline void Scene::writeHeatmap(string& imageFile, Camera* camera, int view)
+{
+	float* cost = rayTracer->getCost(view);
+	if(cost == NULL)
+		return;
+
+	// the heatmap has the format of the image (output.png -> output.heatmap.png)
+	size_t idxExt = imageFile.find_last_of('.');
+	string fileName = siblingFile(imageFile, ".heatmap") + ((idxExt != string::npos) ? imageFile.substr(idxExt) : string(".ppm"));
+
+	vector<Vector3d> colors;
+	int tileSize = heatmapTiles_ ? TileScheduler::TILE_SIZE : 1;
+	double scale = Heatmap::toColors(cost, camera->getImageWidth(), camera->getImageHeight(), tileSize, colors);
+
+	// DEBUG
+	cout << "Saving heatmap to file " << fileName << " (white = " << scale 
+		 << ((rayTracer->getHeatmap() == Heatmap::METRIC_TIME) ? " ns" : " tests") << " per pixel)" << endl;
+
+	OutputFormat format;
+	ImageWriter* writer = ImageWriter::create(fileName, format);
+	if(!writer->open(fileName, camera->getImageWidth(), camera->getImageHeight())) {
+		cerr << "ERROR: The file " << fileName << " cannot be opened." << endl;
+		delete writer;
+		return;
+	}
+	writer->writeRows(&colors[0], camera->getImageHeight());
+	writer->close();
+	delete writer;
+}
+
+inline void Scene::compareWithReference(string& imageFile)
+{
+	Camera* camera = rayTracer->camera_;
+	int count = camera->getImageWidth() * camera->getImageHeight();
+	if(image == NULL) {
+		cerr << "ERROR: Nothing to compare, the image was not rendered." << endl;
+		return;
+	}
+
+	vector<Vector3d> approximate(image, image + count);
+	RenderStats approximateStats = rayTracer->getStats();
+
+	// the reference without any approximation
+	bool shadows = proxyShadows_;
+	unsigned bounce = proxyBounce_;
+	double lodPixels = lodPixels_;
+	setProxies(false, 0);
+	setLod(0.0);
+	render();
+	setProxies(shadows, bounce);
+	setLod(lodPixels);
+	RenderStats& referenceStats = rayTracer->getStats();
+
+	// error of the colors clamped as in the saved images
+	double sumSquares = 0.0;
+	double maxError = 0.0;
+	int differing = 0;
+	vector<double> errors(count);
+	for(int i = 0; i < count; i++) {
+		double a[3] = { approximate.at(i).x_, approximate.at(i).y_, approximate.at(i).z_ };
+		double r[3] = { image[i].x_, image[i].y_, image[i].z_ };
+		double error = 0.0;
+		bool differs = false;
+		for(int c = 0; c < 3; c++) {
+			double ac = max(0.0, min(1.0, a[c]));
+			double rc = max(0.0, min(1.0, r[c]));
+			sumSquares += (ac - rc) * (ac - rc);
+			error = max(error, fabs(ac - rc));
+			differs = differs || ((int)(ac * 255.0 + 0.5) != (int)(rc * 255.0 + 0.5));
+		}
+		errors.at(i) = error;
+		maxError = max(maxError, error);
+		if(differs)
+			differing++;
+	}
+
+	cout << endl << setw(12) << left << "" << setw(10) << right << "seconds" << setw(14) << "shadow rays" 
+		 << setw(16) << "triangle tests" << endl;
+	cout << setw(12) << left << "approximate" << right << fixed << setprecision(3) << setw(10) << approximateStats.totalTime 
+		 << setw(14) << approximateStats.shadowRays << setw(16) << approximateStats.triangleTests << endl;
+	cout << setw(12) << left << "reference" << right << setw(10) << referenceStats.totalTime
+		 << setw(14) << referenceStats.shadowRays << setw(16) << referenceStats.triangleTests << endl;
+	cout << "speedup " << setprecision(2) << ((approximateStats.totalTime > 0.0) ? referenceStats.totalTime / approximateStats.totalTime : 0.0)
+		 << ", RMSE " << setprecision(5) << sqrt(sumSquares / (3.0 * count)) << ", max error " << maxError 
+		 << ", differing pixels " << setprecision(2) << (100.0 * differing / count) << " %" << endl;
+	cout.unsetf(ios::floatfield);
+
+	// the reference and the difference have the format of the image
+	size_t idxExt = imageFile.find_last_of('.');
+	string ext = (idxExt != string::npos) ? imageFile.substr(idxExt) : string(".ppm");
+	string referenceFile = siblingFile(imageFile, ".reference") + ext;
+	writeImage(referenceFile, camera, image);
+
+	vector<Vector3d> colors(count);
+	for(int i = 0; i < count; i++)
+		colors.at(i) = Heatmap::ramp((maxError > 0.0) ? errors.at(i) / maxError : 0.0);
+	string diffFile = siblingFile(imageFile, ".diff") + ext;
+	writeImage(diffFile, camera, &colors[0]);
+
+	// the approximate image stays the result of the scene
+	copy(approximate.begin(), approximate.end(), image);
 }
 
 #endif
\ No newline at end of file
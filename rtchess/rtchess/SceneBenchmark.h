@@ -0,0 +1,292 @@
+#ifndef _SCENEBENCHMARK_H_
+#define _SCENEBENCHMARK_H_
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+
+#include "Chess.h"
+#include "RayTracer.h"
+#include "Material.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+
+//! Class implementing the end-to-end benchmark of the renderer
+/*!
+	Renders a fixed set of canonical scenes (board positions, materials and
+	recursion depths) at each of the given resolutions and thread counts. For
+	each run the wall time of the rendering, Mrays/s, peak resident memory of
+	the process and the scaling efficiency (compared to the run with the
+	lowest number of threads) are recorded.
+
+	Camera, light, background and the renderer settings are taken from the
+	ray tracer configuration, so a benchmark of a new build is comparable
+	with the old one as long as the configuration is the same.
+*/
+class SceneBenchmark
+{
+public:
+	//! Materials of a canonical scene
+	enum Materials {
+		MATERIALS_CONFIGURED,
+		MATERIALS_REFLECTIVE,	// high-reflectivity pieces and board
+		MATERIALS_GLASS			// glass pieces on the configured board
+	};
+
+	//! Canonical scene
+	struct Case {
+		const char* name;
+		const char* position;	// positions of the pieces (format of the chessboard configuration)
+		unsigned depth;			// recursion depth
+		Materials materials;
+	};
+
+	//! Result of one rendering
+	struct Run {
+		string scene;
+		int width;
+		int height;
+		unsigned threads;
+		double seconds;			// wall time of the rendering
+		long long rays;
+		double mraysPerSecond;
+		double peakRssMB;		// peak resident memory of the process so far
+		double efficiency;		// speedup over the lowest thread count divided by the thread ratio
+	};
+
+	SceneBenchmark(Chess& chess, Camera& camera, Light& light, Vector3d bgrdColor) :
+		chess_(chess), camera_(camera), light_(light), bgrdColor_(bgrdColor), rasterizePrimary_(false),
+		shadowSamples_(16), shadowProbes_(4) { }
+	~SceneBenchmark() { }
+
+	//! Materials of the regular scenes (the board of the glass ones)
+	void setMaterials(Material* wPiece, Material* bPiece, Material* wField, Material* bField);
+
+	void setRasterizePrimary(bool rasterize) { rasterizePrimary_ = rasterize; }
+	void setShadowSampling(unsigned samples, unsigned probes) { shadowSamples_ = samples; shadowProbes_ = probes; }
+
+	void addResolution(int width, int height) { resolutions_.push_back(make_pair(width, height)); }
+
+	//! Adds a thread count, 0 stands for all hardware threads
+	void addThreads(unsigned threads);
+
+	//! Renders all the scenes at all resolutions and thread counts
+	void run();
+
+	void print(ostream& os);
+	void writeJson(ostream& os);
+
+	//! Returns the peak resident memory of the process in bytes (0 if unknown)
+	static size_t peakRss();
+
+	static const Case CASES[];
+	static const int CASES_COUNT;
+
+private:
+	Chess& chess_;
+	Camera camera_;
+	Light light_;
+	Vector3d bgrdColor_;
+	bool rasterizePrimary_;
+	unsigned shadowSamples_;
+	unsigned shadowProbes_;
+	Material* materials_[4];
+	vector<pair<int, int> > resolutions_;
+	vector<unsigned> threads_;
+	vector<Run> runs_;
+
+	//! Prints one row of the results table
+	void print(ostream& os, int run);
+};
+
+const SceneBenchmark::Case SceneBenchmark::CASES[] = {
+	// starting position
+	{ "start",
+	  "pawn_1_w A2\npawn_2_w B2\npawn_3_w C2\npawn_4_w D2\npawn_5_w E2\npawn_6_w F2\npawn_7_w G2\npawn_8_w H2\n"
+	  "rook_1_w A1\nknight_1_w B1\nbishop_1_w C1\nqueen_w D1\nking_w E1\nbishop_2_w F1\nknight_2_w G1\nrook_2_w H1\n"
+	  "pawn_1_b H7\npawn_2_b G7\npawn_3_b F7\npawn_4_b E7\npawn_5_b D7\npawn_6_b C7\npawn_7_b B7\npawn_8_b A7\n"
+	  "rook_1_b H8\nknight_1_b G8\nbishop_1_b F8\nking_b E8\nqueen_b D8\nbishop_2_b C8\nknight_2_b B8\nrook_2_b A8\n",
+	  5, MATERIALS_CONFIGURED },
+
+	// sparse rook endgame
+	{ "endgame",
+	  "king_w G1\nrook_1_w D1\npawn_6_w F2\npawn_7_w G3\npawn_8_w H2\n"
+	  "king_b G8\nrook_1_b C8\npawn_3_b F7\npawn_2_b G7\npawn_1_b H6\n",
+	  5, MATERIALS_CONFIGURED },
+
+	// cluttered middlegame (Italian game)
+	{ "middlegame",
+	  "pawn_1_w A2\npawn_2_w B2\npawn_3_w C3\npawn_4_w D3\npawn_5_w E4\npawn_6_w F2\npawn_7_w G2\npawn_8_w H3\n"
+	  "rook_1_w A1\nknight_1_w D2\nbishop_1_w G5\nqueen_w E2\nking_w G1\nbishop_2_w C4\nknight_2_w F3\nrook_2_w F1\n"
+	  "pawn_1_b H6\npawn_2_b G7\npawn_3_b F7\npawn_4_b E5\npawn_5_b D6\npawn_6_b C6\npawn_7_b B5\npawn_8_b A6\n"
+	  "rook_1_b F8\nknight_1_b F6\nbishop_1_b E7\nking_b G8\nqueen_b C7\nbishop_2_b E6\nknight_2_b D7\nrook_2_b A8\n",
+	  5, MATERIALS_CONFIGURED },
+
+	// mirror-like pieces and board
+	{ "reflective", NULL, 5, MATERIALS_REFLECTIVE },
+
+	// glass pieces (Fresnel reflection and refraction), compare with "start"
+	{ "glass", NULL, 5, MATERIALS_GLASS },
+
+	// recursion depth
+	{ "start-depth1", NULL, 1, MATERIALS_CONFIGURED },
+	{ "start-depth3", NULL, 3, MATERIALS_CONFIGURED },
+};
+
+const int SceneBenchmark::CASES_COUNT = sizeof(SceneBenchmark::CASES) / sizeof(SceneBenchmark::Case);
+
+inline void SceneBenchmark::setMaterials(Material* wPiece, Material* bPiece, Material* wField, Material* bField)
+{
+	materials_[0] = wPiece;
+	materials_[1] = bPiece;
+	materials_[2] = wField;
+	materials_[3] = bField;
+}
+
+inline void SceneBenchmark::addThreads(unsigned threads)
+{
+	if(threads == 0)
+		threads = TileScheduler::hardwareThreads();
+	if(find(threads_.begin(), threads_.end(), threads) == threads_.end())
+		threads_.push_back(threads);
+}
+
+inline size_t SceneBenchmark::peakRss()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	if(GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		return pmc.PeakWorkingSetSize;
+	return 0;
+#else
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#ifdef __APPLE__
+	return (size_t)usage.ru_maxrss;				// bytes
+#else
+	return (size_t)usage.ru_maxrss * 1024;		// kilobytes
+#endif
+#endif
+}
+
+inline void SceneBenchmark::run()
+{
+	Material reflectivePiece(Vector3d(0.9, 0.9, 0.9), 0.9, 0.0, 0.0, 64.0);
+	Material reflectiveField(Vector3d(0.8, 0.8, 0.8), 0.8, 0.0, 0.0, 64.0);
+	Material whiteGlass(Vector3d(0.95, 0.95, 0.95), 0.0, 0.9, 1.5, 64.0);
+	Material blackGlass(Vector3d(0.3, 0.3, 0.35), 0.0, 0.7, 1.5, 64.0);
+
+	sort(threads_.begin(), threads_.end());
+
+	for(int c = 0; c < CASES_COUNT; c++) {
+		const Case& scene = CASES[c];
+
+		// scenes without a position use the starting one
+		istringstream position(scene.position != NULL ? scene.position : CASES[0].position);
+		string error;
+		if(!chess_.configure(position, error)) {
+			cerr << "ERROR: scene " << scene.name << ", " << error << endl;
+			continue;
+		}
+
+		if(scene.materials == MATERIALS_REFLECTIVE) {
+			chess_.setWhitePieceMaterial(&reflectivePiece);
+			chess_.setBlackPieceMaterial(&reflectivePiece);
+			chess_.setWhiteFieldMaterial(&reflectiveField);
+			chess_.setBlackFieldMaterial(&reflectiveField);
+		} else if(scene.materials == MATERIALS_GLASS) {
+			chess_.setWhitePieceMaterial(&whiteGlass);
+			chess_.setBlackPieceMaterial(&blackGlass);
+			chess_.setWhiteFieldMaterial(materials_[2]);
+			chess_.setBlackFieldMaterial(materials_[3]);
+		} else {
+			chess_.setWhitePieceMaterial(materials_[0]);
+			chess_.setBlackPieceMaterial(materials_[1]);
+			chess_.setWhiteFieldMaterial(materials_[2]);
+			chess_.setBlackFieldMaterial(materials_[3]);
+		}
+
+		for(int r = 0; r < (int)resolutions_.size(); r++) {
+			double baseSeconds = 0.0;
+
+			for(int t = 0; t < (int)threads_.size(); t++) {
+				RayTracer rayTracer(camera_, light_, chess_.getModel(), scene.depth);
+				rayTracer.camera_->setResolution(resolutions_.at(r).first, resolutions_.at(r).second);
+				rayTracer.setBackgroundColor(bgrdColor_);
+				rayTracer.setRasterizePrimary(rasterizePrimary_);
+				rayTracer.setShadowSampling(shadowSamples_, shadowProbes_);
+				rayTracer.setThreads(threads_.at(t));
+
+				vector<Vector3d> image(resolutions_.at(r).first * resolutions_.at(r).second);
+				rayTracer.render(&image[0]);
+
+				RenderStats& stats = rayTracer.getStats();
+				Run result;
+				result.scene = scene.name;
+				result.width = resolutions_.at(r).first;
+				result.height = resolutions_.at(r).second;
+				result.threads = threads_.at(t);
+				result.seconds = stats.totalTime;
+				result.rays = stats.rays();
+				result.mraysPerSecond = (stats.totalTime > 0.0) ? stats.rays() / stats.totalTime / 1e6 : 0.0;
+				result.peakRssMB = peakRss() / (1024.0 * 1024.0);
+
+				if(t == 0)
+					baseSeconds = result.seconds;
+				result.efficiency = (result.seconds > 0.0) ?
+					(baseSeconds * threads_.at(0)) / (result.seconds * threads_.at(t)) : 0.0;
+
+				runs_.push_back(result);
+				cout << "\r";
+				print(cout, runs_.size() - 1);
+			}
+		}
+	}
+}
+
+inline void SceneBenchmark::print(ostream& os)
+{
+	os << setw(14) << left << "scene" << setw(12) << right << "resolution" << setw(9) << "threads"
+	   << setw(11) << "seconds" << setw(10) << "Mrays/s" << setw(12) << "peak MB" << setw(12) << "efficiency" << endl;
+	for(int i = 0; i < (int)runs_.size(); i++)
+		print(os, i);
+}
+
+inline void SceneBenchmark::print(ostream& os, int run)
+{
+	Run& r = runs_.at(run);
+	ostringstream resolution;
+	resolution << r.width << "x" << r.height;
+	os << setw(14) << left << r.scene << setw(12) << right << resolution.str() << setw(9) << r.threads
+	   << fixed << setprecision(3) << setw(11) << r.seconds << setw(10) << r.mraysPerSecond
+	   << setprecision(1) << setw(12) << r.peakRssMB << setprecision(3) << setw(12) << r.efficiency << endl;
+	os.unsetf(ios::floatfield);
+}
+
+inline void SceneBenchmark::writeJson(ostream& os)
+{
+	os << "{\n  \"runs\": [\n";
+	for(int i = 0; i < (int)runs_.size(); i++) {
+		Run& r = runs_.at(i);
+		os << "    { \"scene\": \"" << r.scene << "\", \"width\": " << r.width << ", \"height\": " << r.height
+		   << ", \"threads\": " << r.threads << ", \"seconds\": " << r.seconds << ", \"rays\": " << r.rays
+		   << ", \"mraysPerSecond\": " << r.mraysPerSecond << ", \"peakRssMB\": " << r.peakRssMB
+		   << ", \"efficiency\": " << r.efficiency << " }" << ((i + 1 < (int)runs_.size()) ? ",\n" : "\n");
+	}
+	os << "  ]\n}\n";
+}
+
+#endif
@@ -0,0 +1,682 @@
+#ifndef _SCENEDESCRIPTION_H_
+#define _SCENEDESCRIPTION_H_
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include "Vector3d.h"
+#include "Camera.h"
+#include "Light.h"
+#include "Chess.h"
+#include "Heatmap.h"
+#include "Bvh.h"
+#include "RayTracer.h"
+#include "ImageWriter.h"
+
+using namespace std;
+
+//! Additional view of the scene rendered to its own file
+struct ViewSettings
+{
+	ViewSettings(Point position, Vector3d direction, string outputFile) :
+		position(position), direction(direction), outputFile(outputFile) { }
+	Point position;
+	Vector3d direction;
+	string outputFile;
+};
+
+//! Additional light of the scene
+struct LightSettings
+{
+	LightSettings() : color(1.0, 1.0, 1.0), intensity(1.0), radius(0.0), range(0.0) { }
+	Point position;
+	Vector3d color;
+	double intensity;
+	double radius;
+	double range;
+};
+
+//! Settings of the renderer not related to the camera, light and materials
+struct RenderSettings
+{
+	RenderSettings() : rasterizePrimary(false), streaming(false), stats(false),
+		heatmap(Heatmap::METRIC_NONE), heatmapTiles(false), shadowSamples(16), shadowProbes(4), lightThreshold(0.0),
+		fresnelThreshold(RayTracer::DEFAULT_FRESNEL_THRESHOLD), proxyTriangles(0), proxyShadows(true), proxyBounce(0), lodLevels(0), lodPixels(2.0), boardGrid(true),
+		bvhRebuild(Bvh::DEFAULT_REBUILD_RATIO), reflectionCache(false), threads(0) { }
+	bool rasterizePrimary;		// solve primary visibility by rasterization
+	bool streaming;				// write finished rows directly to the output file
+	bool stats;					// save the render statistics next to the output file
+	Heatmap::Metric heatmap;	// cost shown by the heatmap saved next to the output file
+	bool heatmapTiles;			// heatmap averaged over the tiles
+	unsigned shadowSamples;		// shadow rays of the area light in the penumbra
+	unsigned shadowProbes;		// shadow rays of the area light deciding the penumbra
+	double lightThreshold;		// lights contributing less at a point are skipped
+	double fresnelThreshold;	// the weaker ray of a transparent surface contributing less to the pixel is not traced
+	vector<LightSettings> lights;	// lights added to the main one
+	unsigned proxyTriangles;	// triangles of the decimated proxies of the objects, 0 - no proxies
+	bool proxyShadows;			// shadow rays traced against the proxies
+	unsigned proxyBounce;		// secondary rays of this and deeper bounces traced against the proxies, 0 - none
+	unsigned lodLevels;			// levels of detail of the objects, 0 - full shapes only
+	double lodPixels;			// projected pixels per triangle picking the level of detail
+	bool boardGrid;				// rays walk the 8x8 grid of the board fields to find the pieces
+	double bvhRebuild;			// SAH cost growth of the refitted bounding volume hierarchy which triggers its rebuild
+	bool reflectionCache;		// reflections of the chessboard kept by the server workers between the jobs
+	unsigned threads;			// number of rendering threads, 0 - all hardware threads
+	vector<ViewSettings> views;	// additional views
+	OutputFormat format;		// bit depth, gamma and compression of the output images
+};
+
+//! Validated description of the scene - the board, the camera, the lights, the materials and the render settings
+/*!
+	The text configuration files are parsed (and checked) once, the keys must
+	match exactly and the values must be complete and in range, otherwise the
+	error names the line. The description can be saved compiled - a compact
+	binary file (native byte order, the same build reads it) which the batch
+	mode and the render server load without parsing:
+
+		"RTSC" <version> <board> <settings>
+*/
+struct SceneDescription
+{
+	SceneDescription();
+
+	//! Reads the ray tracer configuration (format of the configuration file), false and the error if it is not valid
+	bool readSettings(istream& config, string& error);
+
+	//! Reads the positions of the pieces (format of the chessboard configuration file), false and the error if it is not valid
+	bool readBoard(istream& config, string& error) { return Chess::readPlacements(config, board, error); }
+
+	//! Loads the configuration files, false and the error if they cannot be read or are not valid
+	bool loadSettings(const string& fileName, string& error);
+	bool loadBoard(const string& fileName, string& error);
+
+	//! Writes the compiled description
+	void write(ostream& os) const;
+
+	//! Writes the compiled settings only (without the board)
+	void writeSettings(ostream& os) const;
+
+	//! Reads the compiled description, false and the error if it is not valid
+	bool read(istream& is, string& error);
+
+	//! Saves (loads) the compiled description, false and the error if it fails
+	bool save(const string& fileName, string& error) const;
+	bool load(const string& fileName, string& error);
+
+	//! Returns true if the file is the compiled description
+	static bool isCompiled(const string& fileName);
+
+	//! Camera of the description (resolution, anti-aliasing, crop window)
+	Camera camera() const;
+
+	//! Main light of the description
+	Light light() const;
+
+	// camera
+	Point cameraPosition;
+	Vector3d cameraDirection;
+	int width;
+	int height;
+	double fov;
+	int samples;				// samples per pixel
+	Camera::JitterPattern jitter;	// pattern of more samples per pixel
+	Tile crop;					// empty - full screen
+
+	// main light
+	Point lightPosition;
+	double lightRadius;			// 0 - point light (hard shadows)
+	double lightIntensity;
+	double lightRange;
+
+	int depth;					// recursion depth of the rays
+	Vector3d bgrdColor;
+	Material whitePiece, blackPiece, whiteField, blackField;
+	RenderSettings settings;
+	vector<Chess::Placement> board;	// pieces not listed are removed from the chessboard
+
+	static const char MAGIC[];
+	static const unsigned VERSION;
+
+private:
+	//! Applies the value of the key, false if it is not valid (known is false for an unknown key)
+	bool readSetting(const string& key, const string& value, bool& known);
+
+	//! Checks the values which depend on each other
+	bool validate(string& error);
+
+	//! Parsers of the values, false if the whole value is not the expected one
+	static bool parseNumber(const string& value, double& number, double min = -INFINITY);
+	static bool parseInteger(const string& value, int& number, int min);
+	static bool parseCount(const string& value, unsigned& number, unsigned min);
+	static bool parseFlag(const string& value, bool& flag);
+	static bool parseVector(const string& value, Vector3d& vector);
+	static bool parseMaterial(const string& property, const string& value, Material& material, bool& known);
+
+	//! Reads the vector [x, y, z] from the stream
+	static bool parseVector(istream& is, Vector3d& vector);
+
+	//! Returns true if only whitespace is left in the stream
+	static bool atEnd(istream& is) { return !is.fail() && (is >> ws).eof(); }
+
+	// binary values
+	template<class T> static void writeValue(ostream& os, const T& value) { os.write((const char *)&value, sizeof(T)); }
+	template<class T> static bool readValue(istream& is, T& value) { return !is.read((char *)&value, sizeof(T)).fail(); }
+	static void writeVector(ostream& os, const Vector3d& vector);
+	static bool readVector(istream& is, Vector3d& vector);
+	static void writeString(ostream& os, const string& value);
+	static bool readString(istream& is, string& value);
+	static void writeMaterial(ostream& os, const Material& material);
+	static bool readMaterial(istream& is, Material& material);
+	bool readCompiledSettings(istream& is);
+};
+
+const char SceneDescription::MAGIC[] = "RTSC";
+const unsigned SceneDescription::VERSION = 2;
+
+inline SceneDescription::SceneDescription() :
+	cameraPosition(0.0, 0.0, 0.0), cameraDirection(0.0, 1.0, 0.0), width(0), height(0), fov(45.0), samples(1), jitter(Camera::JITTER_STRATIFIED),
+	lightPosition(0.0, 0.0, 0.0), lightRadius(0.0), lightIntensity(1.0), lightRange(0.0), depth(1), bgrdColor(0.0, 0.0, 0.0)
+{
+}
+
+inline bool SceneDescription::readSettings(istream& config, string& error)
+{
+	string line;
+	int lineNum = 0;
+	while(getline(config, line)) {
+		lineNum++;
+		istringstream is(line);
+		string key, value;
+		is >> key;
+		if(key.empty() || key[0] == '#') continue;	// commentary
+
+		// the value is the rest of the line (vectors have spaces)
+		getline(is >> ws, value);
+		value.erase(value.find_last_not_of(" \t\r") + 1);
+
+		bool known = true;
+		if(!readSetting(key, value, known)) {
+			ostringstream message;
+			message << "line " << lineNum << ": " << (known ? "wrong value of " + key + ": " + value : "unknown key " + key);
+			error = message.str();
+			return false;
+		}
+	}
+
+	return validate(error);
+}
+
+inline bool SceneDescription::readSetting(const string& key, const string& value, bool& known)
+{
+	RenderSettings& s = settings;
+
+	// camera
+	if(key == "camera-position")				return parseVector(value, cameraPosition);
+	if(key == "direction" || key == "camera-direction")	return parseVector(value, cameraDirection) && cameraDirection.length() > 0.0;
+	if(key == "width")							return parseInteger(value, width, 1);
+	if(key == "height")							return parseInteger(value, height, 1);
+	if(key == "fov")							return parseNumber(value, fov, 0.0) && fov > 0.0 && fov < 180.0;
+	if(key == "antialiasing")					return parseInteger(value, samples, 1);
+	if(key == "jitter") {
+		jitter = (value == "grid") ? Camera::JITTER_GRID : Camera::JITTER_STRATIFIED;
+		return value == "grid" || value == "stratified";
+	}
+	if(key == "crop") {
+		// crop x y width height (rectangle of the screen, in pixels)
+		istringstream is(value);
+		is >> crop.x >> crop.y >> crop.width >> crop.height;
+		return atEnd(is) && crop.x >= 0 && crop.y >= 0 && crop.width > 0 && crop.height > 0;
+	}
+
+	// lights
+	if(key == "light-position")					return parseVector(value, lightPosition);
+	if(key == "light-radius")					return parseNumber(value, lightRadius, 0.0);
+	if(key == "light-intensity")				return parseNumber(value, lightIntensity, 0.0);
+	if(key == "light-range")					return parseNumber(value, lightRange, 0.0);
+	if(key == "light-threshold")				return parseNumber(value, s.lightThreshold, 0.0);
+	if(key == "fresnel-threshold")				return parseNumber(value, s.fresnelThreshold, 0.0);
+	if(key == "shadow-samples")					return parseCount(value, s.shadowSamples, 1);
+	if(key == "shadow-probes")					return parseCount(value, s.shadowProbes, 1);
+	if(key == "light") {
+		// light [position] [color] intensity radius range
+		LightSettings added;
+		istringstream is(value);
+		if(!parseVector(is, added.position) || !parseVector(is, added.color))
+			return false;
+		is >> added.intensity >> added.radius >> added.range;
+		if(!atEnd(is) || added.intensity < 0.0 || added.radius < 0.0 || added.range < 0.0)
+			return false;
+		s.lights.push_back(added);
+		return true;
+	}
+
+	// ray tracer
+	if(key == "depth")							return parseInteger(value, depth, 0);
+	if(key == "bgrd-color")						return parseVector(value, bgrdColor);
+	if(key == "proxy-triangles")				return parseCount(value, s.proxyTriangles, 0);
+	if(key == "proxy-shadows")					return parseFlag(value, s.proxyShadows);
+	if(key == "proxy-bounce")					return parseCount(value, s.proxyBounce, 0);
+	if(key == "lod-levels")						return parseCount(value, s.lodLevels, 0);
+	if(key == "lod-pixels")						return parseNumber(value, s.lodPixels, 0.0) && s.lodPixels > 0.0;
+	if(key == "board-grid")						return parseFlag(value, s.boardGrid);
+	if(key == "bvh-rebuild")					return parseNumber(value, s.bvhRebuild, 1.0);
+	if(key == "reflection-cache")				return parseFlag(value, s.reflectionCache);
+	if(key == "primary-visibility") {
+		s.rasterizePrimary = (value == "raster");
+		return value == "raster" || value == "trace";
+	}
+	if(key == "threads")						return parseCount(value, s.threads, 0);
+	if(key == "streaming")						return parseFlag(value, s.streaming);
+	if(key == "stats")							return parseFlag(value, s.stats);
+	if(key == "heatmap-tiles")					return parseFlag(value, s.heatmapTiles);
+	if(key == "heatmap") {
+		if(value == "time")			s.heatmap = Heatmap::METRIC_TIME;
+		else if(value == "tests")	s.heatmap = Heatmap::METRIC_TESTS;
+		else if(value == "none")	s.heatmap = Heatmap::METRIC_NONE;
+		else						return false;
+		return true;
+	}
+
+	// output image
+	if(key == "output-bits")					return parseInteger(value, s.format.bits, 8) && (s.format.bits == 8 || s.format.bits == 16);
+	if(key == "gamma")							return parseNumber(value, s.format.gamma, 0.0) && s.format.gamma > 0.0;
+	if(key == "png-compression")				return parseInteger(value, s.format.compression, 0) && s.format.compression <= 9;
+	if(key == "view") {
+		// view output_file [position] [direction]
+		string outputFile;
+		Vector3d position, direction;
+		istringstream is(value);
+		is >> outputFile;
+		if(outputFile.empty() || !parseVector(is, position) || !parseVector(is, direction) || !atEnd(is) || direction.length() <= 0.0)
+			return false;
+		s.views.push_back(ViewSettings(position, direction, outputFile));
+		return true;
+	}
+
+	// materials
+	if(key.compare(0, 12, "white-piece-") == 0)	return parseMaterial(key.substr(12), value, whitePiece, known);
+	if(key.compare(0, 12, "black-piece-") == 0)	return parseMaterial(key.substr(12), value, blackPiece, known);
+	if(key.compare(0, 12, "white-field-") == 0)	return parseMaterial(key.substr(12), value, whiteField, known);
+	if(key.compare(0, 12, "black-field-") == 0)	return parseMaterial(key.substr(12), value, blackField, known);
+
+	known = false;
+	return false;
+}
+
+inline bool SceneDescription::validate(string& error)
+{
+	if(width <= 0 || height <= 0)
+		error = "no camera resolution (width, height)";
+	else if(crop.size() > 0 && (crop.x + crop.width > width || crop.y + crop.height > height))
+		error = "the crop window exceeds the screen";
+	else if(whitePiece.transparency > 0.0 && whitePiece.refractIdx <= 0.0)
+		error = "no refraction index of the transparent white-piece material";
+	else if(blackPiece.transparency > 0.0 && blackPiece.refractIdx <= 0.0)
+		error = "no refraction index of the transparent black-piece material";
+	else if(whiteField.transparency > 0.0 && whiteField.refractIdx <= 0.0)
+		error = "no refraction index of the transparent white-field material";
+	else if(blackField.transparency > 0.0 && blackField.refractIdx <= 0.0)
+		error = "no refraction index of the transparent black-field material";
+	else
+		return true;
+	return false;
+}
+
+inline bool SceneDescription::parseNumber(const string& value, double& number, double min)
+{
+	istringstream is(value);
+	double n;
+	is >> n;
+	if(!atEnd(is) || n < min)
+		return false;
+	number = n;
+	return true;
+}
+
+inline bool SceneDescription::parseInteger(const string& value, int& number, int min)
+{
+	istringstream is(value);
+	int n;
+	is >> n;
+	if(!atEnd(is) || n < min)
+		return false;
+	number = n;
+	return true;
+}
+
+inline bool SceneDescription::parseCount(const string& value, unsigned& number, unsigned min)
+{
+	int n;
+	if(!parseInteger(value, n, (int)min))
+		return false;
+	number = (unsigned)n;
+	return true;
+}
+
+inline bool SceneDescription::parseFlag(const string& value, bool& flag)
+{
+	flag = (value == "1");
+	return value == "0" || value == "1";
+}
+
+inline bool SceneDescription::parseVector(const string& value, Vector3d& vector)
+{
+	istringstream is(value);
+	return parseVector(is, vector) && atEnd(is);
+}
+
+inline bool SceneDescription::parseVector(istream& is, Vector3d& vector)
+{
+	// [x, y, z]
+	string inner;
+	is >> ws;
+	if(is.get() != '[' || !getline(is, inner, ']'))
+		return false;
+
+	for(int i = 0; i < (int)inner.size(); i++)
+		if(inner[i] == ',') inner[i] = ' ';
+	istringstream values(inner);
+	values >> vector.x_ >> vector.y_ >> vector.z_;
+	return atEnd(values);
+}
+
+inline bool SceneDescription::parseMaterial(const string& property, const string& value, Material& material, bool& known)
+{
+	if(property == "color")			return parseVector(value, material.color);
+	if(property == "reflectivity")	return parseNumber(value, material.reflection, 0.0) && material.reflection <= 1.0;
+	if(property == "shininess")		return parseNumber(value, material.shininess, 0.0);
+	if(property == "transparency")	return parseNumber(value, material.transparency, 0.0) && material.transparency <= 1.0;
+	if(property == "refraction-index")	return parseNumber(value, material.refractIdx, 0.0) && material.refractIdx > 0.0;
+	known = false;
+	return false;
+}
+
+inline bool SceneDescription::loadSettings(const string& fileName, string& error)
+{
+	ifstream file(fileName);
+	if(file.fail()) {
+		error = "The file " + fileName + " cannot be opened.";
+		return false;
+	}
+	if(!readSettings(file, error)) {
+		error = fileName + ", " + error;
+		return false;
+	}
+	return true;
+}
+
+inline bool SceneDescription::loadBoard(const string& fileName, string& error)
+{
+	ifstream file(fileName);
+	if(file.fail()) {
+		error = "The file " + fileName + " cannot be opened.";
+		return false;
+	}
+	if(!readBoard(file, error)) {
+		error = fileName + ", " + error;
+		return false;
+	}
+	return true;
+}
+
+inline Camera SceneDescription::camera() const
+{
+	Camera camera(cameraPosition, cameraDirection, width, height, fov);
+	camera.setJitter((samples > 1) ? jitter : Camera::JITTER_NONE, samples);
+	camera.setCrop(crop);
+	return camera;
+}
+
+inline Light SceneDescription::light() const
+{
+	Light light;
+	light.center_ = lightPosition;
+	light.radius_ = lightRadius;
+	light.intensity_ = lightIntensity;
+	light.range_ = lightRange;
+	return light;
+}
+
+inline void SceneDescription::write(ostream& os) const
+{
+	os.write(MAGIC, 4);
+	writeValue(os, VERSION);
+
+	writeValue(os, (unsigned)board.size());
+	for(int i = 0; i < (int)board.size(); i++) {
+		writeValue(os, (int)board.at(i).piece);
+		writeValue(os, board.at(i).field.x);
+		writeValue(os, board.at(i).field.y);
+	}
+
+	writeSettings(os);
+}
+
+inline void SceneDescription::writeSettings(ostream& os) const
+{
+	writeVector(os, cameraPosition);
+	writeVector(os, cameraDirection);
+	writeValue(os, width);
+	writeValue(os, height);
+	writeValue(os, fov);
+	writeValue(os, samples);
+	writeValue(os, (int)jitter);
+	writeValue(os, crop);
+
+	writeVector(os, lightPosition);
+	writeValue(os, lightRadius);
+	writeValue(os, lightIntensity);
+	writeValue(os, lightRange);
+
+	writeValue(os, depth);
+	writeVector(os, bgrdColor);
+	writeMaterial(os, whitePiece);
+	writeMaterial(os, blackPiece);
+	writeMaterial(os, whiteField);
+	writeMaterial(os, blackField);
+
+	const RenderSettings& s = settings;
+	writeValue(os, s.rasterizePrimary);
+	writeValue(os, s.streaming);
+	writeValue(os, s.stats);
+	writeValue(os, (int)s.heatmap);
+	writeValue(os, s.heatmapTiles);
+	writeValue(os, s.shadowSamples);
+	writeValue(os, s.shadowProbes);
+	writeValue(os, s.lightThreshold);
+	writeValue(os, s.fresnelThreshold);
+	writeValue(os, (unsigned)s.lights.size());
+	for(int i = 0; i < (int)s.lights.size(); i++) {
+		const LightSettings& light = s.lights.at(i);
+		writeVector(os, light.position);
+		writeVector(os, light.color);
+		writeValue(os, light.intensity);
+		writeValue(os, light.radius);
+		writeValue(os, light.range);
+	}
+	writeValue(os, s.proxyTriangles);
+	writeValue(os, s.proxyShadows);
+	writeValue(os, s.proxyBounce);
+	writeValue(os, s.lodLevels);
+	writeValue(os, s.lodPixels);
+	writeValue(os, s.boardGrid);
+	writeValue(os, s.bvhRebuild);
+	writeValue(os, s.reflectionCache);
+	writeValue(os, s.threads);
+	writeValue(os, (unsigned)s.views.size());
+	for(int i = 0; i < (int)s.views.size(); i++) {
+		writeVector(os, s.views.at(i).position);
+		writeVector(os, s.views.at(i).direction);
+		writeString(os, s.views.at(i).outputFile);
+	}
+	writeValue(os, s.format.bits);
+	writeValue(os, s.format.gamma);
+	writeValue(os, s.format.compression);
+}
+
+inline bool SceneDescription::read(istream& is, string& error)
+{
+	char magic[4];
+	unsigned version = 0;
+	if(!is.read(magic, 4) || string(magic, 4) != MAGIC || !readValue(is, version)) {
+		error = "not a compiled scene";
+		return false;
+	}
+	if(version != VERSION) {
+		error = "unsupported version of the compiled scene";
+		return false;
+	}
+
+	unsigned pieces = 0;
+	board.clear();
+	if(!readValue(is, pieces) || pieces > ModelChess::CHESS_PIECES_COUNT) {
+		error = "corrupted board of the compiled scene";
+		return false;
+	}
+	for(unsigned i = 0; i < pieces; i++) {
+		int piece = -1;
+		ModelChess::chessBoardCoords field(-1, -1);
+		if(!readValue(is, piece) || !readValue(is, field.x) || !readValue(is, field.y) ||
+		   !Chess::addPlacement(board, Chess::Placement((Chess::chessPieces)piece, field), error)) {
+			error = "corrupted board of the compiled scene";
+			return false;
+		}
+	}
+
+	if(!readCompiledSettings(is)) {
+		error = "corrupted settings of the compiled scene";
+		return false;
+	}
+	return validate(error);
+}
+
+inline bool SceneDescription::readCompiledSettings(istream& is)
+{
+	int jitterPattern, metric;
+	unsigned lights, views;
+	RenderSettings& s = settings;
+
+	bool ok = readVector(is, cameraPosition) && readVector(is, cameraDirection) && readValue(is, width) && readValue(is, height) &&
+		readValue(is, fov) && readValue(is, samples) && readValue(is, jitterPattern) && readValue(is, crop) &&
+		readVector(is, lightPosition) && readValue(is, lightRadius) && readValue(is, lightIntensity) && readValue(is, lightRange) &&
+		readValue(is, depth) && readVector(is, bgrdColor) && readMaterial(is, whitePiece) && readMaterial(is, blackPiece) &&
+		readMaterial(is, whiteField) && readMaterial(is, blackField) &&
+		readValue(is, s.rasterizePrimary) && readValue(is, s.streaming) && readValue(is, s.stats) && readValue(is, metric) &&
+		readValue(is, s.heatmapTiles) && readValue(is, s.shadowSamples) && readValue(is, s.shadowProbes) && readValue(is, s.lightThreshold) &&
+		readValue(is, s.fresnelThreshold) && readValue(is, lights) && lights < 1024;
+	if(!ok)
+		return false;
+
+	s.lights.resize(lights);
+	for(unsigned i = 0; i < lights && ok; i++) {
+		LightSettings& light = s.lights.at(i);
+		ok = readVector(is, light.position) && readVector(is, light.color) &&
+			readValue(is, light.intensity) && readValue(is, light.radius) && readValue(is, light.range);
+	}
+
+	ok = ok && readValue(is, s.proxyTriangles) && readValue(is, s.proxyShadows) && readValue(is, s.proxyBounce) &&
+		readValue(is, s.lodLevels) && readValue(is, s.lodPixels) && readValue(is, s.boardGrid) && readValue(is, s.bvhRebuild) &&
+		readValue(is, s.reflectionCache) && readValue(is, s.threads) && readValue(is, views) && views < 1024;
+	if(!ok)
+		return false;
+
+	s.views.clear();
+	for(unsigned i = 0; i < views && ok; i++) {
+		Vector3d position, direction;
+		string outputFile;
+		ok = readVector(is, position) && readVector(is, direction) && readString(is, outputFile);
+		s.views.push_back(ViewSettings(position, direction, outputFile));
+	}
+
+	ok = ok && readValue(is, s.format.bits) && readValue(is, s.format.gamma) && readValue(is, s.format.compression);
+	jitter = (Camera::JitterPattern)jitterPattern;
+	s.heatmap = (Heatmap::Metric)metric;
+	return ok && (jitter == Camera::JITTER_GRID || jitter == Camera::JITTER_STRATIFIED) &&
+		metric >= Heatmap::METRIC_NONE && metric <= Heatmap::METRIC_TESTS;
+}
+
+inline void SceneDescription::writeVector(ostream& os, const Vector3d& vector)
+{
+	// the components only (the layout of Vector3d depends on RTCHESS_SIMD)
+	writeValue(os, vector.x_);
+	writeValue(os, vector.y_);
+	writeValue(os, vector.z_);
+}
+
+inline bool SceneDescription::readVector(istream& is, Vector3d& vector)
+{
+	double x, y, z;
+	if(!readValue(is, x) || !readValue(is, y) || !readValue(is, z))
+		return false;
+	vector = Vector3d(x, y, z);
+	return true;
+}
+
+inline void SceneDescription::writeString(ostream& os, const string& value)
+{
+	writeValue(os, (unsigned)value.size());
+	os.write(value.data(), value.size());
+}
+
+inline bool SceneDescription::readString(istream& is, string& value)
+{
+	unsigned size;
+	if(!readValue(is, size) || size > 4096)
+		return false;
+	value.resize(size);
+	return size == 0 || !is.read(&value[0], size).fail();
+}
+
+inline void SceneDescription::writeMaterial(ostream& os, const Material& material)
+{
+	writeVector(os, material.color);
+	writeValue(os, material.reflection);
+	writeValue(os, material.transparency);
+	writeValue(os, material.refractIdx);
+	writeValue(os, material.shininess);
+}
+
+inline bool SceneDescription::readMaterial(istream& is, Material& material)
+{
+	return readVector(is, material.color) && readValue(is, material.reflection) && readValue(is, material.transparency) &&
+		readValue(is, material.refractIdx) && readValue(is, material.shininess);
+}
+
+inline bool SceneDescription::save(const string& fileName, string& error) const
+{
+	ofstream file(fileName, ios::binary);
+	if(file.fail()) {
+		error = "The file " + fileName + " cannot be opened.";
+		return false;
+	}
+	write(file);
+	if(file.fail()) {
+		error = "The file " + fileName + " cannot be written.";
+		return false;
+	}
+	return true;
+}
+
+inline bool SceneDescription::load(const string& fileName, string& error)
+{
+	ifstream file(fileName, ios::binary);
+	if(file.fail()) {
+		error = "The file " + fileName + " cannot be opened.";
+		return false;
+	}
+	if(!read(file, error)) {
+		error = fileName + ", " + error;
+		return false;
+	}
+	return true;
+}
+
+inline bool SceneDescription::isCompiled(const string& fileName)
+{
+	ifstream file(fileName, ios::binary);
+	char magic[4];
+	return file.read(magic, 4) && string(magic, 4) == MAGIC;
+}
+
+#endif
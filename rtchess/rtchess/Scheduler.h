@@ -0,0 +1,179 @@
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "Tile.h"
+#include "ImageWriter.h"
+
+using namespace std;
+
+//! Class implementing a shared queue of tiles rendered by a pool of threads
+/*!
+	Tiles of all views are put into one queue. Each thread takes the next
+	tile as soon as it finishes the previous one, so the threads stay busy
+	even if the cost of the views (or parts of the screen) differs.
+*/
+class TileScheduler
+{
+public:
+	//! Unit of work - one tile of one view
+	struct Task {
+		Task() : view(0) { }
+		Task(int view, Tile tile) : view(view), tile(tile) { }
+		int view;
+		Tile tile;
+	};
+
+	TileScheduler() : next_(0) { }
+	~TileScheduler() { }
+
+	//! Splits the screen of the view to tiles and appends them to the queue
+	void addView(int view, int width, int height, int tileSize = TILE_SIZE) { addView(view, Tile(0, 0, width, height), tileSize); }
+
+	//! Splits the rectangle of the screen of the view to tiles (starting at its top left corner) and appends them to the queue
+	void addView(int view, Tile area, int tileSize = TILE_SIZE);
+
+	//! Appends a single task to the queue
+	void addTask(Task& task) { tasks_.push_back(task); }
+
+	int size() { return (int)tasks_.size(); }
+
+	//! Task of the given index (in the order of adding)
+	Task& at(int i) { return tasks_.at(i); }
+
+	//! Takes the next task from the queue (thread safe).
+	/*! @return false if the queue is empty.
+	*/
+	bool next(Task& task);
+
+	//! Runs worker(threadIdx) in the given number of threads and waits for all of them.
+	/*! 0 threads stands for the number of hardware threads.
+	*/
+	template<typename Worker>
+	void run(unsigned threads, Worker worker);
+
+	static unsigned hardwareThreads();
+
+	static const int TILE_SIZE;
+
+private:
+	vector<Task> tasks_;
+	atomic<int> next_;
+};
+
+const int TileScheduler::TILE_SIZE = 32;
+
+inline void TileScheduler::addView(int view, Tile area, int tileSize)
+{
+	for(int y = area.y; y < area.y + area.height; y += tileSize)
+		for(int x = area.x; x < area.x + area.width; x += tileSize)
+			tasks_.push_back(Task(view, Tile(x, y, min(tileSize, area.x + area.width - x), min(tileSize, area.y + area.height - y))));
+}
+
+inline bool TileScheduler::next(Task& task)
+{
+	int i = next_++;
+	if(i >= (int)tasks_.size())
+		return false;
+
+	task = tasks_[i];
+	return true;
+}
+
+inline unsigned TileScheduler::hardwareThreads()
+{
+	unsigned n = thread::hardware_concurrency();
+	return (n > 0) ? n : 1;
+}
+
+template<typename Worker>
+inline void TileScheduler::run(unsigned threads, Worker worker)
+{
+	if(threads == 0)
+		threads = hardwareThreads();
+
+	vector<thread> pool;
+	for(unsigned i = 1; i < threads; i++)
+		pool.push_back(thread(worker, i));
+
+	// the calling thread works as well
+	worker(0);
+
+	for(int i = 0; i < (int)pool.size(); i++)
+		pool.at(i).join();
+}
+
+//! Class implementing a window of bands of rows streamed to the output file
+/*!
+	The screen is divided into horizontal bands of TILE_SIZE rows, the tiles 
+	of the view must be queued in the band order. Only a window of bands is kept
+	in memory - a thread rendering a tile beyond the window waits until the
+	oldest band is finished. Finished bands are written in the order of rows.
+*/
+class BandWindow
+{
+public:
+	BandWindow(ImageWriter* writer, int width, int height, int window, int bandHeight = TileScheduler::TILE_SIZE);
+	~BandWindow() { }
+
+	//! Waits until the band fits into the window.
+	/*! @return buffer of the band, its first row is the first row of the band.
+	*/
+	Vector3d* acquire(int band);
+
+	//! Marks one tile of the band as finished, writes all complete bands
+	void finishTile(int band);
+
+	int getBandHeight() { return bandHeight_; }
+
+private:
+	ImageWriter* writer_;
+	int width_;
+	int height_;
+	int window_;
+	int bandHeight_;
+	int written_;				// number of bands already written
+	vector<int> pending_;		// number of unfinished tiles in each band
+	vector<Vector3d> buffer_;	// rows of bands within the window
+	mutex mutex_;
+	condition_variable windowMoved_;
+};
+
+inline BandWindow::BandWindow(ImageWriter* writer, int width, int height, int window, int bandHeight) :
+	writer_(writer), width_(width), height_(height), window_(window), bandHeight_(bandHeight), written_(0)
+{
+	int tilesPerBand = (width + TileScheduler::TILE_SIZE - 1) / TileScheduler::TILE_SIZE;
+	pending_.assign((height + bandHeight - 1) / bandHeight, tilesPerBand);
+	buffer_.resize(window * bandHeight * width);
+}
+
+inline Vector3d* BandWindow::acquire(int band)
+{
+	unique_lock<mutex> lock(mutex_);
+	while(band >= written_ + window_)
+		windowMoved_.wait(lock);
+
+	return &buffer_[(band % window_) * bandHeight_ * width_];
+}
+
+inline void BandWindow::finishTile(int band)
+{
+	lock_guard<mutex> lock(mutex_);
+	if(--pending_[band] > 0)
+		return;
+
+	// write all complete bands following the already written ones
+	while(written_ < (int)pending_.size() && pending_[written_] == 0) {
+		int rows = min(bandHeight_, height_ - written_ * bandHeight_);
+		writer_->writeRows(&buffer_[(written_ % window_) * bandHeight_ * width_], rows);
+		written_++;
+	}
+	windowMoved_.notify_all();
+}
+
+#endif
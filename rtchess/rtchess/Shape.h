@@ -1,25 +1,41 @@
 #ifndef _SHAPE_H_
 #define _SHAPE_H_
 
+#include <vector>
 #include "Vector3d.h"
 #include "Ray.h"
 
 using namespace std;
 
+class PrimitiveSet;
+
 #define MIN(a, b) (a) < (b) ? (a) : (b)
 #define MAX(a, b) (a) > (b) ? (a) : (b)
 
 //! Material of the shape. 
 struct Material 
 {
-	Material() : color(Vector3d(0.0, 0.0, 0.0)), reflection(0.0), transparency(0.0), refractIdx(0.0), shininess(4.0) { }
+	//! Shading kernel of the material - the secondary rays its hits cast (flags)
+	enum Kernel {
+		KERNEL_DIFFUSE = 0,
+		KERNEL_REFLECTIVE = 1,
+		KERNEL_TRANSPARENT = 2,
+		KERNEL_REFLECTIVE_TRANSPARENT = 3
+	};
+
+	Material() : color(Vector3d(0.0, 0.0, 0.0)), reflection(0.0), transparency(0.0), refractIdx(0.0), shininess(4.0) { classify(); }
 	Material(Vector3d& color, double reflection, double transparency, double refractiveIndex, double shininess) : 
-		color(color), reflection(reflection), transparency(transparency), refractIdx(refractiveIndex), shininess(shininess) { }
+		color(color), reflection(reflection), transparency(transparency), refractIdx(refractiveIndex), shininess(shininess) { classify(); }
+
+	//! Picks the kernel by the coefficients, called again (before rendering) once they change
+	void classify() { kernel = (Kernel)((reflection > 0.0 ? KERNEL_REFLECTIVE : 0) | (transparency > 0.0 ? KERNEL_TRANSPARENT : 0)); }
+
 	Vector3d color;			// RGB, <0.0 - 1.0>
 	double reflection;		// <0.0 - 1.0>
 	double transparency;	// <0.0 - 1.0>
 	double refractIdx;
 	double shininess;
+	Kernel kernel;
 };
 
 class Shape
@@ -33,6 +49,8 @@ public:
 		Vector3d normal;
 		double t;		
 		Shape* obj;
+		int object;				// index of the object in the model (set by the ray tracer)
+		PrimitiveSet* shapes;	// shapes of the object the hit belongs to - full, proxy or level of detail (set by the ray tracer)
 	};
 
 	//! Calculates coordinates of intersection with given ray.
@@ -101,20 +119,17 @@ inline bool Sphere::intersects(const Ray& ray, Intersection& info)
 
 Vector3d Sphere::minCoords()
 {
-	std::cerr << "Sphere::minCoords() - not yet implemented." << std::endl;
-	exit(1);
+	return center_ - Vector3d(radius_);
 }
 
 Vector3d Sphere::maxCoords()
 {
-	std::cerr << "Sphere::maxCoords() - not yet implemented." << std::endl;
-	exit(1);
+	return center_ + Vector3d(radius_);
 }
 
 void Sphere::translate(Vector3d& t)
 {
-	std::cerr << "Sphere::maxCoords() - not yet implemented." << std::endl;
-	exit(1);
+	center_ += t;
 }
 
 class Triangle: public Shape
@@ -0,0 +1,140 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <string>
+#include <fstream>
+#include <chrono>
+
+using namespace std;
+
+//! Counters and stage times of one rendering
+/*!
+	Each rendering thread counts into its own instance (no synchronization on
+	the hot path), the instances are merged when the thread finishes. Stage
+	times of the threads are summed, so they are in thread-seconds, while the
+	total time is the wall time of the rendering.
+*/
+struct RenderStats
+{
+	RenderStats() { reset(); }
+
+	void reset();
+
+	//! Adds the counters and times of other thread
+	void merge(const RenderStats& other);
+
+	long long rays() const { return primaryRays + shadowRays + reflectionRays + refractionRays; }
+
+	//! Writes the statistics as JSON object
+	void writeJson(ostream& os) const;
+
+	//! Saves the statistics as JSON file
+	/*! @return false if the file cannot be opened.
+	*/
+	bool saveJson(const string& fileName) const;
+
+	// rays by type
+	long long primaryRays;
+	long long shadowRays;
+	long long reflectionRays;
+	long long refractionRays;
+
+	long long boundingBoxTests;		// intersection tests with bounding boxes
+	long long triangleTests;		// intersection tests with the shapes of objects
+	long long hits;					// rays hitting some object
+	long long traversalSteps;		// objects whose shapes were tested (bounding box passed)
+	long long culledLights;			// lights skipped at shaded points for their low contribution
+	long long cachedReflections;	// reflections of the primary hits taken from the reflection cache (not traced)
+
+	// time of the stages in seconds
+	double visibilityTime;			// rasterization of the visibility buffers
+	double rayGenerationTime;		// primary ray directions
+	double tracingTime;				// tracing and shading
+	double outputTime;				// writing the image files
+	double totalTime;				// wall time of the rendering
+};
+
+//! Measures the time elapsed since the construction (or the last lap)
+class StopWatch
+{
+public:
+	StopWatch() : start_(chrono::high_resolution_clock::now()) { }
+
+	//! Returns seconds elapsed since the last lap and starts a new one
+	double lap() {
+		chrono::high_resolution_clock::time_point now = chrono::high_resolution_clock::now();
+		double s = chrono::duration<double>(now - start_).count();
+		start_ = now;
+		return s;
+	}
+
+private:
+	chrono::high_resolution_clock::time_point start_;
+};
+
+inline void RenderStats::reset()
+{
+	primaryRays = shadowRays = reflectionRays = refractionRays = 0;
+	boundingBoxTests = triangleTests = hits = traversalSteps = culledLights = cachedReflections = 0;
+	visibilityTime = rayGenerationTime = tracingTime = outputTime = totalTime = 0.0;
+}
+
+inline void RenderStats::merge(const RenderStats& other)
+{
+	primaryRays += other.primaryRays;
+	shadowRays += other.shadowRays;
+	reflectionRays += other.reflectionRays;
+	refractionRays += other.refractionRays;
+	boundingBoxTests += other.boundingBoxTests;
+	triangleTests += other.triangleTests;
+	hits += other.hits;
+	traversalSteps += other.traversalSteps;
+	culledLights += other.culledLights;
+	cachedReflections += other.cachedReflections;
+	visibilityTime += other.visibilityTime;
+	rayGenerationTime += other.rayGenerationTime;
+	tracingTime += other.tracingTime;
+	outputTime += other.outputTime;
+}
+
+inline void RenderStats::writeJson(ostream& os) const
+{
+	long long total = rays();
+
+	os << "{\n"
+	   << "  \"rays\": {\n"
+	   << "    \"primary\": " << primaryRays << ",\n"
+	   << "    \"shadow\": " << shadowRays << ",\n"
+	   << "    \"reflection\": " << reflectionRays << ",\n"
+	   << "    \"refraction\": " << refractionRays << ",\n"
+	   << "    \"total\": " << total << "\n"
+	   << "  },\n"
+	   << "  \"boundingBoxTests\": " << boundingBoxTests << ",\n"
+	   << "  \"triangleTests\": " << triangleTests << ",\n"
+	   << "  \"hits\": " << hits << ",\n"
+	   << "  \"traversalSteps\": " << traversalSteps << ",\n"
+	   << "  \"averageTraversalSteps\": " << ((total > 0) ? (double)traversalSteps / total : 0.0) << ",\n"
+	   << "  \"culledLights\": " << culledLights << ",\n"
+	   << "  \"cachedReflections\": " << cachedReflections << ",\n"
+	   << "  \"seconds\": {\n"
+	   << "    \"visibility\": " << visibilityTime << ",\n"
+	   << "    \"rayGeneration\": " << rayGenerationTime << ",\n"
+	   << "    \"tracing\": " << tracingTime << ",\n"
+	   << "    \"output\": " << outputTime << ",\n"
+	   << "    \"total\": " << totalTime << "\n"
+	   << "  },\n"
+	   << "  \"raysPerSecond\": " << ((totalTime > 0.0) ? total / totalTime : 0.0) << "\n"
+	   << "}\n";
+}
+
+inline bool RenderStats::saveJson(const string& fileName) const
+{
+	ofstream ofs(fileName);
+	if(ofs.fail())
+		return false;
+
+	writeJson(ofs);
+	return true;
+}
+
+#endif
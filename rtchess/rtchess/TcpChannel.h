@@ -0,0 +1,280 @@
+#ifndef _TCPCHANNEL_H_
+#define _TCPCHANNEL_H_
+
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#undef near		// obsolete pointer qualifiers, common names of variables
+#undef far
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#ifdef _WIN32
+typedef SOCKET socket_t;
+const socket_t NO_SOCKET = INVALID_SOCKET;
+#else
+typedef int socket_t;
+const socket_t NO_SOCKET = -1;
+#endif
+
+//! TCP connection - text lines and blocks of bytes in both directions
+/*!
+	The connection is a plain socket, copies refer to the same connection
+	and it must be closed once.
+*/
+class TcpConnection
+{
+public:
+	TcpConnection(socket_t socket = NO_SOCKET) : socket_(socket) { }
+
+	bool isOpen() const { return socket_ != NO_SOCKET; }
+
+	//! Connects to the address "host:port"
+	bool connect(const string& address);
+
+	//! Reads fail when nothing comes for the given time, 0 waits forever
+	void setTimeout(unsigned seconds);
+
+	//! Writes all the bytes
+	bool write(const char* data, size_t size);
+	bool write(const string& text) { return write(text.data(), text.size()); }
+
+	//! Reads the next line (without the end of line), false at the end of the connection
+	bool readLine(string& line);
+
+	//! Reads exactly the given number of bytes
+	bool read(char* data, size_t size);
+
+	void close();
+
+	//! Initializes the sockets of the process (Windows), called by the first connection
+	static bool startup();
+
+private:
+	//! Reads more data into the buffer, false at the end of the connection
+	bool fill();
+
+	socket_t socket_;
+	string buffer_;		// data read but not returned yet
+};
+
+//! Listening end of the TCP channel
+class TcpListener
+{
+public:
+	TcpListener() : socket_(NO_SOCKET) { }
+	~TcpListener() { close(); }
+
+	//! Listens on the port of all the interfaces
+	bool open(unsigned short port);
+
+	//! Waits for the next client at most the given time (milliseconds)
+	/*! @return false if no client came or the listener failed
+	*/
+	bool accept(TcpConnection& connection, int timeout);
+
+	void close();
+
+private:
+	// owns the socket - not copyable
+	TcpListener(const TcpListener&);
+	TcpListener& operator=(const TcpListener&);
+
+	socket_t socket_;
+};
+
+inline bool TcpConnection::startup()
+{
+#ifdef _WIN32
+	static bool started = false;
+	if(!started) {
+		WSADATA data;
+		started = (WSAStartup(MAKEWORD(2, 2), &data) == 0);
+	}
+	return started;
+#else
+	return true;
+#endif
+}
+
+inline bool TcpConnection::connect(const string& address)
+{
+	size_t colon = address.rfind(':');
+	if(colon == string::npos || !startup())
+		return false;
+	string host = address.substr(0, colon);
+	string port = address.substr(colon + 1);
+
+	addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo* found;
+	if(getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0)
+		return false;
+
+	for(addrinfo* a = found; a != NULL && !isOpen(); a = a->ai_next) {
+		socket_ = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+		if(isOpen() && ::connect(socket_, a->ai_addr, (int)a->ai_addrlen) != 0)
+			close();
+	}
+	freeaddrinfo(found);
+
+	// the lines are short requests, they are not delayed
+	int on = 1;
+	if(isOpen())
+		setsockopt(socket_, IPPROTO_TCP, TCP_NODELAY, (const char *)&on, sizeof(on));
+	return isOpen();
+}
+
+inline void TcpConnection::setTimeout(unsigned seconds)
+{
+#ifdef _WIN32
+	DWORD timeout = seconds * 1000;
+#else
+	timeval timeout;
+	timeout.tv_sec = seconds;
+	timeout.tv_usec = 0;
+#endif
+	setsockopt(socket_, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout));
+}
+
+inline bool TcpConnection::write(const char* data, size_t size)
+{
+	for(size_t done = 0; done < size; ) {
+#ifdef MSG_NOSIGNAL
+		int n = (int)send(socket_, data + done, (int)(size - done), MSG_NOSIGNAL);	// the peer leaving must not kill the process
+#else
+		int n = (int)send(socket_, data + done, (int)(size - done), 0);
+#endif
+		if(n <= 0)
+			return false;
+		done += n;
+	}
+	return true;
+}
+
+inline bool TcpConnection::fill()
+{
+	char buf[16384];
+	int n = (int)recv(socket_, buf, sizeof(buf), 0);
+	if(n <= 0)
+		return false;
+	buffer_.append(buf, n);
+	return true;
+}
+
+inline bool TcpConnection::readLine(string& line)
+{
+	size_t end;
+	while((end = buffer_.find('\n')) == string::npos)
+		if(!fill())
+			return false;
+
+	line = buffer_.substr(0, (end > 0 && buffer_[end - 1] == '\r') ? end - 1 : end);
+	buffer_.erase(0, end + 1);
+	return true;
+}
+
+inline bool TcpConnection::read(char* data, size_t size)
+{
+	while(buffer_.size() < size)
+		if(!fill())
+			return false;
+
+	memcpy(data, buffer_.data(), size);
+	buffer_.erase(0, size);
+	return true;
+}
+
+inline void TcpConnection::close()
+{
+	if(isOpen()) {
+#ifdef _WIN32
+		closesocket(socket_);
+#else
+		::close(socket_);
+#endif
+	}
+	socket_ = NO_SOCKET;
+}
+
+inline bool TcpListener::open(unsigned short port)
+{
+	if(!TcpConnection::startup())
+		return false;
+
+	socket_ = socket(AF_INET, SOCK_STREAM, 0);
+	if(socket_ == NO_SOCKET)
+		return false;
+
+	// the port of a previous run can be taken again at once
+	int on = 1;
+	setsockopt(socket_, SOL_SOCKET, SO_REUSEADDR, (const char *)&on, sizeof(on));
+
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port);
+	if(bind(socket_, (sockaddr *)&address, sizeof(address)) != 0 || listen(socket_, 16) != 0) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+inline bool TcpListener::accept(TcpConnection& connection, int timeout)
+{
+	fd_set ready;
+	FD_ZERO(&ready);
+	FD_SET(socket_, &ready);
+	timeval wait;
+	wait.tv_sec = timeout / 1000;
+	wait.tv_usec = (timeout % 1000) * 1000;
+	if(select((int)socket_ + 1, &ready, NULL, NULL, &wait) <= 0)
+		return false;
+
+	socket_t client = ::accept(socket_, NULL, NULL);
+	if(client == NO_SOCKET)
+		return false;
+
+	int on = 1;
+	setsockopt(client, IPPROTO_TCP, TCP_NODELAY, (const char *)&on, sizeof(on));
+	connection = TcpConnection(client);
+	return true;
+}
+
+inline void TcpListener::close()
+{
+	if(socket_ != NO_SOCKET) {
+#ifdef _WIN32
+		closesocket(socket_);
+#else
+		::close(socket_);
+#endif
+	}
+	socket_ = NO_SOCKET;
+}
+
+#endif
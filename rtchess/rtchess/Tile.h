@@ -0,0 +1,18 @@
+#ifndef _TILE_H_
+#define _TILE_H_
+
+//! Rectangular part of the screen, in pixels
+struct Tile
+{
+	Tile() : x(0), y(0), width(0), height(0) { }
+	Tile(int x, int y, int width, int height) : x(x), y(y), width(width), height(height) { }
+
+	int size() const { return width * height; }
+
+	int x;			// left column
+	int y;			// top row
+	int width;
+	int height;
+};
+
+#endif
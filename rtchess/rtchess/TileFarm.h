@@ -0,0 +1,311 @@
+#ifndef _TILEFARM_H_
+#define _TILEFARM_H_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <sstream>
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "RayTracer.h"
+#include "Scheduler.h"
+#include "TcpChannel.h"
+
+using namespace std;
+
+//! Range of the tiles of the screen (indices in the order of TileScheduler::addView)
+struct TileRange
+{
+	TileRange(int first = 0, int count = 0) : first(first), count(count) { }
+	int first;
+	int count;
+};
+
+//! Coordinator of the distributed rendering of one image
+/*!
+	The workers (processes rendering the same scene, see TileWorker) connect
+	over TCP and get the ranges of the tiles of the screen one by one. Each
+	worker returns the pixels of its range, the coordinator copies them into
+	the image. A range of a worker which disconnects (or sends nothing for
+	the timeout) is queued again for the other workers.
+
+	The protocol (text lines, the pixels are raw doubles, 3 per pixel, tile by
+	tile, row by row):
+
+		worker:			worker <width> <height>
+		coordinator:	tiles <first> <count>
+		worker:			pixels <first> <count> <bytes>
+						<bytes of the pixels>
+		...
+		coordinator:	done
+*/
+class TileCoordinator
+{
+public:
+	TileCoordinator(int width, int height, int tilesPerRange = DEFAULT_TILES_PER_RANGE, unsigned timeout = DEFAULT_TIMEOUT);
+
+	//! Waits for the workers on the port until all the tiles are rendered into the image
+	/*! @return false if the port cannot be opened
+	*/
+	bool run(unsigned short port, Vector3d* image);
+
+	//! Ranges queued again after their worker failed
+	int getRequeued() { return requeued_; }
+
+	//! Workers which have connected
+	int getWorkers() { return workers_; }
+
+	static const int DEFAULT_TILES_PER_RANGE;
+	static const unsigned DEFAULT_TIMEOUT;
+
+private:
+	//! Takes the next range, waits while the others are being rendered
+	/*! @return false if all the tiles are finished
+	*/
+	bool take(TileRange& range);
+
+	//! Marks the range finished (or queues it again if it failed)
+	void finish(TileRange& range, bool rendered);
+
+	bool finished();
+
+	//! Hands the ranges to one worker until all the tiles are finished or the worker fails
+	void serve(TcpConnection worker, Vector3d* image);
+
+	//! Receives the pixels of the range into the image
+	bool receive(TcpConnection& worker, TileRange& range, Vector3d* image);
+
+	void log(const string& message);
+
+	int width_;
+	int height_;
+	unsigned timeout_;
+	TileScheduler tiles_;		// all the tiles of the screen
+	deque<TileRange> pending_;	// ranges waiting for a worker
+	int outstanding_;			// ranges being rendered
+	int requeued_;
+	int workers_;
+	mutex mutex_;
+	condition_variable changed_;
+};
+
+//! Worker of the distributed rendering
+class TileWorker
+{
+public:
+	//! Connects to the coordinator ("host:port") and renders the tiles it gets until it is done
+	/*! @return false if the coordinator cannot be reached or refused the worker
+	*/
+	static bool run(const string& address, RayTracer& rayTracer);
+};
+
+const int TileCoordinator::DEFAULT_TILES_PER_RANGE = 8;
+const unsigned TileCoordinator::DEFAULT_TIMEOUT = 300;
+
+inline TileCoordinator::TileCoordinator(int width, int height, int tilesPerRange, unsigned timeout) :
+	width_(width), height_(height), timeout_(timeout), outstanding_(0), requeued_(0), workers_(0)
+{
+	tiles_.addView(0, width, height);
+	tilesPerRange = max(tilesPerRange, 1);
+	for(int first = 0; first < tiles_.size(); first += tilesPerRange)
+		pending_.push_back(TileRange(first, min(tilesPerRange, tiles_.size() - first)));
+}
+
+inline bool TileCoordinator::run(unsigned short port, Vector3d* image)
+{
+	TcpListener listener;
+	if(!listener.open(port))
+		return false;
+
+	ostringstream message;
+	message << "Waiting for the workers on port " << port << ", " << pending_.size() << " ranges of " << tiles_.size() << " tiles";
+	log(message.str());
+
+	// the workers may come (and go) at any time until the image is finished
+	vector<thread> served;
+	while(!finished()) {
+		TcpConnection worker;
+		if(listener.accept(worker, 200))
+			served.push_back(thread(&TileCoordinator::serve, this, worker, image));
+	}
+	listener.close();
+
+	for(int i = 0; i < (int)served.size(); i++)
+		served.at(i).join();
+	return true;
+}
+
+inline bool TileCoordinator::take(TileRange& range)
+{
+	unique_lock<mutex> lock(mutex_);
+	while(pending_.empty() && outstanding_ > 0)
+		changed_.wait(lock);
+	if(pending_.empty())
+		return false;
+
+	range = pending_.front();
+	pending_.pop_front();
+	outstanding_++;
+	return true;
+}
+
+inline void TileCoordinator::finish(TileRange& range, bool rendered)
+{
+	lock_guard<mutex> lock(mutex_);
+	outstanding_--;
+	if(!rendered) {
+		pending_.push_front(range);
+		requeued_++;
+	}
+	changed_.notify_all();
+}
+
+inline bool TileCoordinator::finished()
+{
+	lock_guard<mutex> lock(mutex_);
+	return pending_.empty() && outstanding_ == 0;
+}
+
+inline void TileCoordinator::serve(TcpConnection worker, Vector3d* image)
+{
+	worker.setTimeout(timeout_);
+
+	// the worker must render the same screen
+	string line;
+	int width = 0, height = 0;
+	if(!worker.readLine(line) || sscanf(line.c_str(), "worker %d %d", &width, &height) != 2 || width != width_ || height != height_) {
+		worker.write("error wrong resolution\n");
+		worker.close();
+		log("Refused the worker: " + line);
+		return;
+	}
+
+	int id;
+	{
+		lock_guard<mutex> lock(mutex_);
+		id = ++workers_;
+	}
+	ostringstream name;
+	name << "worker " << id;
+	log(name.str() + " connected");
+
+	TileRange range;
+	while(take(range)) {
+		ostringstream request;
+		request << "tiles " << range.first << " " << range.count << "\n";
+		bool rendered = worker.write(request.str()) && receive(worker, range, image);
+		finish(range, rendered);
+		if(!rendered) {
+			ostringstream lost;
+			lost << name.str() << " lost, tiles " << range.first << "-" << range.first + range.count - 1 << " queued again";
+			log(lost.str());
+			worker.close();
+			return;
+		}
+	}
+
+	worker.write("done\n");
+	worker.close();
+	log(name.str() + " done");
+}
+
+inline bool TileCoordinator::receive(TcpConnection& worker, TileRange& range, Vector3d* image)
+{
+	string line;
+	int first, count;
+	unsigned long bytes;
+	if(!worker.readLine(line) || sscanf(line.c_str(), "pixels %d %d %lu", &first, &count, &bytes) != 3 || first != range.first || count != range.count)
+		return false;
+
+	size_t pixels = 0;
+	for(int i = 0; i < count; i++)
+		pixels += tiles_.at(first + i).tile.size();
+	if((size_t)bytes != pixels * 3 * sizeof(double))
+		return false;
+
+	// the range is copied only when it is complete, a failed worker leaves no pixels
+	vector<double> data(pixels * 3);
+	if(!worker.read((char *)&data[0], bytes))
+		return false;
+
+	size_t k = 0;
+	for(int i = 0; i < count; i++) {
+		Tile& tile = tiles_.at(first + i).tile;
+		for(int y = tile.y; y < tile.y + tile.height; y++)
+			for(int x = tile.x; x < tile.x + tile.width; x++, k += 3)
+				image[y * width_ + x] = Vector3d(data[k], data[k + 1], data[k + 2]);
+	}
+	return true;
+}
+
+inline void TileCoordinator::log(const string& message)
+{
+	lock_guard<mutex> lock(mutex_);
+	cout << message << endl;
+}
+
+inline bool TileWorker::run(const string& address, RayTracer& rayTracer)
+{
+	TcpConnection coordinator;
+	if(!coordinator.connect(address))
+		return false;
+
+	// the screen of the coordinator is the crop window of the camera
+	Camera* camera = rayTracer.camera_;
+	Tile crop = camera->getCrop();
+	int width = crop.width;
+	int height = crop.height;
+	ostringstream hello;
+	hello << "worker " << width << " " << height << "\n";
+	coordinator.write(hello.str());
+
+	TileScheduler tiles;
+	tiles.addView(0, crop);
+	vector<Vector3d> image(width * height);
+	vector<Camera *> cameras(1, camera);
+	vector<Vector3d *> images(1, &image[0]);
+
+	// the model does not change between the ranges, the views are prepared once
+	rayTracer.prepare(cameras);
+
+	string line;
+	while(coordinator.readLine(line)) {
+		int first, count;
+		if(line == "done") {
+			coordinator.close();
+			return true;
+		}
+		if(sscanf(line.c_str(), "tiles %d %d", &first, &count) != 2 || first < 0 || count <= 0 || first + count > tiles.size())
+			break;
+
+		vector<TileScheduler::Task> tasks;
+		for(int i = first; i < first + count; i++)
+			tasks.push_back(tiles.at(i));
+		rayTracer.render(cameras, images, tasks, true);
+
+		vector<double> data;
+		for(int i = 0; i < count; i++) {
+			Tile& tile = tasks.at(i).tile;
+			for(int y = tile.y; y < tile.y + tile.height; y++)
+				for(int x = tile.x; x < tile.x + tile.width; x++) {
+					Vector3d& pixel = image[(y - crop.y) * width + x - crop.x];
+					data.push_back(pixel.x_);
+					data.push_back(pixel.y_);
+					data.push_back(pixel.z_);
+				}
+		}
+
+		ostringstream header;
+		header << "pixels " << first << " " << count << " " << data.size() * sizeof(double) << "\n";
+		if(!coordinator.write(header.str()) || !coordinator.write((const char *)&data[0], data.size() * sizeof(double)))
+			break;
+	}
+
+	cerr << "ERROR: The coordinator " << address << " failed: " << line << endl;
+	coordinator.close();
+	return false;
+}
+
+#endif
@@ -2,6 +2,12 @@
 /*!
 Standard operators +, - are overloaded to implement basic
 operations like Vector3d addition, subtraction
+
+All operators take const references and return the results by value, so
+they can be applied to temporaries without copies. With RTCHESS_SIMD
+defined (x86 with SSE2) the vector is padded to four lanes and the
+element-wise operations run two lanes at a time; the results are the same
+as with the scalar code.
 */
 
 #ifndef _Vector3d_H_
@@ -9,6 +15,9 @@ operations like Vector3d addition, subtraction
 
 #include <string>
 #include <cmath>
+#ifdef RTCHESS_SIMD
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 
@@ -18,49 +27,102 @@ typedef Vector3d Point;
 class Vector3d
 {
 public:	
+#ifdef RTCHESS_SIMD
+	Vector3d(void): w_(0.0) { }
+#else
 	Vector3d(void) { }
+#endif
+#ifdef RTCHESS_SIMD
+	Vector3d(double x, double y, double z): x_(x), y_(y), z_(z), w_(0.0) { }
+	Vector3d(double x): x_(x), y_(x), z_(x), w_(0.0) { }
+#else
 	Vector3d(double x, double y, double z): x_(x), y_(y), z_(z) { }			
 	Vector3d(double x): x_(x), y_(x), z_(x) { }	
+#endif
 	~Vector3d(void) { }
 
-	double length();		
+	double length() const;		
 
 	Vector3d& normalize();
-	double dot(Vector3d& other);
-	Vector3d cross(Vector3d& other);
-	double min();
-	double max();
-
-	Vector3d operator+(Vector3d& other) {
+	double dot(const Vector3d& other) const;
+	Vector3d cross(const Vector3d& other) const;
+	double min() const;
+	double max() const;
+
+	//! Mirror reflection of the direction about the normal
+	Vector3d reflect(const Vector3d& normal) const;
+
+	//! Refraction of the (normalized) direction by Snell's law
+	/*! The normal faces against the direction (normal.dot(direction) < 0), eta is the
+		ratio n1 / n2 of the refractive indices.
+		@return false on total internal reflection (the direction is not set)
+	*/
+	bool refract(const Vector3d& normal, double eta, Vector3d& direction) const;
+
+	//! Fraction of the (unpolarized) light reflected at the interface by the Fresnel equations
+	/*! The normal and eta are the ones of refract(), 1.0 on total internal reflection.
+	*/
+	double fresnel(const Vector3d& normal, double eta) const;
+
+	Vector3d operator+(const Vector3d& other) const {
+#ifdef RTCHESS_SIMD
+		Vector3d r;
+		_mm_storeu_pd(&r.x_, _mm_add_pd(_mm_loadu_pd(&x_), _mm_loadu_pd(&other.x_)));
+		_mm_storeu_pd(&r.z_, _mm_add_pd(_mm_loadu_pd(&z_), _mm_loadu_pd(&other.z_)));
+		return r;
+#else
 		return Vector3d(x_ + other.x_, y_ + other.y_, z_ + other.z_);
+#endif
 	}
 
-	Vector3d operator+=(Vector3d& other) {
+	Vector3d& operator+=(const Vector3d& other) {
 		x_ += other.x_;
 		y_ += other.y_;
 		z_ += other.z_;
 		return *this;
 	}
 	
-	Vector3d operator-() {
+	Vector3d operator-() const {
 		return Vector3d(-x_, -y_, -z_);
 	}
 	
-	Vector3d operator-(Vector3d& other) {
-		return *this + -other;	
+	Vector3d operator-(const Vector3d& other) const {
+#ifdef RTCHESS_SIMD
+		Vector3d r;
+		_mm_storeu_pd(&r.x_, _mm_sub_pd(_mm_loadu_pd(&x_), _mm_loadu_pd(&other.x_)));
+		_mm_storeu_pd(&r.z_, _mm_sub_pd(_mm_loadu_pd(&z_), _mm_loadu_pd(&other.z_)));
+		return r;
+#else
+		return Vector3d(x_ - other.x_, y_ - other.y_, z_ - other.z_);
+#endif
 	}
 
 	//! element-wise multiplication
-	Vector3d operator*(Vector3d& other) {
+	Vector3d operator*(const Vector3d& other) const {
+#ifdef RTCHESS_SIMD
+		Vector3d r;
+		_mm_storeu_pd(&r.x_, _mm_mul_pd(_mm_loadu_pd(&x_), _mm_loadu_pd(&other.x_)));
+		_mm_storeu_pd(&r.z_, _mm_mul_pd(_mm_loadu_pd(&z_), _mm_loadu_pd(&other.z_)));
+		return r;
+#else
 		return Vector3d(x_ * other.x_, y_ * other.y_, z_ * other.z_);
+#endif
 	}
 
-	friend Vector3d operator*(Vector3d& ours, double other) {
+	friend Vector3d operator*(const Vector3d& ours, double other) {
+#ifdef RTCHESS_SIMD
+		Vector3d r;
+		__m128d s = _mm_set1_pd(other);
+		_mm_storeu_pd(&r.x_, _mm_mul_pd(_mm_loadu_pd(&ours.x_), s));
+		_mm_storeu_pd(&r.z_, _mm_mul_pd(_mm_loadu_pd(&ours.z_), s));
+		return r;
+#else
 		return Vector3d(ours.x_ * other, ours.y_ * other, ours.z_ * other);
+#endif
 	}
 
-	friend Vector3d operator*(double other, Vector3d& ours) {
-		return Vector3d(ours.x_ * other, ours.y_ * other, ours.z_ * other);
+	friend Vector3d operator*(double other, const Vector3d& ours) {
+		return ours * other;
 	}
 
 	friend ostream& operator<<(ostream& os, const Vector3d& v) {		
@@ -70,7 +132,7 @@ public:
 		return os;
 	}	
 
-	bool operator==(Vector3d& other) {
+	bool operator==(const Vector3d& other) const {
 		return(almostEqual(x_, other.x_) && 
 			   almostEqual(y_, other.y_) &&
 			   almostEqual(z_, other.z_));
@@ -79,14 +141,17 @@ public:
 	double x_;
 	double y_;
 	double z_;	
+#ifdef RTCHESS_SIMD
+	double w_;		// padding lane, always 0.0
+#endif
 
 private:
-	bool almostEqual(double a, double b, double EPSILON = 1e-6) {
+	static bool almostEqual(double a, double b, double EPSILON = 1e-6) {
 		return fabs(a - b) < EPSILON;
 	}
 };
 
-inline double Vector3d::length() {
+inline double Vector3d::length() const {
 	return sqrt(x_*x_ + y_*y_ + z_*z_);
 }
 
@@ -99,24 +164,54 @@ inline Vector3d& Vector3d::normalize() {
 	return *this;
 }
 
-inline double Vector3d::dot(Vector3d& other) {
+inline double Vector3d::dot(const Vector3d& other) const {
 	return x_ * other.x_ + y_ * other.y_ + z_ * other.z_;
 }
 
-inline Vector3d Vector3d::cross(Vector3d& other) {
+inline Vector3d Vector3d::cross(const Vector3d& other) const {
 	return Vector3d(y_ * other.z_ - z_ * other.y_, 
 					z_ * other.x_ - x_ * other.z_, 
 					x_ * other.y_ - y_ * other.x_);
 }
 
-inline double Vector3d::min()
+inline double Vector3d::min() const
 {
 	return (x_ < y_) ? ((x_ < z_) ? x_ : z_) : ((y_ < z_) ? y_ : z_); 
 }
 
-inline double Vector3d::max()
+inline double Vector3d::max() const
 {
 	return (x_ > y_) ? ((x_ > z_) ? x_ : z_) : ((y_ > z_) ? y_ : z_); 
 }
 
+inline Vector3d Vector3d::reflect(const Vector3d& normal) const
+{
+	return *this - normal * (2.0 * dot(normal));
+}
+
+inline bool Vector3d::refract(const Vector3d& normal, double eta, Vector3d& direction) const
+{
+	double cosI = -normal.dot(*this);	// cosine of incident ray
+	double k = 1.0 - eta * eta * (1.0 - cosI * cosI);
+	if(k < 0.0)
+		return false;
+
+	direction = eta * *this + (eta * cosI - sqrt(k)) * normal;
+	return true;
+}
+
+inline double Vector3d::fresnel(const Vector3d& normal, double eta) const
+{
+	double cosI = -normal.dot(*this);
+	double k = 1.0 - eta * eta * (1.0 - cosI * cosI);
+	if(k < 0.0)
+		return 1.0;
+
+	// mean of the s and p polarized reflectances
+	double cosT = sqrt(k);
+	double rs = (eta * cosI - cosT) / (eta * cosI + cosT);
+	double rp = (eta * cosT - cosI) / (eta * cosT + cosI);
+	return 0.5 * (rs * rs + rp * rp);
+}
+
 #endif
\ No newline at end of file
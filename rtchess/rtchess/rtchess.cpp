@@ -1,5 +1,6 @@
 #include <chrono>
 #include <iostream>
+#include <sstream>
 #include "Scene.h"
 #include "RayTracer.h"
 #include "Camera.h"
@@ -9,6 +10,9 @@
 #include "Vector3d.h"
 #include "Light.h"
 #include "Shape.h"
+#include "SceneBenchmark.h"
+#include "RenderServer.h"
+#include "SceneDescription.h"
 
 using namespace std;
 
@@ -17,121 +21,404 @@ void printHelp() {
 			"\tmodel\t\t\tmodel file name (.OBJ)\n"
 			"\tconfig_chessboard\tchessboard configuration file\n"
 			"\tconfig_ray_tracer\tray tracer configuration file\n"
-			"\toutput\t\t\toutput file (.PNG)" 
+			"\toutput\t\t\toutput file (.PNG, .PPM or .RAW)\n"
+			"\tthe compiled scene might be given instead of both configuration files (in all the modes)\n\n"
+			"       rtchess -compile config_chessboard config_ray_tracer scene\n"
+			"\tvalidates the configuration files and saves them as the compiled scene (binary)\n\n"
+			"       rtchess -estimate model config_chessboard config_ray_tracer\n"
+			"       rtchess -estimate model scene\n"
+			"\testimates the rays and the intersection tests of the rendering without tracing\n\n"
+			"       rtchess -benchmark model config_ray_tracer [results] [resolutions] [threads]\n"
+			"\tresults\t\t\tresults file (.JSON), default benchmark.json\n"
+			"\tresolutions\t\tcomma separated list, default 320x240,640x480\n"
+			"\tthreads\t\t\tcomma separated list, 0 - all hardware threads, default 1,0\n\n"
+			"       rtchess -compare model config_chessboard config_ray_tracer output\n"
+			"\trenders also the reference without the approximations (proxies, levels of detail) and compares the images\n\n"
+			"       rtchess -server model channel [workers] [queue]\n"
+			"\tchannel\t\t\tpath of the Unix domain socket (name of the pipe on Windows)\n"
+			"\tworkers\t\t\tjobs rendered at once, default 1\n"
+			"\tqueue\t\t\tjobs waiting at most, default 64\n\n"
+			"       rtchess -client channel config_chessboard config_ray_tracer output [priority]\n"
+			"\tsends the job (the compiled scene) to the server, the output is written by the server\n\n"
+			"       rtchess -shutdown channel\n"
+			"\tstops the server when the queued jobs are rendered\n\n"
+			"       rtchess -coordinator port[:tiles] model config_chessboard config_ray_tracer output\n"
+			"\trenders the image by the workers connecting to the port, tiles per request default 8\n\n"
+			"       rtchess -worker host:port model config_chessboard config_ray_tracer\n"
+			"\trenders the tiles of the coordinator, the scene must be the same"
 		 << endl;
 }
 
-//! extracts vector from config file format to Vector3d format
-Vector3d extractVector(string value)
+//! Loads the scene description - the compiled scene (one file) or the chessboard and ray tracer configuration files
+/*! Exits on an error, the description is validated.
+*/
+void loadScene(SceneDescription& description, vector<string>& files)
 {
-	int idxFirst = value.find_first_of('[') + 1;
-	int idxSecond = value.find_first_of(',', idxFirst) + 1;
-	int idxThird = value.find_first_of(',', idxSecond) + 1;
-	int idxEnd = value.find_first_of(']', idxThird) + 1;
+	string error;
+	bool loaded = (files.size() == 1) ? description.load(files.at(0), error) :
+		description.loadBoard(files.at(0), error) && description.loadSettings(files.at(1), error);
+	if(!loaded) {
+		cerr << "ERROR: " << error << endl;
+		exit(1);
+	}
+}
+
+//! Number of the files of the scene starting at the argument - 1 if it is compiled, the configuration files otherwise
+int sceneFiles(int argc, char** argv, int first)
+{
+	return (argc > first && SceneDescription::isCompiled(argv[first])) ? 1 : 2;
+}
 
-	double x = atof(value.substr(idxFirst, idxSecond - idxFirst - 1).c_str());
-	double y = atof(value.substr(idxSecond, idxThird - idxSecond - 1).c_str());
-	double z = atof(value.substr(idxThird, idxThird - idxEnd).c_str());
+//! Sets the materials of the description to the chessboard (the description keeps them)
+void setMaterials(Chess& chess, SceneDescription& description)
+{
+	chess.setWhitePieceMaterial(&description.whitePiece);
+	chess.setBlackPieceMaterial(&description.blackPiece);
+	chess.setWhiteFieldMaterial(&description.whiteField);
+	chess.setBlackFieldMaterial(&description.blackField);
+}
 
-	return Vector3d(x, y, z);
+//! Applies the settings to the scene (the proxies and the levels of detail must be created by the caller)
+void setupScene(Scene& scene, SceneDescription& description)
+{
+	RenderSettings& settings = description.settings;
+	scene.setRecursionDepth(description.depth);
+	scene.setBackgroundColor(description.bgrdColor);
+	scene.setRasterizePrimary(settings.rasterizePrimary);
+	scene.setThreads(settings.threads);
+	settings.format.threads = settings.threads;
+	scene.setOutputFormat(settings.format);
+	scene.setHeatmap(settings.heatmap, settings.heatmapTiles);
+	scene.setShadowSampling(settings.shadowSamples, settings.shadowProbes);
+	scene.setLightThreshold(settings.lightThreshold);
+	scene.setFresnelThreshold(settings.fresnelThreshold);
+	scene.setBoardGrid(settings.boardGrid);
+	scene.setBvhRebuild(settings.bvhRebuild);
+	if(settings.proxyTriangles > 0)
+		scene.setProxies(settings.proxyShadows, settings.proxyBounce);
+	if(settings.lodLevels > 0)
+		scene.setLod(settings.lodPixels);
+	for(int i = 0; i < (int)settings.lights.size(); i++) {
+		LightSettings& added = settings.lights.at(i);
+		scene.addLight(added.position, added.color, added.intensity, added.radius, added.range);
+	}
+	for(int i = 0; i < (int)settings.views.size(); i++)
+		scene.addView(settings.views.at(i).position, settings.views.at(i).direction, settings.views.at(i).outputFile);
 }
 
-//! Parse ray tracer configuration file
-void configureScene(string& configRTFile, Camera& camera, Light& light, int& depth, Vector3d& bgrdColor,
-					Material& wPieceMat, Material& bPieceMat, Material& wFieldMat, Material& bFieldMat)
-{	
-	Vector3d position;
-	Vector3d direction;
-	int width;
-	int height;
-	double fov;
-	
-	//debug
-	cout << "Loading configuration file " << configRTFile << "..." << endl;		
+//! Renders the canonical benchmark scenes and saves the results
+int runBenchmark(string& modelFile, string& configRTFile, string& resultsFile, string& resolutions, string& threads)
+{
+	Chess chess(modelFile);
 
-	ifstream file(configRTFile);	
-	if(file.fail()) {
-		cerr << "ERROR: The file " << configRTFile << " cannot be opened." << endl;
+	// the benchmark places the pieces itself, a compiled scene might be given instead of the configuration
+	SceneDescription description;
+	string error;
+	bool loaded = SceneDescription::isCompiled(configRTFile) ? description.load(configRTFile, error) : description.loadSettings(configRTFile, error);
+	if(!loaded) {
+		cerr << "ERROR: " << error << endl;
 		exit(1);
-	}	
-			
-	string line;
-	char propertyBuf[50];
-	char valueBuf[50];		
-	while(getline(file, line)) {
-		if(line[0] == '#') continue;	// commentary
-		
-		sscanf(line.c_str(), "%s %s", propertyBuf, valueBuf);
-		string prop(propertyBuf);
-		string val(valueBuf);
-
-		if	   (prop.find("camera-position") != string::npos) {
-			position = extractVector(val);
-			//camera.setPosition(extractVector(val));
-		}
-		else if(prop.find("direction") != string::npos) {
-			direction = extractVector(val);
-			//camera.setDirection(extractVector(val));
-		}
-		else if(prop.find("width") != string::npos)	{
-			width = atoi(val.c_str());
-			//camera.setResolution(atoi(val.c_str()), camera.getScreenHeight());
-		}
-		else if(prop.find("height") != string::npos) {
-			height = atoi(val.c_str());
-			//camera.setResolution(camera.getScreenWidth(), atoi(val.c_str()));
-		}
-		else if(prop.find("fov") != string::npos)	{
-			fov = atoi(val.c_str());
-			//camera.setFieldOfView(atoi(val.c_str()));
+	}
+	Camera camera = description.camera();
+	Light light = description.light();
+	RenderSettings& settings = description.settings;
+
+	SceneBenchmark benchmark(chess, camera, light, description.bgrdColor);
+	benchmark.setMaterials(&description.whitePiece, &description.blackPiece, &description.whiteField, &description.blackField);
+	benchmark.setRasterizePrimary(settings.rasterizePrimary);
+	benchmark.setShadowSampling(settings.shadowSamples, settings.shadowProbes);
+
+	// lists "320x240,640x480" and "1,2,4"
+	istringstream resolutionList(resolutions);
+	string item;
+	while(getline(resolutionList, item, ',')) {
+		int width, height;
+		if(sscanf(item.c_str(), "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+			cerr << "ERROR: wrong resolution: " << item << endl;
+			exit(1);
 		}
-		else if(prop.find("light-position") != string::npos)			light.center_ = extractVector(val);
-		else if(prop.find("depth") != string::npos)						depth = atoi(val.c_str());
-		else if(prop.find("bgrd-color") != string::npos)				bgrdColor = extractVector(val);
-		else if(prop.find("white-piece-color") != string::npos)			wPieceMat.color = extractVector(val);
-		else if(prop.find("white-piece-reflectivity") != string::npos)	wPieceMat.reflection = atof(val.c_str());
-		else if(prop.find("white-piece-shininess") != string::npos)		wPieceMat.shininess = atof(val.c_str());
-		else if(prop.find("black-piece-color") != string::npos)			bPieceMat.color = extractVector(val);
-		else if(prop.find("black-piece-reflectivity") != string::npos)	bPieceMat.reflection = atof(val.c_str());
-		else if(prop.find("black-piece-shininess") != string::npos)		bPieceMat.shininess = atof(val.c_str());
-		else if(prop.find("white-field-color") != string::npos)			wFieldMat.color = extractVector(val);
-		else if(prop.find("white-field-reflectivity") != string::npos)	wFieldMat.reflection = atof(val.c_str());
-		else if(prop.find("white-field-shininess") != string::npos)		wFieldMat.shininess = atof(val.c_str());
-		else if(prop.find("black-field-color") != string::npos)			bFieldMat.color = extractVector(val);
-		else if(prop.find("black-field-reflectivity") != string::npos)	bFieldMat.reflection = atof(val.c_str());
-		else if(prop.find("black-field-shininess") != string::npos)		bFieldMat.shininess = atof(val.c_str());
-	}
-
-	camera = Camera(position, direction, width, height, fov);
+		benchmark.addResolution(width, height);
+	}
+
+	istringstream threadList(threads);
+	while(getline(threadList, item, ','))
+		benchmark.addThreads(atoi(item.c_str()));
+
+	benchmark.run();
+
+	cout << endl;
+	benchmark.print(cout);
+
+	ofstream ofs(resultsFile);
+	if(ofs.fail()) {
+		cerr << "ERROR: The file " << resultsFile << " cannot be opened." << endl;
+		exit(1);
+	}
+	benchmark.writeJson(ofs);
+	cout << "Results saved to " << resultsFile << endl;
+
+	return 0;
+}
+
+//! Renders the job of the server
+bool renderJob(RenderWorker& worker, RenderJob& job, string& error)
+{
+	// the clients send the compiled scene, the configuration files are parsed (and checked) here
+	SceneDescription description;
+	if(!job.scene.empty()) {
+		istringstream scene(job.scene);
+		if(!description.read(scene, error))
+			return false;
+	} else {
+		istringstream board(job.board);
+		istringstream config(job.settings);
+		if(!description.readBoard(board, error) || !description.readSettings(config, error))
+			return false;
+	}
+	RenderSettings& settings = description.settings;
+
+	worker.chess.place(description.board);
+	worker.whitePiece = description.whitePiece;
+	worker.blackPiece = description.blackPiece;
+	worker.whiteField = description.whiteField;
+	worker.blackField = description.blackField;
+	worker.chess.setWhitePieceMaterial(&worker.whitePiece);
+	worker.chess.setBlackPieceMaterial(&worker.blackPiece);
+	worker.chess.setWhiteFieldMaterial(&worker.whiteField);
+	worker.chess.setBlackFieldMaterial(&worker.blackField);
+
+	Camera camera = description.camera();
+	Light light = description.light();
+	Scene scene(camera, light, worker.chess.getModel());
+	setupScene(scene, description);
+
+	// the model keeps the proxies and the levels of detail for the next jobs
+	if(settings.proxyTriangles > 0 && settings.proxyTriangles != worker.proxyTriangles) {
+		scene.createProxies(settings.proxyTriangles);
+		worker.proxyTriangles = settings.proxyTriangles;
+	}
+	if(settings.lodLevels > 0 && settings.lodLevels != worker.lodLevels) {
+		scene.createLods(settings.lodLevels);
+		worker.lodLevels = settings.lodLevels;
+	}
+
+	// the reflections of the last job are valid for the same lights, materials and settings
+	if(settings.reflectionCache) {
+		ostringstream compiled;
+		description.writeSettings(compiled);
+		if(compiled.str() != worker.reflectionSettings)
+			worker.reflections.clear();
+		worker.reflectionSettings = compiled.str();
+		scene.setReflectionCache(&worker.reflections);
+	}
+
+	scene.render();
+	string failedFile;
+	if(!scene.saveImage(job.output)) {
+		error = "cannot write " + job.output;
+		return false;
+	}
+	if(!scene.saveViews(failedFile)) {
+		error = "cannot write " + failedFile;
+		return false;
+	}
+	if(settings.stats)
+		scene.saveStats(job.output);
+	scene.saveHeatmaps(job.output);
+	return true;
+}
+
+//! Sends the job (or the shutdown if there are no files) to the server and prints its replies
+/*! The files are those of the scene and the output, the scene is validated and compiled here.
+*/
+int runClient(string channel, vector<string>& files, int priority)
+{
+	RenderJob job;
+	if(!files.empty()) {
+		SceneDescription description;
+		vector<string> scene(files.begin(), files.end() - 1);
+		loadScene(description, scene);
+		ostringstream compiled;
+		description.write(compiled);
+		job.scene = compiled.str();
+		job.output = files.back();
+		job.priority = priority;
+	}
+
+	LocalConnection server;
+	if(!server.connect(channel)) {
+		cerr << "ERROR: Cannot connect to " << channel << endl;
+		return 1;
+	}
+
+	if(files.empty()) {
+		server.write("@shutdown\n");
+	} else {
+		ostringstream message;
+		job.write(message);
+		server.write(message.str());
+	}
+
+	// the server closes the connection after the last reply
+	string line;
+	bool failed = false;
+	while(server.readLine(line)) {
+		cout << line << endl;
+		failed = failed || line.compare(0, 5, "error") == 0;
+	}
+	server.close();
+	return failed ? 1 : 0;
+}
+
+//! Compiles the configuration files into the scene file
+int runCompile(vector<string>& files, string& sceneFile)
+{
+	SceneDescription description;
+	loadScene(description, files);
+
+	string error;
+	if(!description.save(sceneFile, error)) {
+		cerr << "ERROR: " << error << endl;
+		return 1;
+	}
+	ifstream compiled(sceneFile, ios::binary | ios::ate);
+	cout << "Compiled scene saved to " << sceneFile << " (" << compiled.tellg() << " bytes)" << endl;
+	return 0;
+}
+
+//! Prints the estimated cost of the rendering of the scene (dry run, no ray is traced)
+int runEstimate(string& modelFile, vector<string>& files)
+{
+	SceneDescription description;
+	loadScene(description, files);
+
+	Chess chess(modelFile);
+	chess.place(description.board);
+	setMaterials(chess, description);
+
+	Camera camera = description.camera();
+	Light light = description.light();
+	Scene scene(camera, light, chess.getModel());
+	setupScene(scene, description);
+	if(description.settings.proxyTriangles > 0)
+		scene.createProxies(description.settings.proxyTriangles);
+	if(description.settings.lodLevels > 0)
+		scene.createLods(description.settings.lodLevels);
+
+	RenderStats estimate = scene.estimate();
+	Tile crop = camera.getCrop();
+	cout << "Estimated rendering (no rays traced)" << endl;
+	cout << "pixels:             " << crop.width << " x " << crop.height << ", " << camera.getSamplesPerPixel() << " samples per pixel, "
+		 << description.settings.views.size() + 1 << " views" << endl;
+	cout << "primary rays:       " << estimate.primaryRays << endl;
+	cout << "shadow rays:        " << estimate.shadowRays << endl;
+	cout << "reflection rays:    " << estimate.reflectionRays << endl;
+	cout << "refraction rays:    " << estimate.refractionRays << endl;
+	cout << "rays:               " << estimate.rays() << endl;
+	cout << "hits:               " << estimate.hits << endl;
+	cout << "bounding box tests: " << estimate.boundingBoxTests << endl;
+	cout << "triangle tests:     " << estimate.triangleTests << endl;
+	return 0;
 }
 
 int main(int argc, char** argv)
 {
+	// benchmark mode
+	if(argc >= 4 && string(argv[1]) == "-benchmark") {
+		string modelFile(argv[2]);
+		string configRTFile(argv[3]);
+		string resultsFile = (argc > 4) ? argv[4] : "benchmark.json";
+		string resolutions = (argc > 5) ? argv[5] : "320x240,640x480";
+		string threads = (argc > 6) ? argv[6] : "1,0";
+		return runBenchmark(modelFile, configRTFile, resultsFile, resolutions, threads);
+	}
+
+	// render server and its client
+	if(argc >= 4 && string(argv[1]) == "-server") {
+		string modelFile(argv[2]);
+		unsigned workers = (argc > 4) ? atoi(argv[4]) : 1;
+		size_t capacity = (argc > 5) ? atoi(argv[5]) : RenderServer::DEFAULT_CAPACITY;
+		RenderServer server(modelFile, renderJob, workers, capacity);
+		if(!server.run(argv[3])) {
+			cerr << "ERROR: Cannot open the channel " << argv[3] << endl;
+			return 1;
+		}
+		return 0;
+	}
+	if(argc >= 4 && string(argv[1]) == "-client") {
+		int last = 3 + sceneFiles(argc, argv, 3);	// the output
+		if(argc <= last) {
+			cerr << "Bad parameters!\n";
+			printHelp();
+			exit(1);
+		}
+		vector<string> files(argv + 3, argv + last + 1);
+		return runClient(argv[2], files, (argc > last + 1) ? atoi(argv[last + 1]) : 0);
+	}
+	if(argc >= 3 && string(argv[1]) == "-shutdown") {
+		vector<string> files;
+		return runClient(argv[2], files, 0);
+	}
+
+	// compiled scene and the dry run
+	if(argc >= 5 && string(argv[1]) == "-compile") {
+		vector<string> files(argv + 2, argv + 4);
+		string sceneFile(argv[4]);
+		return runCompile(files, sceneFile);
+	}
+	if(argc >= 4 && string(argv[1]) == "-estimate") {
+		string modelFile(argv[2]);
+		vector<string> files(argv + 3, argv + min(argc, 3 + sceneFiles(argc, argv, 3)));
+		if(files.size() < 2 && !SceneDescription::isCompiled(files.at(0))) {
+			cerr << "Bad parameters!\n";
+			printHelp();
+			exit(1);
+		}
+		return runEstimate(modelFile, files);
+	}
+
+	// comparison with the reference rendering
+	bool compare = (argc >= 2 && string(argv[1]) == "-compare");
+	if(compare) {
+		argv++;
+		argc--;
+	}
+
+	// distributed rendering - the image is rendered by the workers with the same scene
+	string coordinator, worker;
+	if(argc >= 3 && (string(argv[1]) == "-coordinator" || string(argv[1]) == "-worker")) {
+		(string(argv[1]) == "-worker" ? worker : coordinator) = argv[2];
+		argv += 2;
+		argc -= 2;
+	}
+
 	// For now the model file to be loaded is specifed as 1. parameter
 	// TODO - exceptions
-	if(argc < 5) {
+	// (the worker has no output, the scene might be compiled into one file)
+	int files = sceneFiles(argc, argv, 2);
+	if(argc < 2 + files + (worker.empty() ? 1 : 0)) {
 		cerr << "Bad parameters!\n";
 		printHelp();
 		exit(1);
 	}
 
 	string modelFile = string(argv[1]);	
-	string configChessboardFile = string(argv[2]);
-	string configRTFile = string(argv[3]);
-	string outputFile = string(argv[4]);		
+	vector<string> sceneFileNames(argv + 2, argv + 2 + files);
+	string outputFile = (argc > 2 + files) ? string(argv[2 + files]) : string();		
+
+	// Load and validate the scene description
+	cout << "Loading scene " << sceneFileNames.at(0) << ((files > 1) ? ", " + sceneFileNames.at(1) : string()) << "..." << endl;
+	SceneDescription description;
+	loadScene(description, sceneFileNames);
+	RenderSettings& settings = description.settings;
 
 	// Prepare chessboard
-	Chess chess(modelFile, configChessboardFile, configRTFile);
+	Chess chess(modelFile);
+	chess.place(description.board);
 
 	// Prepare scene, raytracer, adjust model colors
-	Camera camera2;
-	Light light2;
-	int depth;
-	Vector3d bgrdColor;
-	Material whitePieceMaterial, blackPieceMaterial, whiteFieldMaterial, blackFieldMaterial;
-
-	configureScene(configRTFile, camera2, light2, depth, bgrdColor, 
-		whitePieceMaterial, blackPieceMaterial, whiteFieldMaterial, blackFieldMaterial);
+	Camera camera2 = description.camera();
+	Light light2 = description.light();
 
 	//debug
 	cout << "Camera: " << endl;
@@ -141,39 +428,37 @@ int main(int argc, char** argv)
 	cout << "height: " << camera2.getScreenHeight() << endl;
 	cout << "fov: " << camera2.getFieldOfView() << endl;
 
-	chess.setWhitePieceMaterial(&whitePieceMaterial);
-	chess.setBlackPieceMaterial(&blackPieceMaterial);
-	chess.setWhiteFieldMaterial(&whiteFieldMaterial);
-	chess.setBlackFieldMaterial(&blackFieldMaterial);
-
-	// Set camera					
-	Point position(-6.0, -3.0, 6.0);
-	Vector3d direction = Vector3d(4.0, 3.0, -2.0).normalize();
-	/*Point position(0.182, 2.459, 1.930);
-	Vector3d direction = Vector3d(0.8664, 0.3339, -0.3714).normalize();	*/
-	
-	double fieldOfView = 45.0;
-	int width = 80;
-	int height = 60;
-	/*int width = 3840;
-	int height = 2016;*/
-
-	Camera camera(position, direction, width, height, fieldOfView);
-
-	// Set light
-	Material lightMaterial(Vector3d(1.0, 1.0, 1.0), 0.0, 0.0, 0.0, 0.0);
-	Light light(Vector3d(-0.05, 8.432, 3.769), 0.0, &lightMaterial);
+	setMaterials(chess, description);
 
 	// Create scene and fill it with model	
 	Scene scene(camera2, light2, chess.getModel());
-	scene.setRecursionDepth(depth);
-	scene.setBackgroundColor(bgrdColor);
+	setupScene(scene, description);
+	if(settings.proxyTriangles > 0)
+		scene.createProxies(settings.proxyTriangles);
+	if(settings.lodLevels > 0)
+		scene.createLods(settings.lodLevels);
 
 	// debug - measure a time of rendering
 	std::chrono::high_resolution_clock::time_point tStart = std::chrono::high_resolution_clock::now();
 
-	// Render
-	scene.render();
+	if(!worker.empty())
+		return scene.renderWorker(worker) ? 0 : 1;
+
+	// Render (the comparison needs the image in memory)
+	if(!coordinator.empty()) {
+		int port = 0, tiles = TileCoordinator::DEFAULT_TILES_PER_RANGE;
+		sscanf(coordinator.c_str(), "%d:%d", &port, &tiles);
+		if(port <= 0 || port > 65535 || !scene.renderDistributed((unsigned short)port, tiles)) {
+			cerr << "ERROR: Cannot listen on the port " << coordinator << endl;
+			exit(1);
+		}
+	}
+	else if(settings.streaming && !compare) {
+		if(!scene.renderStreaming(outputFile))
+			exit(1);
+	}
+	else
+		scene.render();
 
 	// debug - measure a time of rendering
 	std::chrono::high_resolution_clock::time_point tEnd = std::chrono::high_resolution_clock::now();
@@ -181,7 +466,22 @@ int main(int argc, char** argv)
 	std::cout << "Rendering time: " << (durationMsec / 1000.0) << std::endl;
 
 	// Save resulting image
-	scene.saveImage(outputFile);
+	string failedFile;
+	if(!coordinator.empty()) {
+		if(!scene.saveImage(outputFile))
+			exit(1);
+	} else if(!settings.streaming || compare) {
+		bool saved = scene.saveImage(outputFile);
+		if(!scene.saveViews(failedFile) || !saved)
+			exit(1);
+	}
+
+	if(settings.stats)
+		scene.saveStats(outputFile);
+	scene.saveHeatmaps(outputFile);
+
+	if(compare)
+		scene.compareWithReference(outputFile);
 
 	return 0;
 }
\ No newline at end of file